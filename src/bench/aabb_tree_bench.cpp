@@ -0,0 +1,155 @@
+#include "bench/benchmarks.h"
+
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "rendering/aabb_tree.h"
+#include "rendering/camera.h"
+#include "utils/logger.h"
+
+namespace sb {
+namespace bench {
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double millisecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+           .count();
+}
+
+struct Object
+{
+    Vec3 position;
+    Vec3 velocity;
+    Vec3 halfSize;
+    AABBTree::ProxyId proxy;
+
+    AABB getBox() const
+    {
+        return AABB(position - halfSize, position + halfSize);
+    }
+};
+
+} // namespace
+
+void aabbTree(unsigned frames)
+{
+    const size_t NUM_OBJECTS = 50000;
+    const float WORLD_SIZE = 500.f;
+    const float DT = 1.f / 60.f;
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> position(-WORLD_SIZE, WORLD_SIZE);
+    std::uniform_real_distribution<float> velocity(-5.f, 5.f);
+    std::uniform_real_distribution<float> size(0.2f, 2.f);
+
+    AABBTree tree;
+    std::vector<Object> objects(NUM_OBJECTS);
+
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < objects.size(); ++i) {
+        Object& o = objects[i];
+        o.position = Vec3(position(rng), position(rng), position(rng));
+        o.velocity = Vec3(velocity(rng), velocity(rng), velocity(rng));
+        o.halfSize = Vec3(size(rng), size(rng), size(rng));
+        o.proxy = tree.insert(o.getBox(), (uint32_t)i);
+    }
+    double buildTime = millisecondsSince(start);
+
+    Camera camera;
+    camera.setPerspectiveMatrix();
+
+    std::vector<uint32_t> results;
+    double moveTime = 0.0;
+    double frustumTime = 0.0;
+    double rayTime = 0.0;
+    double overlapTime = 0.0;
+    size_t reinserted = 0;
+    size_t visible = 0;
+    size_t rayHits = 0;
+    size_t overlaps = 0;
+
+    for (unsigned frame = 0; frame < frames; ++frame) {
+        start = Clock::now();
+        for (Object& o: objects) {
+            Vec3 delta = o.velocity * DT;
+            o.position += delta;
+
+            // bounce off the world bounds
+            for (int axis = 0; axis < 3; ++axis) {
+                if (o.position[axis] < -WORLD_SIZE
+                        || o.position[axis] > WORLD_SIZE) {
+                    o.velocity[axis] = -o.velocity[axis];
+                }
+            }
+
+            if (tree.move(o.proxy, o.getBox(), delta)) {
+                ++reinserted;
+            }
+        }
+        moveTime += millisecondsSince(start);
+
+        // orbit the camera so that the visible set changes every frame
+        float angle = (float)frame * 0.01f;
+        camera.lookAt(Vec3(std::cos(angle), 0.2f, std::sin(angle))
+                      * WORLD_SIZE * 1.5f,
+                      Vec3(0.f, 0.f, 0.f));
+
+        start = Clock::now();
+        results.clear();
+        tree.queryFrustum(camera, results);
+        frustumTime += millisecondsSince(start);
+        visible += results.size();
+
+        start = Clock::now();
+        for (int i = 0; i < 100; ++i) {
+            results.clear();
+            Vec3 origin(position(rng), position(rng), -WORLD_SIZE);
+            tree.queryRay(origin, Vec3(0.f, 0.f, 1.f), 2.f * WORLD_SIZE,
+                          results);
+            rayHits += results.size();
+        }
+        rayTime += millisecondsSince(start);
+
+        start = Clock::now();
+        for (int i = 0; i < 100; ++i) {
+            results.clear();
+            Vec3 center(position(rng), position(rng), position(rng));
+            Vec3 extents(10.f, 10.f, 10.f);
+            tree.queryOverlap(AABB(center - extents, center + extents),
+                              results);
+            overlaps += results.size();
+        }
+        overlapTime += millisecondsSince(start);
+    }
+
+    gLog.info("aabb tree: %zu objects, built in %.2f ms, height %d, "
+              "area ratio %.1f\n",
+              objects.size(), buildTime, tree.getHeight(),
+              tree.getAreaRatio());
+
+    if (frames == 0) {
+        return;
+    }
+
+    gLog.info("  move:    %.3f ms/frame, %.1f reinserts/frame\n",
+              moveTime / frames, (double)reinserted / frames);
+    gLog.info("  frustum: %.3f ms/query, %.1f visible\n",
+              frustumTime / frames, (double)visible / frames);
+    gLog.info("  ray:     %.4f ms/query, %.1f hits\n",
+              rayTime / (frames * 100.0), (double)rayHits / (frames * 100.0));
+    gLog.info("  overlap: %.4f ms/query, %.1f results\n",
+              overlapTime / (frames * 100.0),
+              (double)overlaps / (frames * 100.0));
+
+    if (!tree.validate()) {
+        gLog.err("aabb tree: invariants broken\n");
+    }
+}
+
+} // namespace bench
+} // namespace sb
@@ -0,0 +1,18 @@
+#pragma once
+
+namespace sb {
+namespace bench {
+
+// CPU-only micro-benchmarks, selected with --bench-* on the command line;
+// results are reported through gLog
+
+// moves 50k objects per frame in an AABBTree, then runs frustum, ray and
+// overlap queries against it
+void aabbTree(unsigned frames);
+
+// compares the utils/vector.h SIMD kernels against glm on 100k matrix
+// and vector operations per frame, with the largest difference in results
+void vectorMath(unsigned frames);
+
+} // namespace bench
+} // namespace sb
@@ -0,0 +1,193 @@
+#include "bench/benchmarks.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "utils/logger.h"
+#include "utils/types.h"
+
+namespace sb {
+namespace bench {
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double millisecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+           .count();
+}
+
+// average time of one run of func over frames runs
+template<typename Func>
+double measure(unsigned frames,
+               Func func)
+{
+    Clock::time_point start = Clock::now();
+    for (unsigned frame = 0; frame < frames; ++frame) {
+        func();
+    }
+    return millisecondsSince(start) / frames;
+}
+
+float maxError(const std::vector<float>& a,
+               const std::vector<float>& b)
+{
+    float error = 0.f;
+    for (size_t i = 0; i < a.size(); ++i) {
+        error = std::max(error, std::fabs(a[i] - b[i]));
+    }
+    return error;
+}
+
+template<typename T>
+float maxError(const std::vector<T>& a,
+               const std::vector<T>& b)
+{
+    const size_t N = sizeof(T) / sizeof(float);
+
+    float error = 0.f;
+    for (size_t i = 0; i < a.size(); ++i) {
+        const float* x = (const float*)&a[i];
+        const float* y = (const float*)&b[i];
+        for (size_t c = 0; c < N; ++c) {
+            error = std::max(error, std::fabs(x[c] - y[c]));
+        }
+    }
+    return error;
+}
+
+void report(const char* name,
+            double glmMs,
+            double simdMs,
+            float error)
+{
+    gLog.info("  %-10s glm %7.3f ms, simd %7.3f ms, %5.2fx, max error %g\n",
+              name, glmMs, simdMs, simdMs > 0.0 ? glmMs / simdMs : 0.0,
+              error);
+}
+
+} // namespace
+
+void vectorMath(unsigned frames)
+{
+    const size_t COUNT = 100000;
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> value(-10.f, 10.f);
+    std::uniform_real_distribution<float> angle(-PI, PI);
+
+    // simd:: types are the glm ones; TVec members would use the kernels
+    // for the baseline too
+    std::vector<simd::mat4> matrices(COUNT);
+    std::vector<simd::vec4> points(COUNT);
+    std::vector<simd::vec3> a(COUNT);
+    std::vector<simd::vec3> b(COUNT);
+    std::vector<simd::quat> rotations(COUNT);
+
+    for (size_t i = 0; i < COUNT; ++i) {
+        for (int c = 0; c < 4; ++c) {
+            matrices[i][c] = simd::vec4(value(rng), value(rng),
+                                        value(rng), value(rng));
+        }
+        points[i] = simd::vec4(value(rng), value(rng), value(rng), 1.f);
+        a[i] = simd::vec3(value(rng), value(rng), value(rng));
+        b[i] = simd::vec3(value(rng), value(rng), value(rng));
+        rotations[i] = glm::angleAxis(angle(rng), glm::normalize(b[i]));
+    }
+
+    if (frames == 0) {
+        return;
+    }
+
+    gLog.info("vector math: %zu operations per frame, %s kernels\n",
+              COUNT, simd::getInstructionSet());
+
+    const simd::mat4& viewProjection = matrices[0];
+
+    std::vector<simd::mat4> glmMatrices(COUNT);
+    std::vector<simd::mat4> simdMatrices(COUNT);
+    double glmMs = measure(frames, [&]() {
+        for (size_t i = 0; i < COUNT; ++i) {
+            glmMatrices[i] = viewProjection * matrices[i];
+        }
+    });
+    double simdMs = measure(frames, [&]() {
+        for (size_t i = 0; i < COUNT; ++i) {
+            simdMatrices[i] = simd::multiply(viewProjection, matrices[i]);
+        }
+    });
+    report("mat*mat", glmMs, simdMs, maxError(glmMatrices, simdMatrices));
+
+    std::vector<simd::vec4> glmPoints(COUNT);
+    std::vector<simd::vec4> simdPoints(COUNT);
+    glmMs = measure(frames, [&]() {
+        for (size_t i = 0; i < COUNT; ++i) {
+            glmPoints[i] = matrices[i] * points[i];
+        }
+    });
+    simdMs = measure(frames, [&]() {
+        for (size_t i = 0; i < COUNT; ++i) {
+            simdPoints[i] = simd::transform(matrices[i], points[i]);
+        }
+    });
+    report("mat*vec", glmMs, simdMs, maxError(glmPoints, simdPoints));
+
+    std::vector<simd::vec3> glmVectors(COUNT);
+    std::vector<simd::vec3> simdVectors(COUNT);
+    glmMs = measure(frames, [&]() {
+        for (size_t i = 0; i < COUNT; ++i) {
+            glmVectors[i] = glm::normalize(a[i]);
+        }
+    });
+    simdMs = measure(frames, [&]() {
+        for (size_t i = 0; i < COUNT; ++i) {
+            simdVectors[i] = simd::normalize(a[i]);
+        }
+    });
+    report("normalize", glmMs, simdMs, maxError(glmVectors, simdVectors));
+
+    glmMs = measure(frames, [&]() {
+        for (size_t i = 0; i < COUNT; ++i) {
+            glmVectors[i] = glm::cross(a[i], b[i]);
+        }
+    });
+    simdMs = measure(frames, [&]() {
+        for (size_t i = 0; i < COUNT; ++i) {
+            simdVectors[i] = simd::cross(a[i], b[i]);
+        }
+    });
+    report("cross", glmMs, simdMs, maxError(glmVectors, simdVectors));
+
+    std::vector<float> glmDots(COUNT);
+    std::vector<float> simdDots(COUNT);
+    glmMs = measure(frames, [&]() {
+        for (size_t i = 0; i < COUNT; ++i) {
+            glmDots[i] = glm::dot(a[i], b[i]);
+        }
+    });
+    simdMs = measure(frames, [&]() {
+        for (size_t i = 0; i < COUNT; ++i) {
+            simdDots[i] = simd::dot(a[i], b[i]);
+        }
+    });
+    report("dot", glmMs, simdMs, maxError(glmDots, simdDots));
+
+    glmMs = measure(frames, [&]() {
+        for (size_t i = 0; i < COUNT; ++i) {
+            glmVectors[i] = rotations[i] * a[i];
+        }
+    });
+    simdMs = measure(frames, [&]() {
+        for (size_t i = 0; i < COUNT; ++i) {
+            simdVectors[i] = simd::rotate(rotations[i], a[i]);
+        }
+    });
+    report("rotate", glmMs, simdMs, maxError(glmVectors, simdVectors));
+}
+
+} // namespace bench
+} // namespace sb
@@ -1,12 +1,136 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "bench/benchmarks.h"
 #include "rendering/color.h"
+#include "utils/logger.h"
 #include "window/window.h"
 
 int main(int argc, char** argv)
 {
-    (void)argc;
-    (void)argv;
+    // --headless: render offscreen, no window (benchmarks, CI)
+    // --frames N: quit after N frames
+    // --profile-gpu: log GPU scope timings every frame
+    // --capture PATH: record frames; .ppm (printf pattern), .y4m or raw
+    // --present off|on|adaptive: swap interval
+    // --frames-in-flight N: frames queued ahead of the GPU, 1..3
+    // --target-fps F: cap the frame rate by sleeping
+    // --on-demand: skip frames nothing changed in and wait for events
+    // --shader VERT FRAG: load a program at startup, may be repeated; the
+    //                     shader cache report lists hits and misses
+    // --bench-aabb-tree: run the AABB tree benchmark for --frames (or 100)
+    //                    frames and quit
+    // --bench-vector-math: same for the SIMD vector and matrix kernels
+    const unsigned width = 800;
+    const unsigned height = 600;
+    // upper bound on the wait for events in --on-demand mode, so that
+    // time-driven content still updates
+    const unsigned ON_DEMAND_WAIT_MS = 100;
+    bool headless = false;
+    bool profileGpu = false;
+    unsigned long maxFrames = 0;
+    const char* capturePath = NULL;
+    bool benchAABBTree = false;
+    bool benchVectorMath = false;
+    const char* presentMode = NULL;
+    unsigned framesInFlight = 0;
+    double targetFps = 0.0;
+    bool onDemand = false;
+    std::vector<std::pair<const char*, const char*>> shaderPaths;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--headless")) {
+            headless = true;
+        } else if (!strcmp(argv[i], "--profile-gpu")) {
+            profileGpu = true;
+        } else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            maxFrames = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--capture") && i + 1 < argc) {
+            capturePath = argv[++i];
+        } else if (!strcmp(argv[i], "--present") && i + 1 < argc) {
+            presentMode = argv[++i];
+        } else if (!strcmp(argv[i], "--frames-in-flight") && i + 1 < argc) {
+            framesInFlight = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--target-fps") && i + 1 < argc) {
+            targetFps = strtod(argv[++i], NULL);
+        } else if (!strcmp(argv[i], "--shader") && i + 2 < argc) {
+            shaderPaths.push_back({ argv[i + 1], argv[i + 2] });
+            i += 2;
+        } else if (!strcmp(argv[i], "--on-demand")) {
+            onDemand = true;
+        } else if (!strcmp(argv[i], "--bench-aabb-tree")) {
+            benchAABBTree = true;
+        } else if (!strcmp(argv[i], "--bench-vector-math")) {
+            benchVectorMath = true;
+        } else {
+            gLog.warn("unknown argument: %s\n", argv[i]);
+        }
+    }
+
+    if (benchAABBTree) {
+        sb::bench::aabbTree(maxFrames ? (unsigned)maxFrames : 100);
+        return 0;
+    }
+    if (benchVectorMath) {
+        sb::bench::vectorMath(maxFrames ? (unsigned)maxFrames : 100);
+        return 0;
+    }
+
+    sb::Window window(width, height, headless);
+    window.getRenderer().getProfiler().setFrameLogging(profileGpu);
+
+    sb::FramePacer& pacer = window.getRenderer().getFramePacer();
+    if (framesInFlight) {
+        pacer.setMaxFramesInFlight(framesInFlight);
+    }
+    if (targetFps > 0.0) {
+        pacer.setTargetFrameTime(1000.0 / targetFps);
+    }
 
-    sb::Window window(800, 600);
+    if (presentMode) {
+        if (!strcmp(presentMode, "off")) {
+            window.getRenderer().setPresentMode(sb::PresentImmediate);
+        } else if (!strcmp(presentMode, "on")) {
+            window.getRenderer().setPresentMode(sb::PresentVSync);
+        } else if (!strcmp(presentMode, "adaptive")) {
+            window.getRenderer().setPresentMode(sb::PresentAdaptive);
+        } else {
+            gLog.warn("unknown present mode: %s\n", presentMode);
+        }
+    }
+
+    if (onDemand) {
+        window.getRenderer().setRedrawOnDemand(true);
+    }
+
+    if (capturePath) {
+        if (!window.isOpened()) {
+            gLog.err("cannot capture to %s: no window\n", capturePath);
+            return 1;
+        }
+
+        // the window manager may not have honored the requested size
+        Vec2i size = window.getSize();
+        sb::FrameCapture& capture = window.getRenderer().getFrameCapture();
+        capture.start(capturePath,
+                      sb::FrameCapture::formatFromPath(capturePath),
+                      (unsigned)size.x, (unsigned)size.y);
+    }
+
+    for (const auto& paths: shaderPaths) {
+        window.getRenderer().loadProgram(paths.first, paths.second);
+    }
+
+    const sb::ShaderCache& shaders = window.getRenderer().getShaderCache();
+    if (!shaders.getEntries().empty()) {
+        shaders.logReport();
+    }
+
+    unsigned long frames = 0;
+    auto start = std::chrono::steady_clock::now();
 
     while (window.isOpened()) {
         sb::Event event;
@@ -23,6 +147,50 @@ int main(int argc, char** argv)
 
         window.clear(sb::Color::Black);
         window.display();
+
+        // nothing changed, sleep until there is input to react to
+        if (window.getRenderer().isFrameSkipped()) {
+            window.waitForEvent(ON_DEMAND_WAIT_MS);
+        }
+
+        if (maxFrames && ++frames >= maxFrames) {
+            break;
+        }
+    }
+
+    // flushes readbacks still in flight while the window is alive
+    window.getRenderer().getFrameCapture().stop();
+
+    if (frames > 0) {
+        std::chrono::duration<double, std::milli> elapsed =
+                std::chrono::steady_clock::now() - start;
+        gLog.info("%lu frames in %.1f ms, %.3f ms/frame\n",
+                  frames, elapsed.count(), elapsed.count() / frames);
+
+        sb::FramePacer::Stats stats = pacer.getStats();
+        const struct {
+            const char* name;
+            const sb::FramePacer::Timing& timing;
+        } timings[] = {
+            { "frame time", stats.frameTime },
+            { "latency", stats.latency },
+            { "fence wait", stats.fenceWait },
+            { "sleep", stats.sleep }
+        };
+        for (const auto& t: timings) {
+            gLog.info("%-12s min %7.3f avg %7.3f max %7.3f ms over %u frames\n",
+                      t.name, t.timing.minMs, t.timing.avgMs, t.timing.maxMs,
+                      t.timing.samples);
+        }
+
+        if (onDemand) {
+            const sb::DamageTracker::Stats& redraws =
+                    window.getRenderer().getRedrawStats();
+            gLog.info("redraws: %llu skipped, %llu partial, %llu full\n",
+                      (unsigned long long)redraws.skipped,
+                      (unsigned long long)redraws.partial,
+                      (unsigned long long)redraws.full);
+        }
     }
 
     return 0;
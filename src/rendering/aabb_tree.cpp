@@ -0,0 +1,563 @@
+#include "rendering/aabb_tree.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "rendering/camera.h"
+
+namespace sb {
+namespace {
+
+enum EClassification {
+    Outside,
+    Intersecting,
+    Inside
+};
+
+EClassification classify(const Frustum& frustum,
+                         const AABB& box)
+{
+    Vec3 c = box.getCenter();
+    Vec3 e = box.getExtents();
+    EClassification result = Inside;
+
+    for (const float* plane: frustum.planes) {
+        float dist = plane[0] * c.x + plane[1] * c.y + plane[2] * c.z
+                     + plane[3];
+        float reach = std::fabs(plane[0]) * e.x
+                      + std::fabs(plane[1]) * e.y
+                      + std::fabs(plane[2]) * e.z;
+
+        if (dist + reach < 0.f) {
+            return Outside;
+        }
+        if (dist - reach < 0.f) {
+            result = Intersecting;
+        }
+    }
+
+    return result;
+}
+
+// slab test, t measured in direction lengths
+bool intersectsRay(const AABB& box,
+                   const float* origin,
+                   const float* invDirection,
+                   float maxT)
+{
+    const float* boxMin = &box.min.x;
+    const float* boxMax = &box.max.x;
+    float tMin = 0.f;
+    float tMax = maxT;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        float t1 = (boxMin[axis] - origin[axis]) * invDirection[axis];
+        float t2 = (boxMax[axis] - origin[axis]) * invDirection[axis];
+        tMin = std::max(tMin, std::min(t1, t2));
+        tMax = std::min(tMax, std::max(t1, t2));
+    }
+
+    return tMin <= tMax;
+}
+
+} // namespace
+
+AABB AABB::merged(const AABB& a,
+                  const AABB& b)
+{
+    return AABB(Vec3(std::min(a.min.x, b.min.x),
+                     std::min(a.min.y, b.min.y),
+                     std::min(a.min.z, b.min.z)),
+                Vec3(std::max(a.max.x, b.max.x),
+                     std::max(a.max.y, b.max.y),
+                     std::max(a.max.z, b.max.z)));
+}
+
+Vec3 AABB::getCenter() const
+{
+    return Vec3((min.x + max.x) * 0.5f,
+                (min.y + max.y) * 0.5f,
+                (min.z + max.z) * 0.5f);
+}
+
+Vec3 AABB::getExtents() const
+{
+    return Vec3((max.x - min.x) * 0.5f,
+                (max.y - min.y) * 0.5f,
+                (max.z - min.z) * 0.5f);
+}
+
+float AABB::getSurfaceArea() const
+{
+    float dx = max.x - min.x;
+    float dy = max.y - min.y;
+    float dz = max.z - min.z;
+    return 2.f * (dx * dy + dy * dz + dz * dx);
+}
+
+bool AABB::contains(const AABB& b) const
+{
+    return min.x <= b.min.x && min.y <= b.min.y && min.z <= b.min.z
+           && b.max.x <= max.x && b.max.y <= max.y && b.max.z <= max.z;
+}
+
+bool AABB::overlaps(const AABB& b) const
+{
+    return min.x <= b.max.x && b.min.x <= max.x
+           && min.y <= b.max.y && b.min.y <= max.y
+           && min.z <= b.max.z && b.min.z <= max.z;
+}
+
+const AABBTree::ProxyId AABBTree::NULL_NODE;
+
+AABBTree::AABBTree(float margin,
+                   float displacementMultiplier):
+    mNodes(),
+    mRoot(NULL_NODE),
+    mFreeList(NULL_NODE),
+    mNumLeaves(0),
+    mMargin(margin),
+    mDisplacementMultiplier(displacementMultiplier),
+    mStack()
+{
+}
+
+int32_t AABBTree::allocateNode()
+{
+    if (mFreeList == NULL_NODE) {
+        // grow the pool and chain new nodes into the free list
+        int32_t first = (int32_t)mNodes.size();
+        int32_t count = std::max<int32_t>(16, first);
+        mNodes.resize(first + count);
+
+        for (int32_t i = first; i < first + count; ++i) {
+            mNodes[i].next = (i + 1 < first + count) ? i + 1 : NULL_NODE;
+            mNodes[i].height = -1;
+        }
+        mFreeList = first;
+    }
+
+    int32_t node = mFreeList;
+    Node& n = mNodes[node];
+    mFreeList = n.next;
+
+    n.parent = NULL_NODE;
+    n.child1 = NULL_NODE;
+    n.child2 = NULL_NODE;
+    n.height = 0;
+    n.userData = 0;
+    return node;
+}
+
+void AABBTree::freeNode(int32_t node)
+{
+    mNodes[node].next = mFreeList;
+    mNodes[node].height = -1;
+    mFreeList = node;
+}
+
+AABBTree::ProxyId AABBTree::insert(const AABB& box,
+                                   uint32_t userData)
+{
+    int32_t leaf = allocateNode();
+    Node& n = mNodes[leaf];
+
+    Vec3 margin(mMargin, mMargin, mMargin);
+    n.box = AABB(box.min - margin, box.max + margin);
+    n.userData = userData;
+
+    insertLeaf(leaf);
+    ++mNumLeaves;
+    return leaf;
+}
+
+void AABBTree::remove(ProxyId proxy)
+{
+    assert(proxy >= 0 && proxy < (int32_t)mNodes.size());
+    assert(mNodes[proxy].isLeaf());
+
+    removeLeaf(proxy);
+    freeNode(proxy);
+    --mNumLeaves;
+}
+
+bool AABBTree::move(ProxyId proxy,
+                    const AABB& box,
+                    const Vec3& displacement)
+{
+    assert(proxy >= 0 && proxy < (int32_t)mNodes.size());
+    assert(mNodes[proxy].isLeaf());
+
+    if (mNodes[proxy].box.contains(box)) {
+        return false;
+    }
+
+    removeLeaf(proxy);
+
+    // extend the box in the direction of movement, so that the proxy stays
+    // inside it for a few more updates
+    Vec3 margin(mMargin, mMargin, mMargin);
+    AABB fat(box.min - margin, box.max + margin);
+    Vec3 d = displacement * mDisplacementMultiplier;
+
+    if (d.x < 0.f) { fat.min.x += d.x; } else { fat.max.x += d.x; }
+    if (d.y < 0.f) { fat.min.y += d.y; } else { fat.max.y += d.y; }
+    if (d.z < 0.f) { fat.min.z += d.z; } else { fat.max.z += d.z; }
+
+    mNodes[proxy].box = fat;
+    insertLeaf(proxy);
+    return true;
+}
+
+uint32_t AABBTree::getUserData(ProxyId proxy) const
+{
+    assert(proxy >= 0 && proxy < (int32_t)mNodes.size());
+    return mNodes[proxy].userData;
+}
+
+const AABB& AABBTree::getFatAABB(ProxyId proxy) const
+{
+    assert(proxy >= 0 && proxy < (int32_t)mNodes.size());
+    return mNodes[proxy].box;
+}
+
+void AABBTree::insertLeaf(int32_t leaf)
+{
+    if (mRoot == NULL_NODE) {
+        mRoot = leaf;
+        mNodes[leaf].parent = NULL_NODE;
+        return;
+    }
+
+    // descend towards the sibling that minimizes the surface area increase
+    const AABB leafBox = mNodes[leaf].box;
+    int32_t index = mRoot;
+
+    while (!mNodes[index].isLeaf()) {
+        const Node& node = mNodes[index];
+        float area = node.box.getSurfaceArea();
+        float combinedArea = AABB::merged(node.box, leafBox).getSurfaceArea();
+
+        // cost of making a new parent of this node and the leaf
+        float cost = 2.f * combinedArea;
+        // minimum cost of pushing the leaf further down
+        float inheritanceCost = 2.f * (combinedArea - area);
+
+        float childCost[2];
+        int32_t children[2] = { node.child1, node.child2 };
+        for (int i = 0; i < 2; ++i) {
+            const Node& child = mNodes[children[i]];
+            float mergedArea = AABB::merged(child.box, leafBox)
+                               .getSurfaceArea();
+            childCost[i] = child.isLeaf()
+                           ? mergedArea + inheritanceCost
+                           : mergedArea - child.box.getSurfaceArea()
+                             + inheritanceCost;
+        }
+
+        if (cost < childCost[0] && cost < childCost[1]) {
+            break;
+        }
+
+        index = childCost[0] < childCost[1] ? children[0] : children[1];
+    }
+
+    int32_t sibling = index;
+    int32_t oldParent = mNodes[sibling].parent;
+    int32_t newParent = allocateNode();
+
+    Node& parent = mNodes[newParent];
+    parent.parent = oldParent;
+    parent.box = AABB::merged(leafBox, mNodes[sibling].box);
+    parent.height = mNodes[sibling].height + 1;
+    parent.child1 = sibling;
+    parent.child2 = leaf;
+    mNodes[sibling].parent = newParent;
+    mNodes[leaf].parent = newParent;
+
+    if (oldParent == NULL_NODE) {
+        mRoot = newParent;
+    } else if (mNodes[oldParent].child1 == sibling) {
+        mNodes[oldParent].child1 = newParent;
+    } else {
+        mNodes[oldParent].child2 = newParent;
+    }
+
+    // walk back up, fixing heights and boxes
+    index = mNodes[leaf].parent;
+    while (index != NULL_NODE) {
+        index = balance(index);
+
+        Node& node = mNodes[index];
+        const Node& child1 = mNodes[node.child1];
+        const Node& child2 = mNodes[node.child2];
+        node.height = 1 + std::max(child1.height, child2.height);
+        node.box = AABB::merged(child1.box, child2.box);
+
+        index = node.parent;
+    }
+}
+
+void AABBTree::removeLeaf(int32_t leaf)
+{
+    if (leaf == mRoot) {
+        mRoot = NULL_NODE;
+        return;
+    }
+
+    int32_t parent = mNodes[leaf].parent;
+    int32_t grandParent = mNodes[parent].parent;
+    int32_t sibling = mNodes[parent].child1 == leaf
+                      ? mNodes[parent].child2
+                      : mNodes[parent].child1;
+
+    freeNode(parent);
+
+    if (grandParent == NULL_NODE) {
+        mRoot = sibling;
+        mNodes[sibling].parent = NULL_NODE;
+        return;
+    }
+
+    // sibling takes the parent's place
+    if (mNodes[grandParent].child1 == parent) {
+        mNodes[grandParent].child1 = sibling;
+    } else {
+        mNodes[grandParent].child2 = sibling;
+    }
+    mNodes[sibling].parent = grandParent;
+
+    int32_t index = grandParent;
+    while (index != NULL_NODE) {
+        index = balance(index);
+
+        Node& node = mNodes[index];
+        const Node& child1 = mNodes[node.child1];
+        const Node& child2 = mNodes[node.child2];
+        node.box = AABB::merged(child1.box, child2.box);
+        node.height = 1 + std::max(child1.height, child2.height);
+
+        index = node.parent;
+    }
+}
+
+// rotates the taller child up if the subtree at a is unbalanced; returns
+// the index of the new subtree root
+int32_t AABBTree::balance(int32_t a)
+{
+    Node& nodeA = mNodes[a];
+    if (nodeA.isLeaf() || nodeA.height < 2) {
+        return a;
+    }
+
+    int32_t b = nodeA.child1;
+    int32_t c = nodeA.child2;
+    int32_t diff = mNodes[c].height - mNodes[b].height;
+
+    if (diff > 1 || diff < -1) {
+        // rotate the taller child (up) with a (down)
+        int32_t up = diff > 1 ? c : b;
+        int32_t other = diff > 1 ? b : c;
+        Node& nodeUp = mNodes[up];
+
+        int32_t f = nodeUp.child1;
+        int32_t g = nodeUp.child2;
+
+        nodeUp.child1 = a;
+        nodeUp.parent = nodeA.parent;
+        nodeA.parent = up;
+
+        if (nodeUp.parent == NULL_NODE) {
+            mRoot = up;
+        } else if (mNodes[nodeUp.parent].child1 == a) {
+            mNodes[nodeUp.parent].child1 = up;
+        } else {
+            mNodes[nodeUp.parent].child2 = up;
+        }
+
+        // the taller grandchild stays with up, the other goes to a
+        int32_t keep = mNodes[f].height > mNodes[g].height ? f : g;
+        int32_t give = keep == f ? g : f;
+
+        nodeUp.child2 = keep;
+        if (diff > 1) {
+            nodeA.child2 = give;
+        } else {
+            nodeA.child1 = give;
+        }
+        mNodes[give].parent = a;
+
+        nodeA.box = AABB::merged(mNodes[other].box, mNodes[give].box);
+        nodeA.height = 1 + std::max(mNodes[other].height,
+                                    mNodes[give].height);
+        nodeUp.box = AABB::merged(nodeA.box, mNodes[keep].box);
+        nodeUp.height = 1 + std::max(nodeA.height, mNodes[keep].height);
+
+        return up;
+    }
+
+    return a;
+}
+
+void AABBTree::queryFrustum(const Frustum& frustum,
+                            std::vector<uint32_t>& results) const
+{
+    if (mRoot == NULL_NODE) {
+        return;
+    }
+
+    mStack.clear();
+    mStack.push_back(mRoot);
+
+    while (!mStack.empty()) {
+        int32_t index = mStack.back();
+        mStack.pop_back();
+
+        // indices encoded as (-index - 2) mark subtrees already known to be
+        // fully inside, those are collected without further plane tests
+        bool inside = false;
+        if (index < 0) {
+            index = -index - 2;
+            inside = true;
+        }
+
+        const Node& node = mNodes[index];
+        if (!inside) {
+            EClassification c = classify(frustum, node.box);
+            if (c == Outside) {
+                continue;
+            }
+            inside = (c == Inside);
+        }
+
+        if (node.isLeaf()) {
+            results.push_back(node.userData);
+        } else if (inside) {
+            mStack.push_back(-node.child1 - 2);
+            mStack.push_back(-node.child2 - 2);
+        } else {
+            mStack.push_back(node.child1);
+            mStack.push_back(node.child2);
+        }
+    }
+}
+
+void AABBTree::queryFrustum(Camera& camera,
+                            std::vector<uint32_t>& results) const
+{
+    queryFrustum(camera.getFrustum(), results);
+}
+
+void AABBTree::queryOverlap(const AABB& box,
+                            std::vector<uint32_t>& results) const
+{
+    if (mRoot == NULL_NODE) {
+        return;
+    }
+
+    mStack.clear();
+    mStack.push_back(mRoot);
+
+    while (!mStack.empty()) {
+        const Node& node = mNodes[mStack.back()];
+        mStack.pop_back();
+
+        if (!node.box.overlaps(box)) {
+            continue;
+        }
+
+        if (node.isLeaf()) {
+            results.push_back(node.userData);
+        } else {
+            mStack.push_back(node.child1);
+            mStack.push_back(node.child2);
+        }
+    }
+}
+
+void AABBTree::queryRay(const Vec3& origin,
+                        const Vec3& direction,
+                        float maxDistance,
+                        std::vector<uint32_t>& results) const
+{
+    if (mRoot == NULL_NODE) {
+        return;
+    }
+
+    // division by zero gives infinities, which the slab test handles
+    const float o[3] = { origin.x, origin.y, origin.z };
+    const float invDir[3] = {
+        1.f / direction.x, 1.f / direction.y, 1.f / direction.z
+    };
+
+    mStack.clear();
+    mStack.push_back(mRoot);
+
+    while (!mStack.empty()) {
+        const Node& node = mNodes[mStack.back()];
+        mStack.pop_back();
+
+        if (!intersectsRay(node.box, o, invDir, maxDistance)) {
+            continue;
+        }
+
+        if (node.isLeaf()) {
+            results.push_back(node.userData);
+        } else {
+            mStack.push_back(node.child1);
+            mStack.push_back(node.child2);
+        }
+    }
+}
+
+int32_t AABBTree::getHeight() const
+{
+    return mRoot == NULL_NODE ? 0 : mNodes[mRoot].height;
+}
+
+float AABBTree::getAreaRatio() const
+{
+    if (mRoot == NULL_NODE) {
+        return 0.f;
+    }
+
+    float total = 0.f;
+    for (const Node& node: mNodes) {
+        if (node.height >= 0) {
+            total += node.box.getSurfaceArea();
+        }
+    }
+
+    float rootArea = mNodes[mRoot].box.getSurfaceArea();
+    return rootArea > 0.f ? total / rootArea : 0.f;
+}
+
+bool AABBTree::validate() const
+{
+    return mRoot == NULL_NODE || validate(mRoot, NULL_NODE);
+}
+
+bool AABBTree::validate(int32_t index,
+                        int32_t parent) const
+{
+    const Node& node = mNodes[index];
+    if (node.parent != parent) {
+        return false;
+    }
+    if (node.isLeaf()) {
+        return node.height == 0;
+    }
+
+    const Node& child1 = mNodes[node.child1];
+    const Node& child2 = mNodes[node.child2];
+    if (node.height != 1 + std::max(child1.height, child2.height)
+            || !node.box.contains(child1.box)
+            || !node.box.contains(child2.box)) {
+        return false;
+    }
+
+    return validate(node.child1, index) && validate(node.child2, index);
+}
+
+} // namespace sb
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "rendering/frustum.h"
+#include "utils/types.h"
+
+namespace sb {
+
+class Camera;
+
+struct AABB
+{
+    Vec3 min;
+    Vec3 max;
+
+    AABB() {}
+    AABB(const Vec3& min,
+         const Vec3& max):
+        min(min),
+        max(max)
+    {}
+
+    static AABB merged(const AABB& a,
+                       const AABB& b);
+
+    Vec3 getCenter() const;
+    Vec3 getExtents() const;    // half-size
+    float getSurfaceArea() const;
+
+    bool contains(const AABB& b) const;
+    bool overlaps(const AABB& b) const;
+};
+
+// Dynamic bounding volume hierarchy. Leaves store "fat" boxes, enlarged by
+// a margin and by the predicted displacement, so that small movements do
+// not touch the tree at all. Insertion picks the sibling by surface area
+// heuristic; the tree is kept balanced with AVL-like rotations.
+//
+// Nodes live in a contiguous pool and link to each other by index.
+class AABBTree
+{
+public:
+    typedef int32_t ProxyId;
+    static const ProxyId NULL_NODE = -1;
+
+    explicit AABBTree(float margin = 0.1f,
+                      float displacementMultiplier = 2.f);
+
+    // userData is returned by queries
+    ProxyId insert(const AABB& box,
+                   uint32_t userData);
+    void remove(ProxyId proxy);
+    // displacement: expected movement until the next update, may be zero;
+    // returns true if the proxy had to be reinserted
+    bool move(ProxyId proxy,
+              const AABB& box,
+              const Vec3& displacement);
+
+    uint32_t getUserData(ProxyId proxy) const;
+    const AABB& getFatAABB(ProxyId proxy) const;
+
+    // queries append userData of all leaves whose fat box passes the test
+    void queryFrustum(const Frustum& frustum,
+                      std::vector<uint32_t>& results) const;
+    void queryFrustum(Camera& camera,
+                      std::vector<uint32_t>& results) const;
+    void queryOverlap(const AABB& box,
+                      std::vector<uint32_t>& results) const;
+    // direction does not have to be normalized, maxDistance is measured in
+    // its lengths
+    void queryRay(const Vec3& origin,
+                  const Vec3& direction,
+                  float maxDistance,
+                  std::vector<uint32_t>& results) const;
+
+    uint32_t getNumProxies() const { return mNumLeaves; }
+    int32_t getHeight() const;
+    // sum of node surface areas / root surface area, lower is better
+    float getAreaRatio() const;
+
+    // checks structure invariants, for debugging
+    bool validate() const;
+
+private:
+    struct Node
+    {
+        AABB box;
+        union {
+            int32_t parent;
+            int32_t next;   // in free list
+        };
+        int32_t child1;
+        int32_t child2;
+        int32_t height;     // leaf = 0, free = -1
+        uint32_t userData;
+
+        bool isLeaf() const { return child1 == NULL_NODE; }
+    };
+
+    std::vector<Node> mNodes;
+    int32_t mRoot;
+    int32_t mFreeList;
+    uint32_t mNumLeaves;
+
+    float mMargin;
+    float mDisplacementMultiplier;
+
+    mutable std::vector<int32_t> mStack;
+
+    int32_t allocateNode();
+    void freeNode(int32_t node);
+
+    void insertLeaf(int32_t leaf);
+    void removeLeaf(int32_t leaf);
+    int32_t balance(int32_t node);
+
+    bool validate(int32_t node,
+                  int32_t parent) const;
+};
+
+} // namespace sb
@@ -19,7 +19,12 @@ namespace sb
         mUpReal(0.f, 1.f, 0.f),
         mXZAngle(0.0),
         mYAngle(0.0),
-        mMatrixUpdateFlags(0)
+        mFov(PI_3),
+        mAspectRatio(1.33f),
+        mNear(Z_NEAR),
+        mFar(Z_FAR),
+        mFrustum(),
+        mMatrixUpdateFlags(FrustumOutdated)
     {
         setOrthographicMatrix();
         setPerspectiveMatrix();
@@ -43,8 +48,19 @@ namespace sb
                                       float near,
                                       float far)
     {
+        mFov = fov;
+        mAspectRatio = aspectRatio;
+        mNear = near;
+        mFar = far;
+
         mPerspectiveProjectionMatrix =
                 math::matrixPerspective(fov, aspectRatio, near, far);
+        mMatrixUpdateFlags |= FrustumOutdated;
+    }
+
+    void Camera::setAspectRatio(float aspectRatio)
+    {
+        setPerspectiveMatrix(mFov, aspectRatio, mNear, mFar);
     }
 
     void Camera::updateViewMatrix()
@@ -68,20 +84,34 @@ namespace sb
             mTranslationMatrix = glm::translate(-mEye);
         }
 
-        mMatrixUpdateFlags = 0;
-        mViewMatrix = mRotationMatrix * mTranslationMatrix;
+        // any view change moves the frustum as well
+        mMatrixUpdateFlags = FrustumOutdated;
+        mViewMatrix = simd::multiply(mRotationMatrix, mTranslationMatrix);
     }
 
     // updates only if needed
     Mat44& Camera::getViewMatrix()
     {
-        if (mMatrixUpdateFlags) {
+        if (mMatrixUpdateFlags & MatrixViewUpdated) {
             updateViewMatrix();
         }
 
         return mViewMatrix;
     }
 
+    // updates only if needed
+    const Frustum& Camera::getFrustum()
+    {
+        if (mMatrixUpdateFlags) {
+            mFrustum = Frustum::fromMatrix(
+                    simd::multiply(mPerspectiveProjectionMatrix,
+                                   getViewMatrix()));
+            mMatrixUpdateFlags &= ~FrustumOutdated;
+        }
+
+        return mFrustum;
+    }
+
     void Camera::lookAt(Vec3 pos, Vec3 at, Vec3 up)
     {
         mEye = pos;
@@ -113,8 +143,8 @@ namespace sb
     {
         Quat rot = glm::angleAxis(angle.value(), mUpReal);
 
-        mFront = rot * mFront;
-        mRight = rot * mRight;
+        mFront = simd::rotate(rot, mFront);
+        mRight = simd::rotate(rot, mRight);
 
         mMatrixUpdateFlags |= MatrixRotationUpdated;
         updateAngles();
@@ -123,13 +153,13 @@ namespace sb
     void Camera::rotate(const Vec3& axis, Radians angle)
     {
         Quat rot = glm::angleAxis(angle.value(), axis.normalized());
-        lookAt(mEye, mEye + (rot * (mAt - mEye)), mUp);
+        lookAt(mEye, mEye + simd::rotate(rot, mAt - mEye), mUp);
     }
 
     void Camera::rotateAround(Radians angle)
     {
         Quat rot = glm::angleAxis(angle.value(), mUpReal);
-        lookAt(mAt + (rot * (mEye - mAt)), mAt, mUp);
+        lookAt(mAt + simd::rotate(rot, mEye - mAt), mAt, mUp);
     }
 
     void Camera::mouseLook(Radians dtX, Radians dtY)
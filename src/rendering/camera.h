@@ -4,6 +4,7 @@
 #include <cmath>
 
 #include "types.h"
+#include "rendering/frustum.h"
 #include "utils/math.h"
 #include "utils/types.h"
 
@@ -26,6 +27,10 @@ namespace sb
                                   float aspectRatio = 1.33f,
                                   float near = Z_NEAR,
                                   float far = Z_FAR);
+        // keeps field of view and clipping planes of the last
+        // setPerspectiveMatrix() call
+        void setAspectRatio(float aspectRatio);
+        float getAspectRatio() const { return mAspectRatio; }
         void updateViewMatrix();
 
         Mat44& getOrthographicProjectionMatrix()
@@ -38,13 +43,19 @@ namespace sb
         }
         Mat44& getViewMatrix();    // updates only if needed
 
+        // perspective view frustum, updates only if needed; modifying the
+        // projection through getPerspectiveProjectionMatrix() requires
+        // calling setPerspectiveMatrix() afterwards
+        const Frustum& getFrustum();
+
         Mat44 getViewProjectionMatrix(EProjectionType projectionType)
         {
             if (projectionType == ProjectionOrthographic) {
                 return getOrthographicProjectionMatrix();
             }
 
-            return getPerspectiveProjectionMatrix() * getViewMatrix();
+            return simd::multiply(getPerspectiveProjectionMatrix(),
+                                  getViewMatrix());
         }
 
         void lookAt(Vec3 pos,
@@ -90,9 +101,19 @@ namespace sb
         Radians mXZAngle;
         Radians mYAngle;
 
+        float mFov;
+        float mAspectRatio;
+        float mNear;
+        float mFar;
+
+        Frustum mFrustum;
+
         enum EMatrixUpdateFlags {
             MatrixRotationUpdated = 1,
-            MatrixTranslationUpdated = 1 << 1
+            MatrixTranslationUpdated = 1 << 1,
+            MatrixViewUpdated = MatrixRotationUpdated
+                                | MatrixTranslationUpdated,
+            FrustumOutdated = 1 << 2
         };
         uint32_t mMatrixUpdateFlags;
 
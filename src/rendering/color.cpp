@@ -43,6 +43,11 @@ namespace sb
         return *this;
     }
 
+    Color Color::operator *(const Color& c) const
+    {
+        return Color(r * c.r, g * c.g, b * c.b, a * c.a);
+    }
+
     Color Color::operator +(const Color& c) const
     {
         return Color(r + c.r, g + c.g, b + c.b, (a + c.a) / 2.f);
@@ -16,6 +16,7 @@ namespace sb
         Color operator *(float factor) const;
         Color& operator *=(float factor);
 
+        Color operator *(const Color& c) const;     // component-wise
         Color operator +(const Color& c) const;
         Color& operator +=(const Color& c);
 
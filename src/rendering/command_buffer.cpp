@@ -0,0 +1,149 @@
+#include "rendering/command_buffer.h"
+
+#include <cassert>
+#include <cstring>
+
+#include "rendering/drawable.h"
+#include "rendering/gl_state.h"
+#include "rendering/renderer.h"
+#include "utils/gl.h"
+#include "utils/logger.h"
+
+namespace sb {
+namespace {
+
+// enough for pointers, size_t and floats stored in payloads
+const size_t COMMAND_ALIGNMENT = 8;
+
+struct DrawCmd
+{
+    const Drawable* drawable;
+};
+
+struct DrawInstancedCmd
+{
+    const Drawable* drawable;
+    const Mat44* transforms;
+    const Color* colors;
+    size_t count;
+};
+
+// followed by data
+struct UpdateBufferCmd
+{
+    GLenum target;
+    BufferId buffer;
+    size_t offset;
+    size_t size;
+};
+
+} // namespace
+
+CommandBuffer::CommandBuffer(uint32_t order):
+    mOrder(order),
+    mNumCommands(0),
+    mData()
+{
+}
+
+void CommandBuffer::reset()
+{
+    mNumCommands = 0;
+    mData.clear();
+}
+
+void* CommandBuffer::push(ECommand command,
+                          size_t payloadSize)
+{
+    size_t size = sizeof(Header) + payloadSize;
+    size = (size + COMMAND_ALIGNMENT - 1) & ~(COMMAND_ALIGNMENT - 1);
+
+    size_t at = mData.size();
+    mData.resize(at + size);
+
+    Header* header = (Header*)&mData[at];
+    header->command = command;
+    header->size = (uint32_t)size;
+
+    ++mNumCommands;
+    return header + 1;
+}
+
+void CommandBuffer::draw(const Drawable& d)
+{
+    DrawCmd* cmd = (DrawCmd*)push(CmdDraw, sizeof(DrawCmd));
+    cmd->drawable = &d;
+}
+
+void CommandBuffer::drawInstanced(const Drawable& d,
+                                  const Mat44* transforms,
+                                  const Color* colors,
+                                  size_t count)
+{
+    DrawInstancedCmd* cmd = (DrawInstancedCmd*)push(CmdDrawInstanced,
+                                                    sizeof(DrawInstancedCmd));
+    cmd->drawable = &d;
+    cmd->transforms = transforms;
+    cmd->colors = colors;
+    cmd->count = count;
+}
+
+void CommandBuffer::updateBuffer(GLenum target,
+                                 BufferId buffer,
+                                 size_t offset,
+                                 const void* data,
+                                 size_t size)
+{
+    UpdateBufferCmd* cmd = (UpdateBufferCmd*)push(CmdUpdateBuffer,
+                                                  sizeof(UpdateBufferCmd)
+                                                  + size);
+    cmd->target = target;
+    cmd->buffer = buffer;
+    cmd->offset = offset;
+    cmd->size = size;
+    memcpy(cmd + 1, data, size);
+}
+
+void CommandBuffer::replay(Renderer& renderer) const
+{
+    GLState& state = renderer.getGLState();
+
+    size_t at = 0;
+    while (at < mData.size()) {
+        const Header* header = (const Header*)&mData[at];
+        const void* payload = header + 1;
+        at += header->size;
+
+        switch (header->command) {
+        case CmdDraw: {
+            const DrawCmd* cmd = (const DrawCmd*)payload;
+            renderer.draw(*cmd->drawable);
+            break;
+        }
+        case CmdDrawInstanced: {
+            const DrawInstancedCmd* cmd = (const DrawInstancedCmd*)payload;
+            renderer.drawInstanced(*cmd->drawable, cmd->transforms,
+                                   cmd->colors, cmd->count);
+            break;
+        }
+        case CmdUpdateBuffer: {
+            const UpdateBufferCmd* cmd = (const UpdateBufferCmd*)payload;
+            // the index buffer binding is vertex array state
+            if (cmd->target == GL_ELEMENT_ARRAY_BUFFER) {
+                state.bindVertexArray(0);
+            }
+            state.bindBuffer(cmd->target, cmd->buffer);
+            if (GL_CHECK(glBufferSubData(cmd->target, cmd->offset, cmd->size,
+                                         cmd + 1))) {
+                gLog.err("cannot update buffer %u\n", cmd->buffer);
+            }
+            break;
+        }
+        default:
+            assert(!"invalid command");
+            break;
+        }
+    }
+}
+
+} // namespace sb
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "rendering/color.h"
+#include "rendering/types.h"
+#include "utils/types.h"
+
+namespace sb {
+
+class Drawable;
+class Renderer;
+
+// Linear buffer of rendering commands. Recording does not touch GL, so each
+// worker thread may fill its own buffer in parallel; the buffers are then
+// replayed on the thread owning the GL context (see Window::submit).
+//
+// Draw commands are queued into the renderer like Renderer::draw, which
+// sorts and batches them; program and texture come from the drawable, and
+// per-draw values from per-instance attributes. Buffer updates are applied
+// during replay, in recorded order, so all of them happen before any draw
+// of the frame runs.
+class CommandBuffer
+{
+public:
+    // buffers submitted in the same frame are replayed in ascending order;
+    // ties keep the submission order
+    explicit CommandBuffer(uint32_t order = 0);
+
+    CommandBuffer(const CommandBuffer&) = delete;
+    CommandBuffer& operator =(const CommandBuffer&) = delete;
+
+    uint32_t getOrder() const { return mOrder; }
+    void setOrder(uint32_t order) { mOrder = order; }
+
+    // forgets all commands, keeps allocated memory
+    void reset();
+    bool empty() const { return mNumCommands == 0; }
+    size_t getNumCommands() const { return mNumCommands; }
+    size_t getSize() const { return mData.size(); }
+
+    // d (and arrays passed to drawInstanced) must stay alive until replayed
+    void draw(const Drawable& d);
+    void drawInstanced(const Drawable& d,
+                       const Mat44* transforms,
+                       const Color* colors,
+                       size_t count);
+
+    // data is copied. Draws of this frame see the last update, a buffer
+    // drawn from must not change between its draws. GL_ELEMENT_ARRAY_BUFFER
+    // updates unbind the current vertex array
+    void updateBuffer(GLenum target,
+                      BufferId buffer,
+                      size_t offset,
+                      const void* data,
+                      size_t size);
+
+    // must be called on the thread owning the GL context
+    void replay(Renderer& renderer) const;
+
+private:
+    enum ECommand {
+        CmdDraw,
+        CmdDrawInstanced,
+        CmdUpdateBuffer
+    };
+
+    struct Header
+    {
+        uint32_t command;
+        uint32_t size;      // of the whole command, including padding
+    };
+
+    uint32_t mOrder;
+    size_t mNumCommands;
+    std::vector<uint8_t> mData;
+
+    // reserves space for a command with payloadSize bytes after the header
+    void* push(ECommand command,
+               size_t payloadSize);
+};
+
+} // namespace sb
@@ -0,0 +1,152 @@
+#include "rendering/damage_tracker.h"
+
+#include <algorithm>
+
+namespace sb {
+namespace {
+
+void unite(DamageTracker::Rect& rect,
+           const DamageTracker::Rect& other)
+{
+    if (other.isEmpty()) {
+        return;
+    }
+    if (rect.isEmpty()) {
+        rect = other;
+        return;
+    }
+
+    int right = std::max(rect.x + rect.width, other.x + other.width);
+    int top = std::max(rect.y + rect.height, other.y + other.height);
+    rect.x = std::min(rect.x, other.x);
+    rect.y = std::min(rect.y, other.y);
+    rect.width = right - rect.x;
+    rect.height = top - rect.y;
+}
+
+} // namespace
+
+const uint64_t DamageTracker::HASH_SEED;
+
+DamageTracker::DamageTracker():
+    mGlobal(HASH_SEED),
+    mLastGlobal(HASH_SEED),
+    mHasLastFrame(false),
+    mFullyInvalid(false),
+    mInvalidRect(),
+    mItems(),
+    mLastItems(),
+    mHistory(),
+    mStats()
+{
+}
+
+DamageTracker::~DamageTracker()
+{
+}
+
+uint64_t DamageTracker::hash(const void* data,
+                             size_t size,
+                             uint64_t seed)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; ++i) {
+        seed ^= bytes[i];
+        seed *= 1099511628211ULL;
+    }
+    return seed;
+}
+
+void DamageTracker::addGlobal(const void* data,
+                              size_t size)
+{
+    mGlobal = hash(data, size, mGlobal);
+}
+
+void DamageTracker::addLocal(uint64_t hash,
+                             const Rect& rect)
+{
+    mItems.push_back({ hash, rect });
+}
+
+void DamageTracker::invalidate()
+{
+    mFullyInvalid = true;
+}
+
+void DamageTracker::invalidate(const Rect& rect)
+{
+    unite(mInvalidRect, rect);
+}
+
+DamageTracker::EDamage DamageTracker::endFrame(unsigned bufferAge,
+                                               bool partialAllowed,
+                                               Rect& damage)
+{
+    bool full = !mHasLastFrame || mFullyInvalid || mGlobal != mLastGlobal;
+    Rect frameDamage = mInvalidRect;
+
+    if (!full) {
+        // items compare by position, so reordering damages all of them
+        size_t common = std::min(mItems.size(), mLastItems.size());
+        for (size_t i = 0; i < common; ++i) {
+            if (mItems[i].hash != mLastItems[i].hash) {
+                unite(frameDamage, mItems[i].rect);
+                unite(frameDamage, mLastItems[i].rect);
+            }
+        }
+        for (size_t i = common; i < mItems.size(); ++i) {
+            unite(frameDamage, mItems[i].rect);
+        }
+        for (size_t i = common; i < mLastItems.size(); ++i) {
+            unite(frameDamage, mLastItems[i].rect);
+        }
+    }
+
+    mLastGlobal = mGlobal;
+    mGlobal = HASH_SEED;
+    mLastItems.swap(mItems);
+    mItems.clear();
+    mHasLastFrame = true;
+    mFullyInvalid = false;
+    mInvalidRect = Rect();
+
+    if (!full && frameDamage.isEmpty()) {
+        ++mStats.skipped;
+        return DamageNone;
+    }
+
+    mHistory.insert(mHistory.begin(), full ? Rect() : frameDamage);
+    if (mHistory.size() > MAX_BUFFER_AGE) {
+        mHistory.pop_back();
+    }
+
+    if (!full && partialAllowed
+            && bufferAge > 0 && bufferAge <= mHistory.size()) {
+        // the back buffer lacks everything presented after it
+        damage = Rect();
+        for (unsigned i = 0; i < bufferAge && !full; ++i) {
+            full = mHistory[i].isEmpty();
+            unite(damage, mHistory[i]);
+        }
+
+        if (!full) {
+            ++mStats.partial;
+            return DamagePartial;
+        }
+    }
+
+    ++mStats.full;
+    return DamageFull;
+}
+
+void DamageTracker::reset()
+{
+    mGlobal = HASH_SEED;
+    mHasLastFrame = false;
+    mItems.clear();
+    mLastItems.clear();
+    mHistory.clear();
+}
+
+} // namespace sb
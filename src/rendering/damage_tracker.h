@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace sb {
+
+// Finds out what changed since the last presented frame, so that frames
+// nothing changed in can be skipped and 2D changes redrawn partially.
+//
+// Everything that can affect the whole frame (camera, viewport, 3D draws,
+// ...) is folded into one hash with addGlobal(). 2D items are added one
+// by one with addLocal(), together with the window rectangle they cover;
+// an item that differs from the one at the same position in the last
+// frame damages both rectangles only.
+//
+// A partial redraw relies on the back buffer still holding an older frame.
+// bufferAge tells how many frames ago its contents were presented
+// (GLX_EXT_buffer_age; always 1 for offscreen targets, 0 if unknown), and
+// the damage of all frames since then is redrawn.
+class DamageTracker
+{
+public:
+    static const unsigned MAX_BUFFER_AGE = 4;
+    static const uint64_t HASH_SEED = 14695981039346656037ULL;
+
+    enum EDamage {
+        DamageNone,     // frame can be skipped
+        DamagePartial,  // only the damage rectangle needs redrawing
+        DamageFull
+    };
+
+    // window coordinates, origin in the bottom left corner
+    struct Rect
+    {
+        int x;
+        int y;
+        int width;
+        int height;
+
+        bool isEmpty() const { return width <= 0 || height <= 0; }
+    };
+
+    struct Stats
+    {
+        uint64_t skipped;
+        uint64_t partial;
+        uint64_t full;
+    };
+
+    DamageTracker();
+    ~DamageTracker();
+
+    DamageTracker(const DamageTracker&) = delete;
+    DamageTracker(DamageTracker&&) = delete;
+    DamageTracker& operator =(const DamageTracker&) = delete;
+    DamageTracker& operator =(DamageTracker&&) = delete;
+
+    // FNV-1a, chain calls by passing the previous result as seed
+    static uint64_t hash(const void* data,
+                         size_t size,
+                         uint64_t seed = HASH_SEED);
+
+    void addGlobal(const void* data,
+                   size_t size);
+    void addLocal(uint64_t hash,
+                  const Rect& rect);
+    // for changes the tracker cannot see, e.g. texture contents; the next
+    // frame is redrawn entirely or within rect
+    void invalidate();
+    void invalidate(const Rect& rect);
+
+    // classifies the frame made of everything added since the last call.
+    // damage is set for DamagePartial, which is only returned if
+    // partialAllowed
+    EDamage endFrame(unsigned bufferAge,
+                     bool partialAllowed,
+                     Rect& damage);
+    // forgets the last frame, the next one is redrawn entirely
+    void reset();
+
+    const Stats& getStats() const { return mStats; }
+
+private:
+    struct Item
+    {
+        uint64_t hash;
+        Rect rect;
+    };
+
+    uint64_t mGlobal;
+    uint64_t mLastGlobal;
+    bool mHasLastFrame;
+    bool mFullyInvalid;
+    Rect mInvalidRect;
+
+    std::vector<Item> mItems;
+    std::vector<Item> mLastItems;
+    // damage of the last presented frames, newest first; empty rects
+    // stand for full redraws
+    std::vector<Rect> mHistory;
+
+    Stats mStats;
+};
+
+} // namespace sb
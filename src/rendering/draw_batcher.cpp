@@ -0,0 +1,364 @@
+#include "rendering/draw_batcher.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include "rendering/camera.h"
+#include "rendering/frame_uniforms.h"
+#include "rendering/gl_state.h"
+#include "rendering/stream_buffer.h"
+#include "utils/gl.h"
+#include "utils/logger.h"
+
+namespace sb {
+namespace {
+
+// fits SortKey::SHAPE_BITS
+uint32_t getShapeIndex(GLenum shape)
+{
+    switch (shape) {
+    case GL_TRIANGLES:
+        return 0;
+    case GL_LINES:
+        return 1;
+    case GL_POINTS:
+        return 2;
+    default:
+        return 3;
+    }
+}
+
+} // namespace
+
+bool DrawBatcher::BatchKey::operator ==(const BatchKey& k) const
+{
+    return program == k.program
+           && texture == k.texture
+           && shape == k.shape
+           && projection == k.projection
+           && translucent == k.translucent;
+}
+
+DrawBatcher::DrawBatcher():
+    mQueue(),
+    mDeferred(),
+    mOrder(),
+    mSortScratch(),
+    mBatches(),
+    mVertices(),
+    mIndices(),
+    mMatrixLocations(),
+    mState(NULL),
+    mStream(NULL),
+    mVAO(0),
+    mVertexBuffer(0),
+    mIndexBuffer(0),
+    mVertexBufferCapacity(0),
+    mIndexBufferCapacity(0),
+    mIndexOffset(0),
+    mStats(),
+    mPartiallyFlushed(false)
+{
+}
+
+DrawBatcher::~DrawBatcher()
+{
+    if (mVAO) {
+        mState->deleteVertexArray(mVAO);
+    }
+    if (mVertexBuffer) {
+        mState->deleteBuffer(mVertexBuffer);
+    }
+    if (mIndexBuffer) {
+        mState->deleteBuffer(mIndexBuffer);
+    }
+}
+
+bool DrawBatcher::init(GLState& state,
+                       StreamBuffer& stream)
+{
+    mState = &state;
+    mStream = &stream;
+
+    GL_CHECK_RET(glGenVertexArrays(1, &mVAO), false);
+    GL_CHECK_RET(glGenBuffers(1, &mVertexBuffer), false);
+    GL_CHECK_RET(glGenBuffers(1, &mIndexBuffer), false);
+
+    mState->bindVertexArray(mVAO);
+    GL_CHECK(glEnableVertexAttribArray(AttribPosition));
+    GL_CHECK(glEnableVertexAttribArray(AttribColor));
+    GL_CHECK(glEnableVertexAttribArray(AttribTexcoord));
+    mState->bindVertexArray(0);
+
+    return true;
+}
+
+// VAO must be bound
+void DrawBatcher::setVertexSource(BufferId vertexBuffer,
+                                  size_t vertexOffset,
+                                  BufferId indexBuffer)
+{
+    mState->bindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glVertexAttribPointer(AttribPosition, 3, GL_FLOAT, GL_FALSE,
+                          sizeof(Vertex),
+                          (void*)(vertexOffset + offsetof(Vertex, position)));
+    glVertexAttribPointer(AttribColor, 4, GL_FLOAT, GL_FALSE,
+                          sizeof(Vertex),
+                          (void*)(vertexOffset + offsetof(Vertex, color)));
+    glVertexAttribPointer(AttribTexcoord, 2, GL_FLOAT, GL_FALSE,
+                          sizeof(Vertex),
+                          (void*)(vertexOffset + offsetof(Vertex, texcoord)));
+    mState->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+}
+
+DrawBatcher::BatchKey DrawBatcher::makeKey(const Drawable& d) const
+{
+    return {
+        d.getProgram(),
+        d.getTexture(),
+        d.getMesh().getListShape(),
+        d.getProjectionType(),
+        d.isTranslucent()
+    };
+}
+
+void DrawBatcher::add(const Drawable& d)
+{
+    mQueue.push_back({ makeKey(d), &d.getMesh(), &d.getTransform(), NULL,
+                       d.getLayer() });
+}
+
+void DrawBatcher::addInstances(const Drawable& d,
+                               const Mat44* transforms,
+                               const Color* colors,
+                               size_t count)
+{
+    BatchKey key = makeKey(d);
+    for (size_t i = 0; i < count; ++i) {
+        mQueue.push_back({ key, &d.getMesh(), &transforms[i],
+                           colors ? &colors[i] : NULL, d.getLayer() });
+    }
+}
+
+void DrawBatcher::flush(Camera& camera)
+{
+    if (!mPartiallyFlushed) {
+        mStats = Stats();
+    }
+    mPartiallyFlushed = false;
+
+    drawQueue(camera);
+}
+
+void DrawBatcher::flush(Camera& camera,
+                        EProjectionType projection)
+{
+    if (!mPartiallyFlushed) {
+        mStats = Stats();
+        mPartiallyFlushed = true;
+    }
+
+    auto deferred = std::stable_partition(
+            mQueue.begin(), mQueue.end(),
+            [projection](const Submission& s) {
+                return s.key.projection == projection;
+            });
+    mDeferred.assign(deferred, mQueue.end());
+    mQueue.erase(deferred, mQueue.end());
+
+    drawQueue(camera);
+    mQueue.swap(mDeferred);
+}
+
+void DrawBatcher::discard()
+{
+    mQueue.clear();
+    mPartiallyFlushed = false;
+}
+
+void DrawBatcher::drawQueue(Camera& camera)
+{
+    mStats.drawables += (uint32_t)mQueue.size();
+
+    if (!mQueue.empty()) {
+        sort(camera);
+        build();
+        upload();
+        submit(camera);
+    }
+
+    mQueue.clear();
+}
+
+void DrawBatcher::sort(Camera& camera)
+{
+    const Vec3& eye = camera.getEye();
+
+    mOrder.clear();
+    mOrder.reserve(mQueue.size());
+
+    for (size_t i = 0; i < mQueue.size(); ++i) {
+        const Submission& s = mQueue[i];
+
+        // squared distance orders the same as distance; orthographic draws
+        // keep submission order (the sort is stable)
+        float depth = 0.f;
+        if (s.key.projection == ProjectionPerspective) {
+            const Mat44& t = *s.transform;
+            Vec3 d(t[3][0] - eye.x, t[3][1] - eye.y, t[3][2] - eye.z);
+            depth = d.x * d.x + d.y * d.y + d.z * d.z;
+        }
+
+        uint64_t key = SortKey::make(s.layer, s.key.translucent,
+                                     s.key.projection, s.key.program,
+                                     s.key.texture,
+                                     getShapeIndex(s.key.shape), depth);
+        mOrder.push_back({ key, (uint32_t)i });
+    }
+
+    radixSort(mOrder, mSortScratch);
+}
+
+void DrawBatcher::build()
+{
+    mBatches.clear();
+    mVertices.clear();
+    mIndices.clear();
+
+    for (const SortEntry& entry: mOrder) {
+        const Submission& s = mQueue[entry.index];
+
+        if (mBatches.empty() || !(mBatches.back().key == s.key)) {
+            mBatches.push_back({ s.key, mIndices.size(), 0 });
+        }
+
+        appendGeometry(s);
+        mBatches.back().numIndices = mIndices.size()
+                                     - mBatches.back().firstIndex;
+    }
+
+    mStats.batches += (uint32_t)mBatches.size();
+    mStats.vertices += (uint32_t)mVertices.size();
+    mStats.indices += (uint32_t)mIndices.size();
+}
+
+void DrawBatcher::appendGeometry(const Submission& s)
+{
+    const Mat44& transform = *s.transform;
+
+    IndexType base = (IndexType)mVertices.size();
+    for (const Vertex& v: s.mesh->getVertices()) {
+        Vec4 pos = simd::transform(transform,
+                                   Vec4(v.position.x, v.position.y,
+                                        v.position.z, 1.f));
+        mVertices.push_back(Vertex(Vec3(pos.x, pos.y, pos.z),
+                                   s.color ? v.color * *s.color : v.color,
+                                   v.texcoord));
+    }
+
+    s.mesh->appendListIndices(base, mIndices);
+}
+
+void DrawBatcher::upload()
+{
+    mState->bindVertexArray(mVAO);
+
+    if (!uploadStreamed()) {
+        uploadOrphaned();
+    }
+}
+
+bool DrawBatcher::uploadStreamed()
+{
+    size_t vertexBytes = mVertices.size() * sizeof(Vertex);
+    size_t indexBytes = mIndices.size() * sizeof(IndexType);
+
+    StreamBuffer::Allocation vertices = mStream->allocate(vertexBytes);
+    if (!vertices.isValid()) {
+        return false;
+    }
+    StreamBuffer::Allocation indices = mStream->allocate(indexBytes);
+    if (!indices.isValid()) {
+        return false;
+    }
+
+    memcpy(vertices.ptr, mVertices.data(), vertexBytes);
+    memcpy(indices.ptr, mIndices.data(), indexBytes);
+    mStream->flush();
+
+    setVertexSource(mStream->getId(), vertices.offset, mStream->getId());
+    mIndexOffset = indices.offset;
+    return true;
+}
+
+// used only when the stream buffer runs out of space for this frame
+void DrawBatcher::uploadOrphaned()
+{
+    size_t vertexBytes = mVertices.size() * sizeof(Vertex);
+    size_t indexBytes = mIndices.size() * sizeof(IndexType);
+
+    setVertexSource(mVertexBuffer, 0, mIndexBuffer);
+    mIndexOffset = 0;
+
+    // reallocating with NULL data orphans the old storage, so the driver
+    // does not have to wait for the previous frame to finish
+    if (vertexBytes > mVertexBufferCapacity) {
+        mVertexBufferCapacity = std::max(vertexBytes,
+                                         mVertexBufferCapacity * 2);
+    }
+    mState->bindBuffer(GL_ARRAY_BUFFER, mVertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, mVertexBufferCapacity, NULL,
+                 GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, vertexBytes, mVertices.data());
+
+    if (indexBytes > mIndexBufferCapacity) {
+        mIndexBufferCapacity = std::max(indexBytes,
+                                        mIndexBufferCapacity * 2);
+    }
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mIndexBufferCapacity, NULL,
+                 GL_STREAM_DRAW);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indexBytes, mIndices.data());
+}
+
+void DrawBatcher::submit(Camera& camera)
+{
+    ProgramId currProgram = 0;
+    EProjectionType currProjection = ProjectionPerspective;
+    bool matrixSet = false;
+
+    mState->bindVertexArray(mVAO);
+
+    for (const Batch& batch: mBatches) {
+        const BatchKey& key = batch.key;
+
+        if (key.program != currProgram) {
+            mState->useProgram(key.program);
+            currProgram = key.program;
+            matrixSet = false;
+        }
+        mState->bindTexture(0, GL_TEXTURE_2D, key.texture);
+        mState->depthMask(!key.translucent);
+
+        // programs reading the frame uniform block have no matrix uniform
+        GLint matrixLocation = mMatrixLocations.get(*mState, key.program);
+        if (matrixLocation >= 0
+                && (!matrixSet || key.projection != currProjection)) {
+            Mat44 viewProjection = camera.getViewProjectionMatrix(key.projection);
+            glUniformMatrix4fv(matrixLocation, 1, GL_FALSE,
+                               &viewProjection[0][0]);
+            currProjection = key.projection;
+            matrixSet = true;
+        }
+
+        glDrawElements(key.shape, (GLsizei)batch.numIndices, GL_UNSIGNED_INT,
+                       (void*)(mIndexOffset
+                               + batch.firstIndex * sizeof(IndexType)));
+    }
+
+    mState->depthMask(true);
+    mState->bindVertexArray(0);
+}
+
+} // namespace sb
+
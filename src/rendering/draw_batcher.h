@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "rendering/drawable.h"
+#include "rendering/frame_uniforms.h"
+#include "rendering/sort_key.h"
+#include "rendering/types.h"
+
+namespace sb {
+
+class Camera;
+class GLState;
+class StreamBuffer;
+
+// Collects drawables submitted during a frame, orders them by SortKey and
+// merges consecutive ones sharing program, texture, primitive, projection
+// and translucency into a single indexed draw.
+class DrawBatcher
+{
+public:
+    struct Stats
+    {
+        uint32_t drawables;
+        uint32_t batches;
+        uint32_t vertices;
+        uint32_t indices;
+    };
+
+    DrawBatcher();
+    ~DrawBatcher();
+
+    DrawBatcher(const DrawBatcher&) = delete;
+    DrawBatcher(DrawBatcher&&) = delete;
+    DrawBatcher& operator =(const DrawBatcher&) = delete;
+    DrawBatcher& operator =(DrawBatcher&&) = delete;
+
+    // requires a current GL context; geometry is streamed through stream
+    // whenever it fits, both state and stream must outlive the batcher
+    bool init(GLState& state,
+              StreamBuffer& stream);
+
+    void add(const Drawable& d);
+    // draws count copies of d's mesh, replacing its transform with
+    // transforms[i] and modulating vertex colors by colors[i] (if not NULL);
+    // arrays must stay alive until flush()
+    void addInstances(const Drawable& d,
+                      const Mat44* transforms,
+                      const Color* colors,
+                      size_t count);
+    void flush(Camera& camera);
+    // draws only what uses projection, the rest stays queued for a later
+    // flush; statistics cover all flushes up to the next full one
+    void flush(Camera& camera,
+               EProjectionType projection);
+    // forgets everything queued without drawing it
+    void discard();
+
+    // statistics of the last flushed frame
+    const Stats& getStats() const { return mStats; }
+
+private:
+    struct BatchKey
+    {
+        ProgramId program;
+        TextureId texture;
+        GLenum shape;
+        EProjectionType projection;
+        bool translucent;
+
+        bool operator ==(const BatchKey& k) const;
+    };
+
+    struct Submission
+    {
+        BatchKey key;
+        const Mesh* mesh;
+        const Mat44* transform;
+        const Color* color;     // NULL if vertex colors are used as-is
+        uint8_t layer;
+    };
+
+    struct Batch
+    {
+        BatchKey key;
+        size_t firstIndex;
+        size_t numIndices;
+    };
+
+    std::vector<Submission> mQueue;
+    std::vector<Submission> mDeferred;
+    std::vector<SortEntry> mOrder;
+    std::vector<SortEntry> mSortScratch;
+    std::vector<Batch> mBatches;
+    std::vector<Vertex> mVertices;
+    std::vector<IndexType> mIndices;
+    MatrixLocations mMatrixLocations;
+
+    GLState* mState;
+    StreamBuffer* mStream;
+    GLuint mVAO;
+    BufferId mVertexBuffer;
+    BufferId mIndexBuffer;
+    size_t mVertexBufferCapacity;
+    size_t mIndexBufferCapacity;
+    size_t mIndexOffset;
+
+    Stats mStats;
+    bool mPartiallyFlushed;
+
+    void drawQueue(Camera& camera);
+    void sort(Camera& camera);
+    void build();
+    BatchKey makeKey(const Drawable& d) const;
+    void appendGeometry(const Submission& s);
+    void upload();
+    bool uploadStreamed();
+    void uploadOrphaned();
+    void setVertexSource(BufferId vertexBuffer,
+                         size_t vertexOffset,
+                         BufferId indexBuffer);
+    void submit(Camera& camera);
+};
+
+} // namespace sb
+
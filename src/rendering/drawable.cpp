@@ -0,0 +1,23 @@
+#include "rendering/drawable.h"
+
+#include <cassert>
+
+namespace sb {
+
+Drawable::Drawable(const std::shared_ptr<const Mesh>& mesh,
+                   ProgramId program,
+                   TextureId texture,
+                   EProjectionType projection):
+    mMesh(mesh),
+    mProgram(program),
+    mTexture(texture),
+    mProjection(projection),
+    mTransform(1.f),
+    mLayer(0),
+    mTranslucent(false)
+{
+    assert(mMesh);
+}
+
+} // namespace sb
+
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+
+#include "rendering/mesh.h"
+#include "rendering/sort_key.h"
+#include "rendering/types.h"
+#include "utils/types.h"
+
+namespace sb {
+
+class Drawable
+{
+public:
+    Drawable(const std::shared_ptr<const Mesh>& mesh,
+             ProgramId program,
+             TextureId texture = 0,
+             EProjectionType projection = ProjectionPerspective);
+
+    const Mesh& getMesh() const { return *mMesh; }
+    const std::shared_ptr<const Mesh>& getSharedMesh() const { return mMesh; }
+    ProgramId getProgram() const { return mProgram; }
+    TextureId getTexture() const { return mTexture; }
+    EProjectionType getProjectionType() const { return mProjection; }
+
+    const Mat44& getTransform() const { return mTransform; }
+    void setTransform(const Mat44& transform) { mTransform = transform; }
+
+    // layers are drawn in increasing order; 0 to SortKey::MAX_LAYER, the
+    // largest the sort key can encode, larger values are clamped
+    uint8_t getLayer() const { return mLayer; }
+    void setLayer(uint8_t layer)
+    {
+        assert(layer <= SortKey::MAX_LAYER && "layer out of range");
+        mLayer = layer < SortKey::MAX_LAYER ? layer : SortKey::MAX_LAYER;
+    }
+    // translucent drawables are drawn back-to-front after opaque ones of
+    // the same layer, without depth writes
+    bool isTranslucent() const { return mTranslucent; }
+    void setTranslucent(bool translucent) { mTranslucent = translucent; }
+
+private:
+    std::shared_ptr<const Mesh> mMesh;
+    ProgramId mProgram;
+    TextureId mTexture;
+    EProjectionType mProjection;
+    Mat44 mTransform;
+    uint8_t mLayer;
+    bool mTranslucent;
+};
+
+} // namespace sb
+
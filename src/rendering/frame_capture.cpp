@@ -0,0 +1,464 @@
+#include "rendering/frame_capture.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "rendering/gl_state.h"
+#include "utils/gl.h"
+#include "utils/logger.h"
+
+namespace sb {
+namespace {
+
+// how long to wait for a readback before giving up on it, in nanoseconds
+const GLuint64 READBACK_TIMEOUT = 1000000000;
+
+const unsigned BYTES_PER_PIXEL = 4;
+
+bool endsWith(const std::string& str,
+              const char* suffix)
+{
+    size_t len = strlen(suffix);
+    return str.size() >= len
+           && str.compare(str.size() - len, len, suffix) == 0;
+}
+
+// BT.601, limited range
+void rgbToYuv(const uint8_t* rgb,
+              uint8_t& y,
+              uint8_t& u,
+              uint8_t& v)
+{
+    int r = rgb[0];
+    int g = rgb[1];
+    int b = rgb[2];
+
+    y = (uint8_t)(16 + ((66 * r + 129 * g + 25 * b + 128) >> 8));
+    u = (uint8_t)(128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8));
+    v = (uint8_t)(128 + ((112 * r - 94 * g - 18 * b + 128) >> 8));
+}
+
+// number of integer conversions in a printf pattern, -1 if it has any
+// other conversion; "%%" is allowed
+int countIndexConversions(const std::string& pattern)
+{
+    int count = 0;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] != '%') {
+            continue;
+        }
+
+        // flags and width, no precision or length modifiers
+        size_t at = pattern.find_first_not_of("-+ #0123456789", i + 1);
+        if (at == std::string::npos) {
+            return -1;
+        }
+
+        char conversion = pattern[at];
+        if (conversion == '%' && at == i + 1) {
+            i = at;
+            continue;
+        }
+        if (!strchr("diuoxX", conversion)) {
+            return -1;
+        }
+
+        ++count;
+        i = at;
+    }
+    return count;
+}
+
+} // namespace
+
+const unsigned FrameCapture::RING_SIZE;
+const unsigned FrameCapture::MAX_QUEUED_FRAMES;
+
+FrameCapture::FrameCapture():
+    mState(NULL),
+    mSupported(false),
+    mActive(false),
+    mPath(),
+    mFormat(FormatRaw),
+    mWidth(0),
+    mHeight(0),
+    mFps(0),
+    mSlots(),
+    mNextSlot(0),
+    mNextFrame(0),
+    mFramePool(),
+    mFreeFrames(MAX_QUEUED_FRAMES),
+    mFilledFrames(MAX_QUEUED_FRAMES),
+    mWriter(),
+    mStopWriter(false),
+    mWritten(0),
+    mFile(NULL),
+    mRowBuffer(),
+    mStats()
+{
+}
+
+FrameCapture::~FrameCapture()
+{
+    stop();
+
+    for (Slot& slot: mSlots) {
+        if (slot.buffer) {
+            mState->deleteBuffer(slot.buffer);
+        }
+    }
+}
+
+bool FrameCapture::init(GLState& state)
+{
+    mState = &state;
+
+    mSupported = GLEW_ARB_pixel_buffer_object && GLEW_ARB_map_buffer_range;
+    if (!mSupported) {
+        gLog.warn("pixel buffer objects not available, frame capture "
+                  "disabled\n");
+        return false;
+    }
+
+    for (Slot& slot: mSlots) {
+        GL_CHECK_RET(glGenBuffers(1, &slot.buffer), false);
+        slot.fence = 0;
+        slot.pending = false;
+    }
+
+    return true;
+}
+
+FrameCapture::EFormat FrameCapture::formatFromPath(const std::string& path)
+{
+    if (endsWith(path, ".ppm")) {
+        return FormatPPM;
+    }
+    if (endsWith(path, ".y4m")) {
+        return FormatY4M;
+    }
+    return FormatRaw;
+}
+
+bool FrameCapture::start(const std::string& path,
+                         EFormat format,
+                         unsigned width,
+                         unsigned height,
+                         unsigned fps)
+{
+    if (!mSupported) {
+        gLog.err("frame capture not supported\n");
+        return false;
+    }
+
+    stop();
+
+    mPath = path;
+    if (format == FormatPPM) {
+        // the pattern ends up as a format string in writePPM()
+        int conversions = countIndexConversions(path);
+        if (conversions < 0 || conversions > 1) {
+            gLog.err("invalid frame pattern %s, expected at most one "
+                     "integer conversion\n", path.c_str());
+            return false;
+        }
+        if (conversions == 0) {
+            // one file per frame, not the same one overwritten
+            size_t ext = path.rfind('.');
+            size_t dir = path.rfind('/');
+            if (ext == std::string::npos
+                    || (dir != std::string::npos && ext < dir)) {
+                ext = path.size();
+            }
+            mPath = path.substr(0, ext) + "_%05u" + path.substr(ext);
+        }
+    }
+
+    mFormat = format;
+    mWidth = width;
+    mHeight = height;
+    mFps = fps;
+
+    if (format != FormatPPM) {
+        mFile = fopen(path.c_str(), "wb");
+        if (!mFile) {
+            gLog.err("cannot open %s for writing\n", path.c_str());
+            return false;
+        }
+    }
+
+    if (format == FormatY4M) {
+        fprintf(mFile, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n",
+                width, height, fps);
+    }
+
+    size_t frameBytes = (size_t)width * height * BYTES_PER_PIXEL;
+
+    for (Slot& slot: mSlots) {
+        mState->bindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+        GL_CHECK(glBufferData(GL_PIXEL_PACK_BUFFER, frameBytes, NULL,
+                              GL_STREAM_READ));
+    }
+    mState->bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    Frame* frame;
+    while (mFreeFrames.pop(frame)) {}
+    while (mFilledFrames.pop(frame)) {}
+
+    mFramePool.clear();
+    for (unsigned i = 0; i < MAX_QUEUED_FRAMES; ++i) {
+        mFramePool.emplace_back(new Frame());
+        mFramePool.back()->pixels.resize(frameBytes);
+        mFreeFrames.push(mFramePool.back().get());
+    }
+
+    mNextSlot = 0;
+    mNextFrame = 0;
+    mStats = Stats();
+    mWritten = 0;
+    mStopWriter = false;
+    mWriter = std::thread(&FrameCapture::writerLoop, this);
+
+    gLog.info("capturing %ux%u frames to %s\n", width, height, mPath.c_str());
+    mActive = true;
+    return true;
+}
+
+void FrameCapture::stop()
+{
+    if (!mActive) {
+        return;
+    }
+
+    for (unsigned i = 0; i < RING_SIZE; ++i) {
+        Slot& slot = mSlots[(mNextSlot + i) % RING_SIZE];
+        if (slot.pending) {
+            resolve(slot);
+        }
+    }
+
+    mStopWriter = true;
+    mWriter.join();
+
+    if (mFile) {
+        fclose(mFile);
+        mFile = NULL;
+    }
+
+    mActive = false;
+
+    Stats stats = getStats();
+    gLog.info("frame capture: %u captured, %u written, %u dropped, "
+              "%u stalls, %.3f ms/frame on render thread\n",
+              stats.captured, stats.written, stats.dropped, stats.stalls,
+              stats.captured ? stats.cpuMilliseconds / stats.captured : 0.0);
+}
+
+void FrameCapture::capture()
+{
+    if (!mActive) {
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    resolveReady();
+
+    Slot& slot = mSlots[mNextSlot];
+    if (slot.pending) {
+        ++mStats.stalls;
+        resolve(slot);
+    }
+
+    mState->bindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    glReadPixels(0, 0, mWidth, mHeight, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    mState->bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot.fence = GLEW_ARB_sync
+                 ? glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)
+                 : 0;
+    slot.frame = mNextFrame++;
+    slot.pending = true;
+    mNextSlot = (mNextSlot + 1) % RING_SIZE;
+    ++mStats.captured;
+
+    std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+    mStats.cpuMilliseconds += elapsed.count();
+}
+
+// maps readbacks that already finished, oldest first
+void FrameCapture::resolveReady()
+{
+    for (unsigned i = 0; i < RING_SIZE; ++i) {
+        Slot& slot = mSlots[(mNextSlot + i) % RING_SIZE];
+        if (!slot.pending) {
+            continue;
+        }
+
+        // without fences, wait until the slot is reused
+        if (!slot.fence
+                || glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+
+        resolve(slot);
+    }
+}
+
+void FrameCapture::resolve(Slot& slot)
+{
+    slot.pending = false;
+
+    if (slot.fence) {
+        GLenum result = glClientWaitSync(slot.fence,
+                                         GL_SYNC_FLUSH_COMMANDS_BIT,
+                                         READBACK_TIMEOUT);
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+
+        if (result == GL_TIMEOUT_EXPIRED || result == GL_WAIT_FAILED) {
+            gLog.warn("readback of frame %u timed out\n", slot.frame);
+            ++mStats.dropped;
+            return;
+        }
+    }
+
+    Frame* frame;
+    if (!mFreeFrames.pop(frame)) {
+        ++mStats.dropped;
+        return;
+    }
+
+    size_t bytes = frame->pixels.size();
+
+    mState->bindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    void* ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes,
+                                 GL_MAP_READ_BIT);
+    if (ptr) {
+        memcpy(frame->pixels.data(), ptr, bytes);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    mState->bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    if (!ptr) {
+        gLog.warn("cannot map readback of frame %u\n", slot.frame);
+        mFreeFrames.push(frame);
+        ++mStats.dropped;
+        return;
+    }
+
+    frame->index = slot.frame;
+    // cannot fail, both queues are as large as the pool
+    mFilledFrames.push(frame);
+}
+
+FrameCapture::Stats FrameCapture::getStats() const
+{
+    Stats stats = mStats;
+    stats.written = mWritten;
+    return stats;
+}
+
+void FrameCapture::writerLoop()
+{
+    while (true) {
+        // read before popping: once set, the last frame was pushed already,
+        // so an empty queue really is the end
+        bool stopping = mStopWriter;
+
+        Frame* frame;
+        if (mFilledFrames.pop(frame)) {
+            write(*frame);
+            mFreeFrames.push(frame);
+            ++mWritten;
+        } else if (stopping) {
+            break;
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    if (mFile) {
+        fflush(mFile);
+    }
+}
+
+// GL returns rows bottom-up
+const uint8_t* FrameCapture::getRow(const Frame& frame,
+                                    unsigned y) const
+{
+    return &frame.pixels[(size_t)(mHeight - 1 - y) * mWidth
+                         * BYTES_PER_PIXEL];
+}
+
+void FrameCapture::write(const Frame& frame)
+{
+    switch (mFormat) {
+    case FormatRaw:
+        writeRaw(frame);
+        break;
+    case FormatPPM:
+        writePPM(frame);
+        break;
+    case FormatY4M:
+        writeY4M(frame);
+        break;
+    }
+}
+
+void FrameCapture::writeRaw(const Frame& frame)
+{
+    for (unsigned y = 0; y < mHeight; ++y) {
+        fwrite(getRow(frame, y), BYTES_PER_PIXEL, mWidth, mFile);
+    }
+}
+
+void FrameCapture::writePPM(const Frame& frame)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), mPath.c_str(), frame.index);
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        gLog.err("cannot open %s for writing\n", path);
+        return;
+    }
+
+    fprintf(file, "P6\n%u %u\n255\n", mWidth, mHeight);
+
+    mRowBuffer.resize(mWidth * 3);
+    for (unsigned y = 0; y < mHeight; ++y) {
+        const uint8_t* src = getRow(frame, y);
+        for (unsigned x = 0; x < mWidth; ++x) {
+            memcpy(&mRowBuffer[x * 3], &src[x * BYTES_PER_PIXEL], 3);
+        }
+        fwrite(mRowBuffer.data(), 1, mRowBuffer.size(), file);
+    }
+
+    fclose(file);
+}
+
+void FrameCapture::writeY4M(const Frame& frame)
+{
+    size_t planeSize = (size_t)mWidth * mHeight;
+    mRowBuffer.resize(planeSize * 3);
+
+    uint8_t* planeY = &mRowBuffer[0];
+    uint8_t* planeU = &mRowBuffer[planeSize];
+    uint8_t* planeV = &mRowBuffer[planeSize * 2];
+
+    for (unsigned y = 0; y < mHeight; ++y) {
+        const uint8_t* src = getRow(frame, y);
+        for (unsigned x = 0; x < mWidth; ++x) {
+            size_t idx = (size_t)y * mWidth + x;
+            rgbToYuv(&src[x * BYTES_PER_PIXEL],
+                     planeY[idx], planeU[idx], planeV[idx]);
+        }
+    }
+
+    fputs("FRAME\n", mFile);
+    fwrite(mRowBuffer.data(), 1, mRowBuffer.size(), mFile);
+}
+
+} // namespace sb
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rendering/types.h"
+#include "utils/lockfree_queue.h"
+
+namespace sb {
+
+class GLState;
+
+// Reads rendered frames back without stalling the pipeline: glReadPixels
+// goes into one of RING_SIZE pixel-pack buffers, which is mapped only once
+// its fence signals, usually a frame or two later. Pixels are then handed
+// to a writer thread, so the render thread never touches the disk.
+//
+// If the writer falls behind, frames are dropped instead of blocking.
+class FrameCapture
+{
+public:
+    static const unsigned RING_SIZE = 3;
+    static const unsigned MAX_QUEUED_FRAMES = 8;
+
+    enum EFormat {
+        FormatRaw,      // RGBA8 frames, top row first, appended to one file
+        FormatPPM,      // one binary PPM per frame
+        FormatY4M       // YUV 4:4:4 stream, one file
+    };
+
+    struct Stats
+    {
+        uint32_t captured;
+        uint32_t written;
+        uint32_t dropped;       // writer too slow
+        uint32_t stalls;        // had to wait for a readback to finish
+        double cpuMilliseconds; // spent in capture() on the render thread
+    };
+
+    FrameCapture();
+    ~FrameCapture();
+
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture(FrameCapture&&) = delete;
+    FrameCapture& operator =(const FrameCapture&) = delete;
+    FrameCapture& operator =(FrameCapture&&) = delete;
+
+    // requires a current GL context; state must outlive the capture
+    bool init(GLState& state);
+
+    // for FormatPPM, path is a printf pattern taking the frame number,
+    // e.g. "frame_%05u.ppm"; without a conversion, "_%05u" is inserted
+    // before the extension. fps is only stored in the Y4M header
+    bool start(const std::string& path,
+               EFormat format,
+               unsigned width,
+               unsigned height,
+               unsigned fps = 60);
+    // waits for pending readbacks and for the writer to finish
+    void stop();
+    bool isActive() const { return mActive; }
+    unsigned getWidth() const { return mWidth; }
+    unsigned getHeight() const { return mHeight; }
+
+    // reads the currently bound read framebuffer; call after the frame is
+    // rendered, before presenting it
+    void capture();
+
+    Stats getStats() const;
+
+    // picks the format by extension: .ppm, .y4m, anything else is raw
+    static EFormat formatFromPath(const std::string& path);
+
+private:
+    struct Frame
+    {
+        std::vector<uint8_t> pixels;
+        uint32_t index;
+    };
+
+    struct Slot
+    {
+        BufferId buffer;
+        GLsync fence;
+        uint32_t frame;
+        bool pending;
+    };
+
+    GLState* mState;
+    bool mSupported;
+    bool mActive;
+
+    std::string mPath;
+    EFormat mFormat;
+    unsigned mWidth;
+    unsigned mHeight;
+    unsigned mFps;
+
+    Slot mSlots[RING_SIZE];
+    unsigned mNextSlot;
+    uint32_t mNextFrame;
+
+    std::vector<std::unique_ptr<Frame>> mFramePool;
+    utils::LockFreeQueue<Frame*> mFreeFrames;
+    utils::LockFreeQueue<Frame*> mFilledFrames;
+
+    std::thread mWriter;
+    std::atomic<bool> mStopWriter;
+    std::atomic<uint32_t> mWritten;
+    FILE* mFile;
+    std::vector<uint8_t> mRowBuffer;
+
+    Stats mStats;
+
+    void resolveReady();
+    void resolve(Slot& slot);
+
+    void writerLoop();
+    void write(const Frame& frame);
+    void writeRaw(const Frame& frame);
+    void writePPM(const Frame& frame);
+    void writeY4M(const Frame& frame);
+    const uint8_t* getRow(const Frame& frame,
+                          unsigned y) const;
+};
+
+} // namespace sb
@@ -0,0 +1,783 @@
+#include "rendering/frame_graph.h"
+
+#include <algorithm>
+
+#include "rendering/gl_state.h"
+#include "utils/gl.h"
+#include "utils/logger.h"
+
+namespace sb {
+namespace {
+
+enum EAttachmentKind {
+    KindColor,
+    KindDepth,
+    KindDepthStencil
+};
+
+EAttachmentKind getKind(GLenum format)
+{
+    switch (format) {
+    case GL_DEPTH_COMPONENT16:
+    case GL_DEPTH_COMPONENT24:
+    case GL_DEPTH_COMPONENT32:
+    case GL_DEPTH_COMPONENT32F:
+        return KindDepth;
+    case GL_DEPTH24_STENCIL8:
+    case GL_DEPTH32F_STENCIL8:
+        return KindDepthStencil;
+    default:
+        return KindColor;
+    }
+}
+
+// format and type glTexImage2D accepts together with the internal format
+void getPixelTransfer(GLenum internalFormat,
+                      GLenum& format,
+                      GLenum& type)
+{
+    switch (getKind(internalFormat)) {
+    case KindDepth:
+        format = GL_DEPTH_COMPONENT;
+        type = GL_FLOAT;
+        break;
+    case KindDepthStencil:
+        format = GL_DEPTH_STENCIL;
+        type = GL_UNSIGNED_INT_24_8;
+        break;
+    default:
+        format = GL_RGBA;
+        type = GL_UNSIGNED_BYTE;
+        break;
+    }
+}
+
+uint32_t getBytesPerTexel(GLenum format)
+{
+    switch (format) {
+    case GL_R8:
+        return 1;
+    case GL_RG8:
+    case GL_R16F:
+    case GL_DEPTH_COMPONENT16:
+        return 2;
+    case GL_RGBA16F:
+    case GL_RG32F:
+    case GL_DEPTH32F_STENCIL8:
+        return 8;
+    case GL_RGBA32F:
+        return 16;
+    default:
+        return 4;
+    }
+}
+
+uint64_t getBytes(const FrameGraph::TextureDesc& desc)
+{
+    return (uint64_t)desc.width * desc.height * getBytesPerTexel(desc.format);
+}
+
+} // namespace
+
+const FrameGraph::ResourceId FrameGraph::INVALID_RESOURCE;
+const FrameGraph::ResourceId FrameGraph::BACKBUFFER;
+
+bool FrameGraph::TextureDesc::operator ==(const TextureDesc& d) const
+{
+    return width == d.width
+           && height == d.height
+           && format == d.format;
+}
+
+FrameGraph::Builder::Builder(FrameGraph& graph,
+                             uint32_t pass):
+    mGraph(graph),
+    mPass(pass)
+{
+}
+
+FrameGraph::ResourceId FrameGraph::Builder::create(const char* name,
+                                                   const TextureDesc& desc)
+{
+    Resource r = { name, desc, NO_PASS, 0, NO_PASS, 0, NO_PASS };
+    mGraph.mResources.push_back(r);
+    return (ResourceId)mGraph.mResources.size() - 1;
+}
+
+void FrameGraph::Builder::read(ResourceId resource)
+{
+    Pass& pass = mGraph.mPasses[mPass];
+    if (resource == BACKBUFFER || resource >= mGraph.mResources.size()) {
+        gLog.err("pass %s: cannot read resource %u\n",
+                 pass.name.c_str(), resource);
+        mGraph.mValid = false;
+        return;
+    }
+
+    pass.reads.push_back(resource);
+}
+
+void FrameGraph::Builder::write(ResourceId resource,
+                                ELoadOp load,
+                                const Color& clearColor)
+{
+    Pass& pass = mGraph.mPasses[mPass];
+    if (resource >= mGraph.mResources.size()) {
+        gLog.err("pass %s: cannot write resource %u\n",
+                 pass.name.c_str(), resource);
+        mGraph.mValid = false;
+        return;
+    }
+
+    // the back buffer is written by any number of passes, in the order
+    // they were added; transient textures have a single producer
+    Resource& r = mGraph.mResources[resource];
+    if (resource != BACKBUFFER) {
+        if (r.producer != NO_PASS && r.producer != mPass) {
+            gLog.err("%s written by both %s and %s\n", r.name.c_str(),
+                     mGraph.mPasses[r.producer].name.c_str(),
+                     pass.name.c_str());
+            mGraph.mValid = false;
+            return;
+        }
+        r.producer = mPass;
+    }
+
+    pass.writes.push_back({ resource, load, clearColor });
+}
+
+void FrameGraph::Builder::setSideEffects()
+{
+    mGraph.mPasses[mPass].sideEffects = true;
+}
+
+FrameGraph::FrameGraph():
+    mState(NULL),
+    mBackbuffer(0),
+    mViewport(),
+    mValid(true),
+    mTransientsSupported(false),
+    mPasses(),
+    mResources(),
+    mOrder(),
+    mTextures(),
+    mFramebuffers(),
+    mStats()
+{
+    reset();
+}
+
+FrameGraph::~FrameGraph()
+{
+    for (auto& entry: mFramebuffers) {
+        glDeleteFramebuffers(1, &entry.second);
+    }
+    for (PhysicalTexture& t: mTextures) {
+        mState->deleteTexture(t.texture);
+    }
+}
+
+bool FrameGraph::init(GLState& state,
+                      GLuint backbuffer)
+{
+    mState = &state;
+    mBackbuffer = backbuffer;
+
+    mTransientsSupported = GLEW_ARB_framebuffer_object;
+    if (!mTransientsSupported) {
+        gLog.warn("framebuffer objects not available, passes can only "
+                  "render to the back buffer\n");
+    }
+    return true;
+}
+
+void FrameGraph::setBackbufferViewport(unsigned x,
+                                       unsigned y,
+                                       unsigned width,
+                                       unsigned height)
+{
+    mViewport[0] = x;
+    mViewport[1] = y;
+    mViewport[2] = width;
+    mViewport[3] = height;
+
+    mResources[BACKBUFFER].desc.width = width;
+    mResources[BACKBUFFER].desc.height = height;
+}
+
+void FrameGraph::addPass(const char* name,
+                         const SetupFunc& setup,
+                         const ExecuteFunc& execute)
+{
+    Pass pass = { name, execute, {}, {}, false, false, 0 };
+    mPasses.push_back(pass);
+
+    Builder builder(*this, (uint32_t)mPasses.size() - 1);
+    setup(builder);
+}
+
+TextureId FrameGraph::getTexture(ResourceId resource) const
+{
+    if (resource == BACKBUFFER || resource >= mResources.size()) {
+        return 0;
+    }
+
+    uint32_t physical = mResources[resource].physical;
+    return physical == NO_PASS ? 0 : mTextures[physical].texture;
+}
+
+const FrameGraph::TextureDesc& FrameGraph::getDesc(ResourceId resource) const
+{
+    return mResources[resource].desc;
+}
+
+void FrameGraph::reset()
+{
+    mPasses.clear();
+    mOrder.clear();
+    mValid = true;
+
+    Resource backbuffer = {
+        "backbuffer", { mViewport[2], mViewport[3], GL_RGBA8 },
+        NO_PASS, 0, NO_PASS, 0, NO_PASS
+    };
+    mResources.clear();
+    mResources.push_back(backbuffer);
+}
+
+void FrameGraph::discard()
+{
+    reset();
+}
+
+bool FrameGraph::execute()
+{
+    GL_DEBUG_SCOPE("FrameGraph::execute");
+
+    mStats = Stats();
+    mStats.passes = (uint32_t)mPasses.size();
+    mStats.transientTextures = (uint32_t)mResources.size() - 1;
+
+    if (!mValid || !validate()) {
+        gLog.err("frame graph invalid, skipping %u passes\n",
+                 (unsigned)mPasses.size());
+        reset();
+        return false;
+    }
+
+    cull();
+    if (!sortPasses()) {
+        reset();
+        return false;
+    }
+    computeLifetimes();
+    if (!allocateTextures()) {
+        reset();
+        return false;
+    }
+
+    for (uint32_t i = 0; i < mOrder.size(); ++i) {
+        runPass(i);
+    }
+
+    // leave the back buffer bound for whatever comes after
+    glBindFramebuffer(GL_FRAMEBUFFER, mBackbuffer);
+    mState->viewport(mViewport[0], mViewport[1], mViewport[2], mViewport[3]);
+
+    for (const Resource& r: mResources) {
+        if (r.physical != NO_PASS) {
+            mStats.transientBytes += getBytes(r.desc);
+        }
+    }
+    for (const PhysicalTexture& t: mTextures) {
+        if (t.unusedFrames == 0) {
+            ++mStats.physicalTextures;
+            mStats.physicalBytes += getBytes(t.desc);
+        }
+    }
+
+    releaseUnusedTextures();
+    reset();
+    return true;
+}
+
+bool FrameGraph::validate() const
+{
+    bool valid = true;
+
+    for (const Pass& pass: mPasses) {
+        for (ResourceId r: pass.reads) {
+            if (mResources[r].producer == NO_PASS) {
+                gLog.err("pass %s reads %s, which nobody writes\n",
+                         pass.name.c_str(), mResources[r].name.c_str());
+                valid = false;
+            }
+        }
+
+        unsigned colors = 0;
+        unsigned depths = 0;
+        bool backbuffer = false;
+        for (const Attachment& a: pass.writes) {
+            const TextureDesc& desc = mResources[a.resource].desc;
+            const TextureDesc& first = mResources[pass.writes[0].resource].desc;
+
+            if (a.resource == BACKBUFFER) {
+                backbuffer = true;
+            } else if (getKind(desc.format) == KindColor) {
+                ++colors;
+            } else {
+                ++depths;
+            }
+
+            if (desc.width != first.width || desc.height != first.height) {
+                gLog.err("pass %s: attachments differ in size\n",
+                         pass.name.c_str());
+                valid = false;
+            }
+        }
+
+        if (backbuffer && pass.writes.size() > 1) {
+            gLog.err("pass %s: back buffer cannot be combined with other "
+                     "attachments\n", pass.name.c_str());
+            valid = false;
+        }
+        if (!backbuffer && !pass.writes.empty() && !mTransientsSupported) {
+            gLog.err("pass %s: framebuffer objects not available\n",
+                     pass.name.c_str());
+            valid = false;
+        }
+        if (colors > MAX_COLOR_ATTACHMENTS || depths > 1) {
+            gLog.err("pass %s: too many attachments\n", pass.name.c_str());
+            valid = false;
+        }
+    }
+
+    return valid;
+}
+
+// passes writing only textures nobody reads are culled, which may in turn
+// leave textures they read unused
+void FrameGraph::cull()
+{
+    for (Resource& r: mResources) {
+        r.readers = 0;
+    }
+
+    std::vector<ResourceId> unused;
+    for (Pass& pass: mPasses) {
+        for (ResourceId r: pass.reads) {
+            ++mResources[r].readers;
+        }
+        for (const Attachment& a: pass.writes) {
+            if (a.resource == BACKBUFFER) {
+                pass.sideEffects = true;
+            }
+        }
+        pass.refCount = (uint32_t)pass.writes.size();
+    }
+
+    for (ResourceId r = BACKBUFFER + 1; r < mResources.size(); ++r) {
+        if (mResources[r].readers == 0) {
+            unused.push_back(r);
+        }
+    }
+    for (Pass& pass: mPasses) {
+        if (pass.writes.empty() && !pass.sideEffects) {
+            pass.culled = true;
+            for (ResourceId r: pass.reads) {
+                if (--mResources[r].readers == 0) {
+                    unused.push_back(r);
+                }
+            }
+        }
+    }
+
+    while (!unused.empty()) {
+        const Resource& r = mResources[unused.back()];
+        unused.pop_back();
+
+        if (r.producer == NO_PASS) {
+            continue;
+        }
+
+        Pass& producer = mPasses[r.producer];
+        if (producer.culled || producer.sideEffects
+                || --producer.refCount > 0) {
+            continue;
+        }
+
+        producer.culled = true;
+        for (ResourceId read: producer.reads) {
+            if (--mResources[read].readers == 0) {
+                unused.push_back(read);
+            }
+        }
+    }
+
+    for (const Pass& pass: mPasses) {
+        if (pass.culled) {
+            ++mStats.culledPasses;
+        }
+    }
+}
+
+// topological order, ties broken by the order passes were added in
+bool FrameGraph::sortPasses()
+{
+    const uint32_t count = (uint32_t)mPasses.size();
+    std::vector<uint32_t> dependencies(count, 0);
+    std::vector<std::vector<uint32_t>> dependents(count);
+    uint32_t alive = 0;
+    uint32_t lastBackbufferWriter = NO_PASS;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const Pass& pass = mPasses[i];
+        if (pass.culled) {
+            continue;
+        }
+        ++alive;
+
+        for (ResourceId r: pass.reads) {
+            uint32_t producer = mResources[r].producer;
+            if (producer != i) {
+                dependents[producer].push_back(i);
+                ++dependencies[i];
+            }
+        }
+        for (const Attachment& a: pass.writes) {
+            if (a.resource != BACKBUFFER) {
+                continue;
+            }
+            if (lastBackbufferWriter != NO_PASS) {
+                dependents[lastBackbufferWriter].push_back(i);
+                ++dependencies[i];
+            }
+            lastBackbufferWriter = i;
+        }
+    }
+
+    std::vector<bool> done(count, false);
+    mOrder.clear();
+    while (mOrder.size() < alive) {
+        uint32_t next = NO_PASS;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (!mPasses[i].culled && !done[i] && dependencies[i] == 0) {
+                next = i;
+                break;
+            }
+        }
+
+        if (next == NO_PASS) {
+            gLog.err("frame graph has a dependency cycle\n");
+            return false;
+        }
+
+        done[next] = true;
+        mOrder.push_back(next);
+        for (uint32_t dependent: dependents[next]) {
+            --dependencies[dependent];
+        }
+    }
+
+    return true;
+}
+
+void FrameGraph::computeLifetimes()
+{
+    for (uint32_t position = 0; position < mOrder.size(); ++position) {
+        const Pass& pass = mPasses[mOrder[position]];
+
+        auto use = [&](ResourceId id) {
+            Resource& r = mResources[id];
+            if (r.firstUse == NO_PASS) {
+                r.firstUse = position;
+            }
+            r.lastUse = position;
+        };
+
+        for (ResourceId r: pass.reads) {
+            use(r);
+        }
+        for (const Attachment& a: pass.writes) {
+            if (a.resource != BACKBUFFER) {
+                use(a.resource);
+            }
+        }
+    }
+}
+
+// greedy: resources in order of first use take the first pooled texture
+// of the same size and format that is free by then
+bool FrameGraph::allocateTextures()
+{
+    for (PhysicalTexture& t: mTextures) {
+        t.freeFrom = 0;
+        ++t.unusedFrames;
+    }
+
+    std::vector<ResourceId> transients;
+    for (ResourceId r = BACKBUFFER + 1; r < mResources.size(); ++r) {
+        if (mResources[r].firstUse != NO_PASS) {
+            transients.push_back(r);
+        }
+    }
+    std::stable_sort(transients.begin(), transients.end(),
+                     [this](ResourceId a, ResourceId b) {
+                         return mResources[a].firstUse
+                                < mResources[b].firstUse;
+                     });
+
+    for (ResourceId id: transients) {
+        Resource& r = mResources[id];
+
+        uint32_t physical = 0;
+        for (; physical < mTextures.size(); ++physical) {
+            const PhysicalTexture& t = mTextures[physical];
+            if (t.desc == r.desc && t.freeFrom <= r.firstUse) {
+                break;
+            }
+        }
+
+        if (physical == mTextures.size()) {
+            TextureId texture = 0;
+            GL_CHECK_RET(glGenTextures(1, &texture), false);
+
+            GLenum format;
+            GLenum type;
+            getPixelTransfer(r.desc.format, format, type);
+
+            mState->activeTexture(0);
+            mState->bindTexture(0, GL_TEXTURE_2D, texture);
+            GL_CHECK(glTexImage2D(GL_TEXTURE_2D, 0, r.desc.format,
+                                  r.desc.width, r.desc.height, 0,
+                                  format, type, NULL));
+            GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                                     GL_LINEAR));
+            GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+                                     GL_LINEAR));
+            GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+                                     GL_CLAMP_TO_EDGE));
+            GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+                                     GL_CLAMP_TO_EDGE));
+            GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                                     0));
+
+            mTextures.push_back({ texture, r.desc, 0, 0 });
+        }
+
+        PhysicalTexture& t = mTextures[physical];
+        t.freeFrom = r.lastUse + 1;
+        t.unusedFrames = 0;
+        r.physical = physical;
+    }
+
+    return true;
+}
+
+void FrameGraph::releaseUnusedTextures()
+{
+    for (size_t i = 0; i < mTextures.size();) {
+        if (mTextures[i].unusedFrames <= MAX_UNUSED_FRAMES) {
+            ++i;
+            continue;
+        }
+
+        TextureId texture = mTextures[i].texture;
+        for (auto it = mFramebuffers.begin(); it != mFramebuffers.end();) {
+            const FramebufferKey& key = it->first;
+            if (std::find(key.begin(), key.end(), texture) != key.end()) {
+                glDeleteFramebuffers(1, &it->second);
+                it = mFramebuffers.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        mState->deleteTexture(texture);
+        mTextures[i] = mTextures.back();
+        mTextures.pop_back();
+    }
+}
+
+GLuint FrameGraph::getFramebuffer(const Pass& pass)
+{
+    FramebufferKey key;
+    key.fill(0);
+
+    unsigned colors = 0;
+    for (const Attachment& a: pass.writes) {
+        if (a.resource == BACKBUFFER) {
+            return mBackbuffer;
+        }
+
+        TextureId texture = getTexture(a.resource);
+        if (getKind(mResources[a.resource].desc.format) == KindColor) {
+            key[colors++] = texture;
+        } else {
+            key[MAX_COLOR_ATTACHMENTS] = texture;
+        }
+    }
+
+    auto it = mFramebuffers.find(key);
+    if (it != mFramebuffers.end()) {
+        return it->second;
+    }
+
+    GLuint framebuffer = 0;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+    GLenum drawBuffers[MAX_COLOR_ATTACHMENTS];
+    for (unsigned i = 0; i < colors; ++i) {
+        drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i,
+                               GL_TEXTURE_2D, key[i], 0);
+    }
+
+    TextureId depth = key[MAX_COLOR_ATTACHMENTS];
+    for (const Attachment& a: pass.writes) {
+        EAttachmentKind kind = getKind(mResources[a.resource].desc.format);
+        if (kind != KindColor) {
+            glFramebufferTexture2D(GL_FRAMEBUFFER,
+                                   kind == KindDepth
+                                       ? GL_DEPTH_ATTACHMENT
+                                       : GL_DEPTH_STENCIL_ATTACHMENT,
+                                   GL_TEXTURE_2D, depth, 0);
+        }
+    }
+
+    if (colors > 0) {
+        glDrawBuffers(colors, drawBuffers);
+    } else {
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        gLog.err("pass %s: framebuffer incomplete: 0x%x\n",
+                 pass.name.c_str(), status);
+    }
+
+    mFramebuffers[key] = framebuffer;
+    return framebuffer;
+}
+
+// deadBefore: contents the pass does not care about (LoadDontCare),
+// otherwise: attachments no later pass uses
+void FrameGraph::invalidate(const Pass& pass,
+                            uint32_t position,
+                            bool deadBefore)
+{
+    if (!GLEW_ARB_invalidate_subdata) {
+        return;
+    }
+
+    GLenum attachments[MAX_COLOR_ATTACHMENTS + 2];
+    GLsizei count = 0;
+    unsigned colors = 0;
+
+    for (const Attachment& a: pass.writes) {
+        if (a.resource == BACKBUFFER) {
+            // the back buffer is presented, only discard it on request
+            if (deadBefore && a.load == LoadDontCare) {
+                bool window = (mBackbuffer == 0);
+                attachments[count++] = window ? GL_COLOR
+                                              : GL_COLOR_ATTACHMENT0;
+                attachments[count++] = window ? GL_DEPTH
+                                              : GL_DEPTH_STENCIL_ATTACHMENT;
+            }
+            continue;
+        }
+
+        EAttachmentKind kind = getKind(mResources[a.resource].desc.format);
+        bool dead = deadBefore ? a.load == LoadDontCare
+                               : mResources[a.resource].lastUse == position;
+
+        if (kind == KindColor) {
+            if (dead) {
+                attachments[count++] = GL_COLOR_ATTACHMENT0 + colors;
+            }
+            ++colors;
+        } else if (dead) {
+            attachments[count++] = kind == KindDepth
+                                   ? GL_DEPTH_ATTACHMENT
+                                   : GL_DEPTH_STENCIL_ATTACHMENT;
+        }
+    }
+
+    if (count > 0) {
+        glInvalidateFramebuffer(GL_FRAMEBUFFER, count, attachments);
+    }
+}
+
+void FrameGraph::runPass(uint32_t position)
+{
+    const Pass& pass = mPasses[mOrder[position]];
+    GL_DEBUG_SCOPE(pass.name.c_str());
+
+    if (!pass.writes.empty()) {
+        glBindFramebuffer(GL_FRAMEBUFFER, getFramebuffer(pass));
+
+        if (pass.writes[0].resource == BACKBUFFER) {
+            mState->viewport(mViewport[0], mViewport[1],
+                             mViewport[2], mViewport[3]);
+        } else {
+            const TextureDesc& desc = mResources[pass.writes[0].resource].desc;
+            mState->viewport(0, 0, desc.width, desc.height);
+        }
+
+        invalidate(pass, position, true);
+
+        unsigned colors = 0;
+        for (const Attachment& a: pass.writes) {
+            bool backbuffer = (a.resource == BACKBUFFER);
+            EAttachmentKind kind = backbuffer
+                                   ? KindColor
+                                   : getKind(mResources[a.resource].desc.format);
+
+            if (a.load == LoadClear) {
+                const float color[] = {
+                    a.clearColor.r, a.clearColor.g,
+                    a.clearColor.b, a.clearColor.a
+                };
+                const float depth = 1.f;
+
+                // clears honor the depth mask
+                if (backbuffer || kind != KindColor) {
+                    mState->depthMask(true);
+                }
+
+                if (kind == KindColor) {
+                    glClearBufferfv(GL_COLOR, colors, color);
+                }
+                if (backbuffer || kind == KindDepthStencil) {
+                    glClearBufferfi(GL_DEPTH_STENCIL, 0, depth, 0);
+                } else if (kind == KindDepth) {
+                    glClearBufferfv(GL_DEPTH, 0, &depth);
+                }
+            }
+
+            if (kind == KindColor) {
+                ++colors;
+            }
+        }
+    }
+
+    pass.execute(*this);
+
+    if (!pass.writes.empty()) {
+        invalidate(pass, position, false);
+    }
+
+    // textures sampled here for the last time
+    if (GLEW_ARB_invalidate_subdata) {
+        for (ResourceId r: pass.reads) {
+            if (mResources[r].lastUse == position) {
+                glInvalidateTexImage(getTexture(r), 0);
+            }
+        }
+    }
+}
+
+} // namespace sb
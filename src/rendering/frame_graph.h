@@ -0,0 +1,202 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "rendering/color.h"
+#include "rendering/types.h"
+
+namespace sb {
+
+class GLState;
+
+// Declarative description of the passes of a frame. Each pass declares the
+// textures it samples (read) and the attachments it renders to (write);
+// execute() then:
+// - culls passes whose outputs are never consumed,
+// - orders the remaining ones so that producers run before consumers,
+// - assigns GL storage to transient textures, sharing it between textures
+//   with equal size and format whose lifetimes do not overlap,
+// - clears attachments and invalidates their contents once they are dead.
+//
+// Passes are declared anew every frame; transient textures and their
+// framebuffers are pooled across frames.
+class FrameGraph
+{
+public:
+    typedef uint32_t ResourceId;
+    static const ResourceId INVALID_RESOURCE = (ResourceId)-1;
+    // the framebuffer that plays the role of the window back buffer; can
+    // only be written, never read, and not together with other attachments
+    static const ResourceId BACKBUFFER = 0;
+
+    static const unsigned MAX_COLOR_ATTACHMENTS = 4;
+    // pooled textures unused for that many frames are deleted
+    static const unsigned MAX_UNUSED_FRAMES = 8;
+
+    enum ELoadOp {
+        LoadKeep,       // previous contents are preserved
+        LoadClear,      // cleared before the pass runs
+        LoadDontCare    // previous contents are discarded
+    };
+
+    struct TextureDesc
+    {
+        unsigned width;
+        unsigned height;
+        GLenum format;      // sized internal format, e.g. GL_RGBA8
+
+        bool operator ==(const TextureDesc& d) const;
+    };
+
+    struct Stats
+    {
+        uint32_t passes;            // declared
+        uint32_t culledPasses;
+        uint32_t transientTextures; // declared
+        uint32_t physicalTextures;  // used this frame
+        uint64_t transientBytes;    // without aliasing
+        uint64_t physicalBytes;     // with aliasing
+    };
+
+    class Builder
+    {
+    public:
+        ResourceId create(const char* name,
+                          const TextureDesc& desc);
+        // sampled as a texture during the pass
+        void read(ResourceId resource);
+        // rendered to; clearColor is used for color attachments only, depth
+        // is cleared to 1 and stencil to 0
+        void write(ResourceId resource,
+                   ELoadOp load = LoadKeep,
+                   const Color& clearColor = Color::Black);
+        // pass is never culled, even if nothing uses its outputs
+        void setSideEffects();
+
+    private:
+        friend class FrameGraph;
+
+        FrameGraph& mGraph;
+        uint32_t mPass;
+
+        Builder(FrameGraph& graph,
+                uint32_t pass);
+    };
+
+    typedef std::function<void(Builder&)> SetupFunc;
+    // graph is passed to look up textures with getTexture()
+    typedef std::function<void(const FrameGraph&)> ExecuteFunc;
+
+    FrameGraph();
+    ~FrameGraph();
+
+    FrameGraph(const FrameGraph&) = delete;
+    FrameGraph(FrameGraph&&) = delete;
+    FrameGraph& operator =(const FrameGraph&) = delete;
+    FrameGraph& operator =(FrameGraph&&) = delete;
+
+    // requires a current GL context; state must outlive the graph
+    bool init(GLState& state,
+              GLuint backbuffer);
+    void setBackbufferViewport(unsigned x,
+                               unsigned y,
+                               unsigned width,
+                               unsigned height);
+
+    // setup runs immediately, execute during execute()
+    void addPass(const char* name,
+                 const SetupFunc& setup,
+                 const ExecuteFunc& execute);
+    // runs all passes declared since the last call and forgets them;
+    // returns false without running anything if the declarations are
+    // inconsistent (cycles, reads of textures nobody writes, ...)
+    bool execute();
+    // forgets passes declared since the last execute() without running them
+    void discard();
+    // passes declared since the last execute()
+    size_t getNumPasses() const { return mPasses.size(); }
+
+    // valid only while passes are executed
+    TextureId getTexture(ResourceId resource) const;
+    const TextureDesc& getDesc(ResourceId resource) const;
+
+    // statistics of the last executed frame
+    const Stats& getStats() const { return mStats; }
+
+private:
+    static const uint32_t NO_PASS = (uint32_t)-1;
+
+    struct Resource
+    {
+        std::string name;
+        TextureDesc desc;
+        uint32_t producer;
+        uint32_t readers;       // by passes that were not culled
+        uint32_t firstUse;      // positions in execution order
+        uint32_t lastUse;
+        uint32_t physical;      // index in mTextures
+    };
+
+    struct Attachment
+    {
+        ResourceId resource;
+        ELoadOp load;
+        Color clearColor;
+    };
+
+    struct Pass
+    {
+        std::string name;
+        ExecuteFunc execute;
+        std::vector<ResourceId> reads;
+        std::vector<Attachment> writes;
+        bool sideEffects;
+        bool culled;
+        uint32_t refCount;
+    };
+
+    struct PhysicalTexture
+    {
+        TextureId texture;
+        TextureDesc desc;
+        uint32_t freeFrom;      // execution position it can be reused at
+        unsigned unusedFrames;
+    };
+
+    // color attachments followed by the depth one
+    typedef std::array<TextureId, MAX_COLOR_ATTACHMENTS + 1> FramebufferKey;
+
+    GLState* mState;
+    GLuint mBackbuffer;
+    unsigned mViewport[4];
+    bool mValid;
+    bool mTransientsSupported;
+
+    std::vector<Pass> mPasses;
+    std::vector<Resource> mResources;
+    std::vector<uint32_t> mOrder;
+    std::vector<PhysicalTexture> mTextures;
+    std::map<FramebufferKey, GLuint> mFramebuffers;
+
+    Stats mStats;
+
+    void reset();
+    bool validate() const;
+    void cull();
+    bool sortPasses();
+    void computeLifetimes();
+    bool allocateTextures();
+    void releaseUnusedTextures();
+    void runPass(uint32_t position);
+    GLuint getFramebuffer(const Pass& pass);
+    void invalidate(const Pass& pass,
+                    uint32_t position,
+                    bool deadBefore);
+};
+
+} // namespace sb
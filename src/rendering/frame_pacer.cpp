@@ -0,0 +1,175 @@
+#include "rendering/frame_pacer.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace sb {
+namespace {
+
+// sleeping is only accurate to about a scheduler tick, the rest of the
+// wait is spent yielding
+const std::chrono::microseconds SPIN_THRESHOLD(1000);
+
+double toMilliseconds(std::chrono::steady_clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+} // namespace
+
+const unsigned FramePacer::MAX_FRAMES_IN_FLIGHT;
+const unsigned FramePacer::HISTORY_SIZE;
+
+void FramePacer::History::add(double sample)
+{
+    samples[next] = sample;
+    next = (next + 1) % HISTORY_SIZE;
+    numSamples = std::min(numSamples + 1, HISTORY_SIZE);
+}
+
+FramePacer::Timing FramePacer::History::makeTiming() const
+{
+    Timing timing = { numSamples, 0.0, 0.0, 0.0, 0.0 };
+    if (numSamples == 0) {
+        return timing;
+    }
+
+    timing.lastMs = samples[(next + HISTORY_SIZE - 1) % HISTORY_SIZE];
+    timing.minMs = timing.maxMs = timing.lastMs;
+
+    double sum = 0.0;
+    for (unsigned i = 0; i < numSamples; ++i) {
+        timing.minMs = std::min(timing.minMs, samples[i]);
+        timing.maxMs = std::max(timing.maxMs, samples[i]);
+        sum += samples[i];
+    }
+    timing.avgMs = sum / numSamples;
+
+    return timing;
+}
+
+FramePacer::FramePacer():
+    mMaxFramesInFlight(2),
+    mTargetFrameTime(0.0),
+    mFrames(0),
+    mInFlight(),
+    mLastFrameEnd(Clock::now()),
+    mNextDeadline(mLastFrameEnd),
+    mFrameTime(),
+    mLatency(),
+    mFenceWait(),
+    mSleep()
+{
+}
+
+FramePacer::~FramePacer()
+{
+    for (const InFlight& frame: mInFlight) {
+        glDeleteSync(frame.fence);
+    }
+}
+
+void FramePacer::setMaxFramesInFlight(unsigned count)
+{
+    mMaxFramesInFlight = std::max(1u, std::min(count, MAX_FRAMES_IN_FLIGHT));
+}
+
+void FramePacer::setTargetFrameTime(double milliseconds)
+{
+    mTargetFrameTime = std::max(0.0, milliseconds);
+    mNextDeadline = Clock::now();
+}
+
+bool FramePacer::retireOldest(bool wait)
+{
+    const InFlight& oldest = mInFlight.front();
+
+    GLenum result = glClientWaitSync(oldest.fence,
+                                     wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                     wait ? GL_TIMEOUT_IGNORED : 0);
+    if (result == GL_TIMEOUT_EXPIRED) {
+        return false;
+    }
+
+    // on GL_WAIT_FAILED the frame is dropped from the queue as well, so
+    // that a lost fence cannot block forever
+    mLatency.add(toMilliseconds(Clock::now() - oldest.submitted));
+    glDeleteSync(oldest.fence);
+    mInFlight.pop_front();
+    return true;
+}
+
+void FramePacer::endFrame()
+{
+    ++mFrames;
+
+    if (GLEW_ARB_sync) {
+        InFlight frame = {
+            glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0),
+            Clock::now()
+        };
+        mInFlight.push_back(frame);
+
+        // collect finished frames without waiting, for latency stats
+        while (mInFlight.size() > 1 && retireOldest(false)) {
+        }
+
+        Clock::time_point waitStart = Clock::now();
+        while (mInFlight.size() > mMaxFramesInFlight) {
+            retireOldest(true);
+        }
+        mFenceWait.add(toMilliseconds(Clock::now() - waitStart));
+    }
+
+    if (mTargetFrameTime > 0.0) {
+        Clock::duration target = std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double, std::milli>(mTargetFrameTime));
+        Clock::time_point sleepStart = Clock::now();
+
+        // after a long frame start over instead of rushing to catch up
+        mNextDeadline += target;
+        if (mNextDeadline + target < sleepStart) {
+            mNextDeadline = sleepStart;
+        }
+
+        sleepUntil(mNextDeadline);
+        mSleep.add(toMilliseconds(Clock::now() - sleepStart));
+    }
+
+    Clock::time_point now = Clock::now();
+    mFrameTime.add(toMilliseconds(now - mLastFrameEnd));
+    mLastFrameEnd = now;
+}
+
+void FramePacer::skipFrame()
+{
+    // the next frame starts now, both for frame time and for pacing
+    mLastFrameEnd = Clock::now();
+    mNextDeadline = mLastFrameEnd;
+}
+
+void FramePacer::sleepUntil(Clock::time_point deadline)
+{
+    Clock::time_point now = Clock::now();
+    if (deadline - now > SPIN_THRESHOLD) {
+        std::this_thread::sleep_until(deadline - SPIN_THRESHOLD);
+    }
+
+    while (Clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+}
+
+FramePacer::Stats FramePacer::getStats() const
+{
+    Stats stats = {
+        mFrames,
+        mFrameTime.makeTiming(),
+        mLatency.makeTiming(),
+        mFenceWait.makeTiming(),
+        mSleep.makeTiming()
+    };
+    return stats;
+}
+
+} // namespace sb
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+
+#include "rendering/types.h"
+
+namespace sb {
+
+// Limits how many frames the CPU may queue ahead of the GPU, using a fence
+// per presented frame, and optionally sleeps so that frames start at a
+// fixed rate. Also keeps frame time and latency statistics.
+//
+// Latency is measured from endFrame() to the moment the frame's fence is
+// seen signaled, so it is an upper bound with the resolution of a frame
+// unless the pacer had to wait for it.
+class FramePacer
+{
+public:
+    static const unsigned MAX_FRAMES_IN_FLIGHT = 3;
+    static const unsigned HISTORY_SIZE = 128;
+
+    struct Timing
+    {
+        unsigned samples;   // within the rolling window
+        double lastMs;
+        double minMs;
+        double avgMs;
+        double maxMs;
+    };
+
+    struct Stats
+    {
+        uint64_t frames;
+        Timing frameTime;   // between consecutive endFrame() returns
+        Timing latency;     // submission to GPU completion
+        Timing fenceWait;   // blocked on the frames-in-flight limit
+        Timing sleep;       // spent reaching the target frame time
+    };
+
+    FramePacer();
+    ~FramePacer();
+
+    FramePacer(const FramePacer&) = delete;
+    FramePacer(FramePacer&&) = delete;
+    FramePacer& operator =(const FramePacer&) = delete;
+    FramePacer& operator =(FramePacer&&) = delete;
+
+    // clamped to 1..MAX_FRAMES_IN_FLIGHT
+    void setMaxFramesInFlight(unsigned count);
+    unsigned getMaxFramesInFlight() const { return mMaxFramesInFlight; }
+    // 0 disables pacing
+    void setTargetFrameTime(double milliseconds);
+    double getTargetFrameTime() const { return mTargetFrameTime; }
+
+    // call right after the frame was presented
+    void endFrame();
+    // call instead of endFrame() when nothing was presented; the time spent
+    // until the next presented frame is not counted as frame time
+    void skipFrame();
+
+    // min/avg/max over the last HISTORY_SIZE frames
+    Stats getStats() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct InFlight
+    {
+        GLsync fence;
+        Clock::time_point submitted;
+    };
+
+    struct History
+    {
+        double samples[HISTORY_SIZE];
+        unsigned numSamples;
+        unsigned next;
+
+        void add(double sample);
+        Timing makeTiming() const;
+    };
+
+    unsigned mMaxFramesInFlight;
+    double mTargetFrameTime;
+    uint64_t mFrames;
+
+    std::deque<InFlight> mInFlight;
+    Clock::time_point mLastFrameEnd;
+    Clock::time_point mNextDeadline;
+
+    History mFrameTime;
+    History mLatency;
+    History mFenceWait;
+    History mSleep;
+
+    // returns false if the oldest frame is not finished yet and wait is not
+    // set
+    bool retireOldest(bool wait);
+    void sleepUntil(Clock::time_point deadline);
+};
+
+} // namespace sb
@@ -0,0 +1,183 @@
+#include "rendering/frame_uniforms.h"
+
+#include <cstring>
+
+#include "rendering/camera.h"
+#include "rendering/gl_state.h"
+#include "rendering/stream_buffer.h"
+#include "utils/gl.h"
+#include "utils/logger.h"
+
+namespace sb {
+
+static_assert(sizeof(FrameUniforms::Block) == 7 * 64 + 3 * 16,
+              "FrameUniforms::Block does not match std140 layout");
+
+const char* const FrameUniforms::BLOCK_NAME = "FrameUniforms";
+
+FrameUniforms::FrameUniforms():
+    mState(NULL),
+    mStream(NULL),
+    mEnabled(false),
+    mOffsetAlignment(0),
+    mFallbackBuffer(0),
+    mBlock(),
+    mStartTime(std::chrono::steady_clock::now()),
+    mLastUpdate(mStartTime),
+    mFrame(0)
+{
+}
+
+FrameUniforms::~FrameUniforms()
+{
+    if (mFallbackBuffer) {
+        mState->deleteBuffer(mFallbackBuffer);
+    }
+}
+
+bool FrameUniforms::init(GLState& state,
+                         StreamBuffer& stream)
+{
+    mState = &state;
+    mStream = &stream;
+
+    mEnabled = GLEW_ARB_uniform_buffer_object;
+    if (!mEnabled) {
+        gLog.warn("uniform buffers not available, frame uniforms "
+                  "disabled\n");
+        return false;
+    }
+
+    GL_CHECK(glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT,
+                           &mOffsetAlignment));
+    GL_CHECK_RET(glGenBuffers(1, &mFallbackBuffer), false);
+
+    mState->bindBuffer(GL_UNIFORM_BUFFER, mFallbackBuffer);
+    GL_CHECK(glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), NULL,
+                          GL_STREAM_DRAW));
+    return true;
+}
+
+void FrameUniforms::setViewport(unsigned x,
+                                unsigned y,
+                                unsigned width,
+                                unsigned height)
+{
+    mBlock.viewport[0] = (float)x;
+    mBlock.viewport[1] = (float)y;
+    mBlock.viewport[2] = (float)width;
+    mBlock.viewport[3] = (float)height;
+}
+
+void FrameUniforms::update(Camera& camera)
+{
+    if (!mEnabled) {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::duration<float> sinceStart = now - mStartTime;
+    std::chrono::duration<float> delta = now - mLastUpdate;
+    mLastUpdate = now;
+
+    mBlock.view = camera.getViewMatrix();
+    mBlock.projection = camera.getPerspectiveProjectionMatrix();
+    mBlock.viewProjection = mBlock.projection * mBlock.view;
+    mBlock.invView = glm::inverse(mBlock.view);
+    mBlock.invProjection = glm::inverse(mBlock.projection);
+    mBlock.invViewProjection = glm::inverse(mBlock.viewProjection);
+    mBlock.orthographicProjection = camera.getOrthographicProjectionMatrix();
+
+    const Vec3& eye = camera.getEye();
+    mBlock.eyePosition[0] = eye.x;
+    mBlock.eyePosition[1] = eye.y;
+    mBlock.eyePosition[2] = eye.z;
+    mBlock.eyePosition[3] = 1.f;
+
+    mBlock.time[0] = sinceStart.count();
+    mBlock.time[1] = delta.count();
+    mBlock.time[2] = (float)mFrame++;
+    mBlock.time[3] = 0.f;
+
+    StreamBuffer::Allocation alloc = mStream->allocate(sizeof(Block),
+                                                       mOffsetAlignment);
+    if (alloc.isValid()) {
+        memcpy(alloc.ptr, &mBlock, sizeof(Block));
+        mStream->flush();
+        mState->bindBufferRange(GL_UNIFORM_BUFFER, UniformBindingFrame,
+                                mStream->getId(), alloc.offset,
+                                sizeof(Block));
+        return;
+    }
+
+    // stream buffer full, orphan the fallback buffer instead
+    mState->bindBuffer(GL_UNIFORM_BUFFER, mFallbackBuffer);
+    if (GL_CHECK(glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), NULL,
+                              GL_STREAM_DRAW))) {
+        gLog.err("cannot orphan frame uniform buffer\n");
+        return;
+    }
+    if (GL_CHECK(glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block),
+                                 &mBlock))) {
+        gLog.err("cannot upload frame uniforms\n");
+        return;
+    }
+    mState->bindBufferRange(GL_UNIFORM_BUFFER, UniformBindingFrame,
+                            mFallbackBuffer, 0, sizeof(Block));
+}
+
+bool FrameUniforms::isUsedBy(ProgramId program)
+{
+    return GLEW_ARB_uniform_buffer_object
+           && glGetUniformBlockIndex(program, BLOCK_NAME) != GL_INVALID_INDEX;
+}
+
+bool FrameUniforms::bindProgram(ProgramId program)
+{
+    if (!isUsedBy(program)) {
+        return false;
+    }
+
+    glUniformBlockBinding(program,
+                          glGetUniformBlockIndex(program, BLOCK_NAME),
+                          UniformBindingFrame);
+    return true;
+}
+
+const char* const MatrixLocations::UNIFORM_NAME = "matViewProjection";
+
+MatrixLocations::MatrixLocations():
+    mLocations(),
+    mProgramGeneration(0)
+{
+}
+
+MatrixLocations::~MatrixLocations()
+{
+}
+
+GLint MatrixLocations::get(const GLState& state,
+                           ProgramId program)
+{
+    if (mProgramGeneration != state.getProgramGeneration()) {
+        mLocations.clear();
+        mProgramGeneration = state.getProgramGeneration();
+    }
+
+    auto it = mLocations.find(program);
+    if (it != mLocations.end()) {
+        return it->second;
+    }
+
+    // programs using the frame uniform block do not need it
+    GLint location = glGetUniformLocation(program, UNIFORM_NAME);
+    if (location < 0 && !FrameUniforms::isUsedBy(program)) {
+        gLog.warn("program %u has neither %s uniform nor %s block\n",
+                  program, UNIFORM_NAME, FrameUniforms::BLOCK_NAME);
+    }
+
+    mLocations[program] = location;
+    return location;
+}
+
+} // namespace sb
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+
+#include "rendering/types.h"
+#include "utils/types.h"
+
+namespace sb {
+
+class Camera;
+class GLState;
+class StreamBuffer;
+
+// Uniform block shared by all programs, written once per frame and bound
+// at UniformBindingFrame. Shaders declare it as:
+//
+//   layout(std140) uniform FrameUniforms {
+//       mat4 view;
+//       mat4 projection;
+//       mat4 viewProjection;
+//       mat4 invView;
+//       mat4 invProjection;
+//       mat4 invViewProjection;
+//       mat4 orthographicProjection;
+//       vec4 eyePosition;   // w = 1
+//       vec4 viewport;      // x, y, width, height
+//       vec4 time;          // seconds since start, frame delta, frame number
+//   };
+class FrameUniforms
+{
+public:
+    static const char* const BLOCK_NAME;
+
+    // std140 layout of the block above
+    struct Block
+    {
+        Mat44 view;
+        Mat44 projection;
+        Mat44 viewProjection;
+        Mat44 invView;
+        Mat44 invProjection;
+        Mat44 invViewProjection;
+        Mat44 orthographicProjection;
+        float eyePosition[4];
+        float viewport[4];
+        float time[4];
+    };
+
+    FrameUniforms();
+    ~FrameUniforms();
+
+    FrameUniforms(const FrameUniforms&) = delete;
+    FrameUniforms(FrameUniforms&&) = delete;
+    FrameUniforms& operator =(const FrameUniforms&) = delete;
+    FrameUniforms& operator =(FrameUniforms&&) = delete;
+
+    // requires a current GL context; returns false if uniform buffers are
+    // not supported, programs then have to rely on plain uniforms
+    bool init(GLState& state,
+              StreamBuffer& stream);
+    bool isEnabled() const { return mEnabled; }
+
+    void setViewport(unsigned x,
+                     unsigned y,
+                     unsigned width,
+                     unsigned height);
+
+    // uploads the block and binds it; call once per frame before drawing
+    void update(Camera& camera);
+
+    const Block& getBlock() const { return mBlock; }
+
+    static bool isUsedBy(ProgramId program);
+    // connects the program's FrameUniforms block, if any, to the binding
+    // point; returns false if the program does not use the block
+    static bool bindProgram(ProgramId program);
+
+private:
+    GLState* mState;
+    StreamBuffer* mStream;
+    bool mEnabled;
+    GLint mOffsetAlignment;
+    BufferId mFallbackBuffer;
+
+    Block mBlock;
+    std::chrono::steady_clock::time_point mStartTime;
+    std::chrono::steady_clock::time_point mLastUpdate;
+    uint32_t mFrame;
+};
+
+// Locations of the view-projection matrix uniform the batchers set for
+// programs that do not use the FrameUniforms block, looked up once per
+// program
+class MatrixLocations
+{
+public:
+    static const char* const UNIFORM_NAME;
+
+    MatrixLocations();
+    ~MatrixLocations();
+
+    MatrixLocations(const MatrixLocations&) = delete;
+    MatrixLocations(MatrixLocations&&) = delete;
+    MatrixLocations& operator =(const MatrixLocations&) = delete;
+    MatrixLocations& operator =(MatrixLocations&&) = delete;
+
+    // -1 if the program has no such uniform; warns if it uses neither the
+    // uniform nor the block. Forgets all locations once state reports a
+    // deleted program, whose name may have been reused.
+    GLint get(const GLState& state,
+              ProgramId program);
+
+private:
+    std::unordered_map<ProgramId, GLint> mLocations;
+    uint64_t mProgramGeneration;
+};
+
+} // namespace sb
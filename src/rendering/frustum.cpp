@@ -0,0 +1,283 @@
+#include "rendering/frustum.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+namespace sb {
+namespace {
+
+float planeDistance(const float* plane,
+                    float x,
+                    float y,
+                    float z)
+{
+    return plane[0] * x + plane[1] * y + plane[2] * z + plane[3];
+}
+
+// signed distance of the box corner furthest along the plane normal
+float aabbDistance(const float* plane,
+                   float cx, float cy, float cz,
+                   float ex, float ey, float ez)
+{
+    return planeDistance(plane, cx, cy, cz)
+           + std::fabs(plane[0]) * ex
+           + std::fabs(plane[1]) * ey
+           + std::fabs(plane[2]) * ez;
+}
+
+void setBit(uint32_t* mask,
+            size_t i)
+{
+    mask[i / 32] |= 1u << (i % 32);
+}
+
+#if defined(__AVX__)
+
+struct Simd
+{
+    typedef __m256 Reg;
+    static const size_t WIDTH = 8;
+
+    static Reg load(const float* p) { return _mm256_loadu_ps(p); }
+    static Reg set(float v) { return _mm256_set1_ps(v); }
+    static Reg add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+    static Reg mul(Reg a, Reg b) { return _mm256_mul_ps(a, b); }
+    static Reg ge(Reg a, Reg b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static Reg both(Reg a, Reg b) { return _mm256_and_ps(a, b); }
+    static Reg allSet() { return ge(set(0.f), set(0.f)); }
+    static uint32_t bits(Reg a) { return (uint32_t)_mm256_movemask_ps(a); }
+};
+
+#elif defined(__SSE2__)
+
+struct Simd
+{
+    typedef __m128 Reg;
+    static const size_t WIDTH = 4;
+
+    static Reg load(const float* p) { return _mm_loadu_ps(p); }
+    static Reg set(float v) { return _mm_set1_ps(v); }
+    static Reg add(Reg a, Reg b) { return _mm_add_ps(a, b); }
+    static Reg mul(Reg a, Reg b) { return _mm_mul_ps(a, b); }
+    static Reg ge(Reg a, Reg b) { return _mm_cmpge_ps(a, b); }
+    static Reg both(Reg a, Reg b) { return _mm_and_ps(a, b); }
+    static Reg allSet() { return ge(set(0.f), set(0.f)); }
+    static uint32_t bits(Reg a) { return (uint32_t)_mm_movemask_ps(a); }
+};
+
+#endif
+
+#if defined(__AVX__) || defined(__SSE2__)
+
+// returns number of objects processed, the rest is left for scalar code
+size_t cullSpheresSimd(const Frustum& frustum,
+                       const float* cx,
+                       const float* cy,
+                       const float* cz,
+                       const float* radius,
+                       size_t count,
+                       uint32_t* visible)
+{
+    typedef Simd::Reg Reg;
+
+    Reg planes[Frustum::PlaneCount][4];
+    for (size_t p = 0; p < Frustum::PlaneCount; ++p) {
+        for (size_t c = 0; c < 4; ++c) {
+            planes[p][c] = Simd::set(frustum.planes[p][c]);
+        }
+    }
+
+    const Reg zero = Simd::set(0.f);
+
+    size_t i = 0;
+    for (; i + Simd::WIDTH <= count; i += Simd::WIDTH) {
+        Reg x = Simd::load(cx + i);
+        Reg y = Simd::load(cy + i);
+        Reg z = Simd::load(cz + i);
+        Reg r = Simd::load(radius + i);
+        Reg inside = Simd::allSet();
+
+        for (size_t p = 0; p < Frustum::PlaneCount; ++p) {
+            Reg dist = Simd::add(Simd::add(Simd::mul(planes[p][0], x),
+                                           Simd::mul(planes[p][1], y)),
+                                 Simd::add(Simd::mul(planes[p][2], z),
+                                           planes[p][3]));
+            inside = Simd::both(inside, Simd::ge(Simd::add(dist, r), zero));
+        }
+
+        // WIDTH divides 32, so a group never straddles two words
+        visible[i / 32] |= Simd::bits(inside) << (i % 32);
+    }
+
+    return i;
+}
+
+size_t cullAABBsSimd(const Frustum& frustum,
+                     const float* cx,
+                     const float* cy,
+                     const float* cz,
+                     const float* ex,
+                     const float* ey,
+                     const float* ez,
+                     size_t count,
+                     uint32_t* visible)
+{
+    typedef Simd::Reg Reg;
+
+    Reg planes[Frustum::PlaneCount][4];
+    Reg absNormals[Frustum::PlaneCount][3];
+    for (size_t p = 0; p < Frustum::PlaneCount; ++p) {
+        for (size_t c = 0; c < 4; ++c) {
+            planes[p][c] = Simd::set(frustum.planes[p][c]);
+        }
+        for (size_t c = 0; c < 3; ++c) {
+            absNormals[p][c] = Simd::set(std::fabs(frustum.planes[p][c]));
+        }
+    }
+
+    const Reg zero = Simd::set(0.f);
+
+    size_t i = 0;
+    for (; i + Simd::WIDTH <= count; i += Simd::WIDTH) {
+        Reg x = Simd::load(cx + i);
+        Reg y = Simd::load(cy + i);
+        Reg z = Simd::load(cz + i);
+        Reg hx = Simd::load(ex + i);
+        Reg hy = Simd::load(ey + i);
+        Reg hz = Simd::load(ez + i);
+        Reg inside = Simd::allSet();
+
+        for (size_t p = 0; p < Frustum::PlaneCount; ++p) {
+            Reg dist = Simd::add(Simd::add(Simd::mul(planes[p][0], x),
+                                           Simd::mul(planes[p][1], y)),
+                                 Simd::add(Simd::mul(planes[p][2], z),
+                                           planes[p][3]));
+            Reg reach = Simd::add(Simd::add(Simd::mul(absNormals[p][0], hx),
+                                            Simd::mul(absNormals[p][1], hy)),
+                                  Simd::mul(absNormals[p][2], hz));
+            inside = Simd::both(inside,
+                                Simd::ge(Simd::add(dist, reach), zero));
+        }
+
+        visible[i / 32] |= Simd::bits(inside) << (i % 32);
+    }
+
+    return i;
+}
+
+#endif
+
+} // namespace
+
+Frustum Frustum::fromMatrix(const Mat44& m)
+{
+    // Gribb & Hartmann; glm matrices are column-major, m[col][row]
+    Frustum f;
+    for (int i = 0; i < 4; ++i) {
+        f.planes[PlaneLeft][i] = m[i][3] + m[i][0];
+        f.planes[PlaneRight][i] = m[i][3] - m[i][0];
+        f.planes[PlaneBottom][i] = m[i][3] + m[i][1];
+        f.planes[PlaneTop][i] = m[i][3] - m[i][1];
+        f.planes[PlaneNear][i] = m[i][3] + m[i][2];
+        f.planes[PlaneFar][i] = m[i][3] - m[i][2];
+    }
+
+    for (float* plane: f.planes) {
+        float len = std::sqrt(plane[0] * plane[0]
+                              + plane[1] * plane[1]
+                              + plane[2] * plane[2]);
+        if (len > 0.f) {
+            for (int i = 0; i < 4; ++i) {
+                plane[i] /= len;
+            }
+        }
+    }
+
+    return f;
+}
+
+bool Frustum::containsSphere(const Vec3& center,
+                             float radius) const
+{
+    for (const float* plane: planes) {
+        if (planeDistance(plane, center.x, center.y, center.z) < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Frustum::containsAABB(const Vec3& center,
+                           const Vec3& extents) const
+{
+    for (const float* plane: planes) {
+        if (aabbDistance(plane, center.x, center.y, center.z,
+                         extents.x, extents.y, extents.z) < 0.f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t getMaskWords(size_t count)
+{
+    return (count + 31) / 32;
+}
+
+void cullSpheres(const Frustum& frustum,
+                 const float* centerX,
+                 const float* centerY,
+                 const float* centerZ,
+                 const float* radius,
+                 size_t count,
+                 uint32_t* visible)
+{
+    memset(visible, 0, getMaskWords(count) * sizeof(uint32_t));
+
+    size_t i = 0;
+#if defined(__AVX__) || defined(__SSE2__)
+    i = cullSpheresSimd(frustum, centerX, centerY, centerZ, radius,
+                        count, visible);
+#endif
+
+    for (; i < count; ++i) {
+        if (frustum.containsSphere(Vec3(centerX[i], centerY[i], centerZ[i]),
+                                   radius[i])) {
+            setBit(visible, i);
+        }
+    }
+}
+
+void cullAABBs(const Frustum& frustum,
+               const float* centerX,
+               const float* centerY,
+               const float* centerZ,
+               const float* extentX,
+               const float* extentY,
+               const float* extentZ,
+               size_t count,
+               uint32_t* visible)
+{
+    memset(visible, 0, getMaskWords(count) * sizeof(uint32_t));
+
+    size_t i = 0;
+#if defined(__AVX__) || defined(__SSE2__)
+    i = cullAABBsSimd(frustum, centerX, centerY, centerZ,
+                      extentX, extentY, extentZ, count, visible);
+#endif
+
+    for (; i < count; ++i) {
+        if (frustum.containsAABB(Vec3(centerX[i], centerY[i], centerZ[i]),
+                                 Vec3(extentX[i], extentY[i], extentZ[i]))) {
+            setBit(visible, i);
+        }
+    }
+}
+
+} // namespace sb
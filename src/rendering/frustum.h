@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "utils/types.h"
+
+namespace sb {
+
+// View frustum as six planes, each stored as (a, b, c, d) with the normal
+// pointing inwards: a point p is inside if a*p.x + b*p.y + c*p.z + d >= 0
+// for every plane.
+struct Frustum
+{
+    enum EPlane {
+        PlaneLeft,
+        PlaneRight,
+        PlaneBottom,
+        PlaneTop,
+        PlaneNear,
+        PlaneFar,
+
+        PlaneCount
+    };
+
+    float planes[PlaneCount][4];
+
+    // extracts normalized planes from a (projection * view) matrix
+    static Frustum fromMatrix(const Mat44& viewProjection);
+
+    bool containsSphere(const Vec3& center,
+                        float radius) const;
+    bool containsAABB(const Vec3& center,
+                      const Vec3& extents) const;
+};
+
+// Batch visibility tests of objects stored as SoA arrays. Result is a
+// bitmask with bit (i % 32) of word (i / 32) set if object i intersects the
+// frustum; visible must hold getMaskWords(count) words. Uses AVX or SSE when
+// compiled in, scalar code otherwise.
+size_t getMaskWords(size_t count);
+
+void cullSpheres(const Frustum& frustum,
+                 const float* centerX,
+                 const float* centerY,
+                 const float* centerZ,
+                 const float* radius,
+                 size_t count,
+                 uint32_t* visible);
+
+// boxes given as center and half-extents
+void cullAABBs(const Frustum& frustum,
+               const float* centerX,
+               const float* centerY,
+               const float* centerZ,
+               const float* extentX,
+               const float* extentY,
+               const float* extentZ,
+               size_t count,
+               uint32_t* visible);
+
+} // namespace sb
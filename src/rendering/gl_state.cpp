@@ -0,0 +1,353 @@
+#include "rendering/gl_state.h"
+
+#include <algorithm>
+
+namespace sb {
+namespace {
+
+template<size_t N>
+int findIndex(const GLenum (&table)[N], GLenum value)
+{
+    for (size_t i = 0; i < N; ++i) {
+        if (table[i] == value) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// indexed by GLState::EBufferTarget
+const GLenum BUFFER_TARGETS[] = {
+    GL_ARRAY_BUFFER,
+    GL_ELEMENT_ARRAY_BUFFER,
+    GL_UNIFORM_BUFFER,
+    GL_PIXEL_PACK_BUFFER,
+    GL_PIXEL_UNPACK_BUFFER,
+    GL_COPY_READ_BUFFER,
+    GL_COPY_WRITE_BUFFER,
+    GL_DRAW_INDIRECT_BUFFER
+};
+
+// indexed by GLState::ETextureTarget
+const GLenum TEXTURE_TARGETS[] = {
+    GL_TEXTURE_2D,
+    GL_TEXTURE_2D_ARRAY,
+    GL_TEXTURE_CUBE_MAP,
+    GL_TEXTURE_3D
+};
+
+// indexed by GLState::ECapability
+const GLenum CAPABILITIES[] = {
+    GL_DEPTH_TEST,
+    GL_CULL_FACE,
+    GL_BLEND,
+    GL_SCISSOR_TEST,
+    GL_STENCIL_TEST,
+    GL_TEXTURE_2D
+};
+
+} // namespace
+
+const unsigned GLState::MAX_TEXTURE_UNITS;
+const unsigned GLState::MAX_UNIFORM_BINDINGS;
+const GLuint GLState::UNKNOWN;
+
+uint32_t GLState::Stats::totalIssued() const
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < CallCount; ++i) {
+        sum += issued[i];
+    }
+    return sum;
+}
+
+uint32_t GLState::Stats::totalSkipped() const
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < CallCount; ++i) {
+        sum += skipped[i];
+    }
+    return sum;
+}
+
+GLState::GLState():
+    mProgramGeneration(0),
+    mStats(),
+    mFrameStats()
+{
+    invalidate();
+}
+
+void GLState::invalidate()
+{
+    std::fill_n(mBuffers, (size_t)BufferTargetCount, UNKNOWN);
+    for (BufferRange& range: mUniformRanges) {
+        range = { UNKNOWN, 0, 0 };
+    }
+    mVertexArray = UNKNOWN;
+    mProgram = UNKNOWN;
+    mActiveTexture = UNKNOWN;
+    for (unsigned unit = 0; unit < MAX_TEXTURE_UNITS; ++unit) {
+        std::fill_n(mTextures[unit], (size_t)TextureTargetCount, UNKNOWN);
+    }
+    std::fill_n(mCapabilities, (size_t)CapabilityCount, StateUnknown);
+    mBlendSrc = UNKNOWN;
+    mBlendDst = UNKNOWN;
+    mDepthFunc = UNKNOWN;
+    mDepthMask = StateUnknown;
+    mCullFace = UNKNOWN;
+    mViewport = { -1, -1, -1, -1 };
+    mScissor = { -1, -1, -1, -1 };
+    mClearColorKnown = false;
+}
+
+void GLState::bindBuffer(GLenum target, BufferId buffer)
+{
+    int idx = findIndex(BUFFER_TARGETS, target);
+    if (idx < 0) {
+        track(CallBindBuffer, true);
+        glBindBuffer(target, buffer);
+        return;
+    }
+
+    if (track(CallBindBuffer, mBuffers[idx] != buffer)) {
+        glBindBuffer(target, buffer);
+        mBuffers[idx] = buffer;
+    }
+}
+
+void GLState::bindBufferRange(GLenum target, GLuint index, BufferId buffer,
+                              GLintptr offset, GLsizeiptr size)
+{
+    bool tracked = target == GL_UNIFORM_BUFFER && index < MAX_UNIFORM_BINDINGS;
+    if (tracked) {
+        const BufferRange& range = mUniformRanges[index];
+        if (!track(CallBindBufferRange, range.buffer != buffer
+                                        || range.offset != offset
+                                        || range.size != size)) {
+            return;
+        }
+        mUniformRanges[index] = { buffer, offset, size };
+    } else {
+        track(CallBindBufferRange, true);
+    }
+
+    glBindBufferRange(target, index, buffer, offset, size);
+
+    int idx = findIndex(BUFFER_TARGETS, target);
+    if (idx >= 0) {
+        mBuffers[idx] = buffer;
+    }
+}
+
+void GLState::bindVertexArray(GLuint vao)
+{
+    if (track(CallBindVertexArray, mVertexArray != vao)) {
+        glBindVertexArray(vao);
+        mVertexArray = vao;
+
+        // element array binding is a part of VAO state
+        mBuffers[BufferElementArray] = UNKNOWN;
+    }
+}
+
+void GLState::useProgram(ProgramId program)
+{
+    if (track(CallUseProgram, mProgram != program)) {
+        glUseProgram(program);
+        mProgram = program;
+    }
+}
+
+void GLState::activeTexture(unsigned unit)
+{
+    if (track(CallActiveTexture, mActiveTexture != unit)) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        mActiveTexture = unit;
+    }
+}
+
+void GLState::bindTexture(unsigned unit, GLenum target, TextureId texture)
+{
+    int idx = findIndex(TEXTURE_TARGETS, target);
+    if (idx < 0 || unit >= MAX_TEXTURE_UNITS) {
+        activeTexture(unit);
+        track(CallBindTexture, true);
+        glBindTexture(target, texture);
+        return;
+    }
+
+    // glActiveTexture is only needed if the binding actually changes
+    if (track(CallBindTexture, mTextures[unit][idx] != texture)) {
+        activeTexture(unit);
+        glBindTexture(target, texture);
+        mTextures[unit][idx] = texture;
+    }
+}
+
+void GLState::setCapability(GLenum cap, bool enabled)
+{
+    ETriState wanted = enabled ? StateOn : StateOff;
+    int idx = findIndex(CAPABILITIES, cap);
+
+    if (idx >= 0 && !track(CallCapability, mCapabilities[idx] != wanted)) {
+        return;
+    } else if (idx < 0) {
+        track(CallCapability, true);
+    } else {
+        mCapabilities[idx] = wanted;
+    }
+
+    if (enabled) {
+        glEnable(cap);
+    } else {
+        glDisable(cap);
+    }
+}
+
+void GLState::blendFunc(GLenum src, GLenum dst)
+{
+    if (track(CallBlendFunc, mBlendSrc != src || mBlendDst != dst)) {
+        glBlendFunc(src, dst);
+        mBlendSrc = src;
+        mBlendDst = dst;
+    }
+}
+
+void GLState::depthFunc(GLenum func)
+{
+    if (track(CallDepthFunc, mDepthFunc != func)) {
+        glDepthFunc(func);
+        mDepthFunc = func;
+    }
+}
+
+void GLState::depthMask(bool write)
+{
+    ETriState wanted = write ? StateOn : StateOff;
+    if (track(CallDepthMask, mDepthMask != wanted)) {
+        glDepthMask(write ? GL_TRUE : GL_FALSE);
+        mDepthMask = wanted;
+    }
+}
+
+void GLState::cullFace(GLenum face)
+{
+    if (track(CallCullFace, mCullFace != face)) {
+        glCullFace(face);
+        mCullFace = face;
+    }
+}
+
+void GLState::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    Rect r = { x, y, width, height };
+    if (track(CallViewport, !(mViewport == r))) {
+        glViewport(x, y, width, height);
+        mViewport = r;
+    }
+}
+
+void GLState::scissor(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    Rect r = { x, y, width, height };
+    if (track(CallScissor, !(mScissor == r))) {
+        glScissor(x, y, width, height);
+        mScissor = r;
+    }
+}
+
+void GLState::clearColor(const Color& c)
+{
+    bool changed = !mClearColorKnown
+                   || mClearColor.r != c.r || mClearColor.g != c.g
+                   || mClearColor.b != c.b || mClearColor.a != c.a;
+
+    if (track(CallClearColor, changed)) {
+        glClearColor(c.r, c.g, c.b, c.a);
+        mClearColor = c;
+        mClearColorKnown = true;
+    }
+}
+
+void GLState::deleteBuffer(BufferId buffer)
+{
+    glDeleteBuffers(1, &buffer);
+    for (GLuint& bound: mBuffers) {
+        if (bound == buffer) {
+            bound = 0;
+        }
+    }
+    for (BufferRange& range: mUniformRanges) {
+        if (range.buffer == buffer) {
+            range = { 0, 0, 0 };
+        }
+    }
+}
+
+void GLState::deleteVertexArray(GLuint vao)
+{
+    glDeleteVertexArrays(1, &vao);
+    if (mVertexArray == vao) {
+        mVertexArray = 0;
+        mBuffers[BufferElementArray] = UNKNOWN;
+    }
+}
+
+void GLState::deleteTexture(TextureId texture)
+{
+    glDeleteTextures(1, &texture);
+    for (unsigned unit = 0; unit < MAX_TEXTURE_UNITS; ++unit) {
+        for (GLuint& bound: mTextures[unit]) {
+            if (bound == texture) {
+                bound = 0;
+            }
+        }
+    }
+}
+
+void GLState::deleteProgram(ProgramId program)
+{
+    // a program in use is only flagged for deletion, binding stays valid
+    glDeleteProgram(program);
+    ++mProgramGeneration;
+}
+
+BufferId GLState::getBoundBuffer(GLenum target) const
+{
+    int idx = findIndex(BUFFER_TARGETS, target);
+    return idx < 0 ? UNKNOWN : mBuffers[idx];
+}
+
+void GLState::endFrame()
+{
+    mStats = mFrameStats;
+    mFrameStats = Stats();
+}
+
+const char* GLState::getCallName(ECall call)
+{
+    static const char* NAMES[] = {
+        "glBindBuffer",
+        "glBindVertexArray",
+        "glUseProgram",
+        "glActiveTexture",
+        "glBindTexture",
+        "glEnable/glDisable",
+        "glBlendFunc",
+        "glDepthFunc",
+        "glDepthMask",
+        "glCullFace",
+        "glViewport",
+        "glScissor",
+        "glClearColor",
+        "glBindBufferRange"
+    };
+    static_assert(sizeof(NAMES) / sizeof(NAMES[0]) == CallCount,
+                  "call names out of sync with ECall");
+
+    return call < CallCount ? NAMES[call] : "?";
+}
+
+} // namespace sb
+
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cstdint>
+
+#include "rendering/color.h"
+#include "rendering/types.h"
+
+namespace sb {
+
+// Shadows GL binding and fixed-function state and drops calls that would
+// not change anything. All GL state changes done by the renderer should go
+// through this class, otherwise invalidate() must be called.
+class GLState
+{
+public:
+    enum ECall {
+        CallBindBuffer,
+        CallBindVertexArray,
+        CallUseProgram,
+        CallActiveTexture,
+        CallBindTexture,
+        CallCapability,
+        CallBlendFunc,
+        CallDepthFunc,
+        CallDepthMask,
+        CallCullFace,
+        CallViewport,
+        CallScissor,
+        CallClearColor,
+        CallBindBufferRange,
+
+        CallCount
+    };
+
+    struct Stats
+    {
+        uint32_t issued[CallCount];
+        uint32_t skipped[CallCount];
+
+        uint32_t totalIssued() const;
+        uint32_t totalSkipped() const;
+    };
+
+    static const unsigned MAX_TEXTURE_UNITS = 16;
+    static const unsigned MAX_UNIFORM_BINDINGS = 16;
+
+    GLState();
+
+    GLState(const GLState&) = delete;
+    GLState(GLState&&) = delete;
+    GLState& operator =(const GLState&) = delete;
+    GLState& operator =(GLState&&) = delete;
+
+    // forgets everything, next call of each kind goes to the driver
+    void invalidate();
+
+    void bindBuffer(GLenum target, BufferId buffer);
+    // also binds buffer to the generic target, like GL does
+    void bindBufferRange(GLenum target, GLuint index, BufferId buffer,
+                         GLintptr offset, GLsizeiptr size);
+    void bindVertexArray(GLuint vao);
+    void useProgram(ProgramId program);
+    void bindTexture(unsigned unit, GLenum target, TextureId texture);
+    // texture uploads and parameter changes affect the active unit
+    void activeTexture(unsigned unit);
+
+    void setCapability(GLenum cap, bool enabled);
+    void enable(GLenum cap) { setCapability(cap, true); }
+    void disable(GLenum cap) { setCapability(cap, false); }
+
+    void blendFunc(GLenum src, GLenum dst);
+    void depthFunc(GLenum func);
+    void depthMask(bool write);
+    void cullFace(GLenum face);
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    void scissor(GLint x, GLint y, GLsizei width, GLsizei height);
+    void clearColor(const Color& c);
+
+    // deleted objects are implicitly unbound by GL
+    void deleteBuffer(BufferId buffer);
+    void deleteVertexArray(GLuint vao);
+    void deleteTexture(TextureId texture);
+    void deleteProgram(ProgramId program);
+    // changes whenever a program is deleted; GL may hand out its name to
+    // the next program, so anything cached by ProgramId is stale then
+    uint64_t getProgramGeneration() const { return mProgramGeneration; }
+
+    BufferId getBoundBuffer(GLenum target) const;
+    GLuint getBoundVertexArray() const { return mVertexArray; }
+    ProgramId getProgram() const { return mProgram; }
+
+    // rolls per-frame counters over
+    void endFrame();
+
+    // counters of the last finished frame
+    const Stats& getStats() const { return mStats; }
+    static const char* getCallName(ECall call);
+
+private:
+    enum EBufferTarget {
+        BufferArray,
+        BufferElementArray,
+        BufferUniform,
+        BufferPixelPack,
+        BufferPixelUnpack,
+        BufferCopyRead,
+        BufferCopyWrite,
+        BufferDrawIndirect,
+
+        BufferTargetCount
+    };
+
+    enum ETextureTarget {
+        Texture2D,
+        Texture2DArray,
+        TextureCubeMap,
+        Texture3D,
+
+        TextureTargetCount
+    };
+
+    enum ECapability {
+        CapDepthTest,
+        CapCullFace,
+        CapBlend,
+        CapScissorTest,
+        CapStencilTest,
+        CapTexture2D,
+
+        CapabilityCount
+    };
+
+    enum ETriState {
+        StateUnknown = -1,
+        StateOff = 0,
+        StateOn = 1
+    };
+
+    struct Rect
+    {
+        GLint x, y;
+        GLsizei width, height;
+
+        bool operator ==(const Rect& r) const
+        {
+            return x == r.x && y == r.y
+                   && width == r.width && height == r.height;
+        }
+    };
+
+    // UNKNOWN never matches a real GL name, which forces the next call
+    static const GLuint UNKNOWN = ~0u;
+
+    struct BufferRange
+    {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+    };
+
+    GLuint mBuffers[BufferTargetCount];
+    BufferRange mUniformRanges[MAX_UNIFORM_BINDINGS];
+    GLuint mVertexArray;
+    GLuint mProgram;
+    unsigned mActiveTexture;
+    GLuint mTextures[MAX_TEXTURE_UNITS][TextureTargetCount];
+    ETriState mCapabilities[CapabilityCount];
+    GLenum mBlendSrc;
+    GLenum mBlendDst;
+    GLenum mDepthFunc;
+    ETriState mDepthMask;
+    GLenum mCullFace;
+    Rect mViewport;
+    Rect mScissor;
+    Color mClearColor;
+    bool mClearColorKnown;
+    uint64_t mProgramGeneration;
+
+    Stats mStats;
+    Stats mFrameStats;
+
+    // returns changed, updates counters
+    bool track(ECall call, bool changed)
+    {
+        if (changed) {
+            ++mFrameStats.issued[call];
+        } else {
+            ++mFrameStats.skipped[call];
+        }
+        return changed;
+    }
+};
+
+} // namespace sb
+
@@ -0,0 +1,247 @@
+#include "rendering/gpu_profiler.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "utils/logger.h"
+
+namespace sb {
+
+const unsigned GpuProfiler::FRAME_LATENCY;
+const unsigned GpuProfiler::HISTORY_SIZE;
+const char* const GpuProfiler::FRAME_SCOPE = "frame";
+
+GpuProfiler::GpuProfiler():
+    mEnabled(false),
+    mInFrame(false),
+    mFrameLogging(false),
+    mDroppedFrames(0),
+    mFrames(),
+    mCurrentFrame(0),
+    mOpenRecords(),
+    mScopes(),
+    mScopeIds()
+{
+}
+
+GpuProfiler::~GpuProfiler()
+{
+    for (Frame& frame: mFrames) {
+        if (!frame.queries.empty()) {
+            glDeleteQueries((GLsizei)frame.queries.size(),
+                            frame.queries.data());
+        }
+    }
+}
+
+bool GpuProfiler::init()
+{
+    mEnabled = GLEW_ARB_timer_query;
+    if (!mEnabled) {
+        gLog.warn("ARB_timer_query not available, GPU profiling disabled\n");
+    }
+
+    return mEnabled;
+}
+
+GLuint GpuProfiler::timestamp(Frame& frame)
+{
+    if (frame.usedQueries == frame.queries.size()) {
+        GLuint query;
+        glGenQueries(1, &query);
+        frame.queries.push_back(query);
+    }
+
+    GLuint query = frame.queries[frame.usedQueries++];
+    glQueryCounter(query, GL_TIMESTAMP);
+    frame.lastQuery = query;
+    return query;
+}
+
+unsigned GpuProfiler::getScopeId(const char* name, unsigned depth)
+{
+    auto it = mScopeIds.find(name);
+    if (it != mScopeIds.end()) {
+        return it->second;
+    }
+
+    ScopeHistory history;
+    history.name = name;
+    history.depth = depth;
+    history.numSamples = 0;
+    history.next = 0;
+
+    unsigned id = (unsigned)mScopes.size();
+    mScopes.push_back(history);
+    mScopeIds[name] = id;
+    return id;
+}
+
+void GpuProfiler::beginFrame()
+{
+    if (!mEnabled || mInFrame) {
+        return;
+    }
+
+    Frame& frame = mFrames[mCurrentFrame];
+    if (frame.pending) {
+        resolve(frame);
+    }
+
+    frame.usedQueries = 0;
+    frame.records.clear();
+    frame.pending = false;
+
+    mInFrame = true;
+    beginScope(FRAME_SCOPE);
+}
+
+void GpuProfiler::endFrame()
+{
+    if (!mEnabled || !mInFrame) {
+        return;
+    }
+
+    while (!mOpenRecords.empty()) {
+        endScope();
+    }
+
+    mFrames[mCurrentFrame].pending = true;
+    mCurrentFrame = (mCurrentFrame + 1) % FRAME_LATENCY;
+    mInFrame = false;
+}
+
+void GpuProfiler::discardFrame()
+{
+    if (!mEnabled || !mInFrame) {
+        return;
+    }
+
+    // the slot is reused by the next frame, issued queries get overwritten
+    Frame& frame = mFrames[mCurrentFrame];
+    frame.usedQueries = 0;
+    frame.records.clear();
+
+    mOpenRecords.clear();
+    mInFrame = false;
+}
+
+void GpuProfiler::beginScope(const char* name)
+{
+    if (!mEnabled || !mInFrame) {
+        return;
+    }
+
+    Frame& frame = mFrames[mCurrentFrame];
+    unsigned depth = (unsigned)mOpenRecords.size();
+
+    Record record = {
+        getScopeId(name, depth),
+        depth,
+        timestamp(frame),
+        0
+    };
+
+    mOpenRecords.push_back(frame.records.size());
+    frame.records.push_back(record);
+}
+
+void GpuProfiler::endScope()
+{
+    if (!mEnabled || !mInFrame) {
+        return;
+    }
+
+    assert(!mOpenRecords.empty() && "endScope without beginScope");
+
+    Frame& frame = mFrames[mCurrentFrame];
+    frame.records[mOpenRecords.back()].endQuery = timestamp(frame);
+    mOpenRecords.pop_back();
+}
+
+void GpuProfiler::resolve(Frame& frame)
+{
+    // timestamps complete in order, so the last one being available means
+    // all of them are
+    GLint available = 0;
+    glGetQueryObjectiv(frame.lastQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        ++mDroppedFrames;
+        return;
+    }
+
+    if (mFrameLogging) {
+        gLog.printf("GPU frame:\n");
+    }
+
+    for (const Record& record: frame.records) {
+        GLuint64 begin = 0;
+        GLuint64 end = 0;
+        glGetQueryObjectui64v(record.beginQuery, GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(record.endQuery, GL_QUERY_RESULT, &end);
+
+        double ms = (double)(end - begin) / 1000000.0;
+
+        ScopeHistory& history = mScopes[record.scope];
+        history.samples[history.next] = ms;
+        history.next = (history.next + 1) % HISTORY_SIZE;
+        history.numSamples = std::min(history.numSamples + 1, HISTORY_SIZE);
+
+        if (mFrameLogging) {
+            gLog.printf("%*s%-32s%8.3f ms\n", record.depth * 2, "",
+                        history.name.c_str(), ms);
+        }
+    }
+}
+
+GpuProfiler::ScopeStats GpuProfiler::makeStats(const ScopeHistory& history) const
+{
+    ScopeStats stats = { history.name, history.depth, history.numSamples,
+                         0.0, 0.0, 0.0, 0.0 };
+
+    if (history.numSamples == 0) {
+        return stats;
+    }
+
+    unsigned last = (history.next + HISTORY_SIZE - 1) % HISTORY_SIZE;
+    stats.lastMs = history.samples[last];
+    stats.minMs = stats.maxMs = stats.lastMs;
+
+    double sum = 0.0;
+    for (unsigned i = 0; i < history.numSamples; ++i) {
+        double sample = history.samples[i];
+        stats.minMs = std::min(stats.minMs, sample);
+        stats.maxMs = std::max(stats.maxMs, sample);
+        sum += sample;
+    }
+    stats.avgMs = sum / history.numSamples;
+
+    return stats;
+}
+
+std::vector<GpuProfiler::ScopeStats> GpuProfiler::getStats() const
+{
+    std::vector<ScopeStats> ret;
+    ret.reserve(mScopes.size());
+
+    for (const ScopeHistory& history: mScopes) {
+        ret.push_back(makeStats(history));
+    }
+
+    return ret;
+}
+
+bool GpuProfiler::getScopeStats(const std::string& name,
+                                ScopeStats& stats) const
+{
+    auto it = mScopeIds.find(name);
+    if (it == mScopeIds.end()) {
+        return false;
+    }
+
+    stats = makeStats(mScopes[it->second]);
+    return stats.samples > 0;
+}
+
+} // namespace sb
+
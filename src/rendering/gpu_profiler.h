@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "rendering/types.h"
+
+namespace sb {
+
+// Measures GPU time of named, possibly nested, scopes with GL_TIMESTAMP
+// queries. Queries of a frame are read back FRAME_LATENCY frames later, so
+// reading results never stalls the pipeline.
+class GpuProfiler
+{
+public:
+    static const unsigned FRAME_LATENCY = 3;
+    static const unsigned HISTORY_SIZE = 64;
+
+    // name of the implicit scope that spans the whole frame
+    static const char* const FRAME_SCOPE;
+
+    struct ScopeStats
+    {
+        std::string name;
+        unsigned depth;     // nesting level, 0 for the frame scope
+        unsigned samples;   // within the rolling window
+        double lastMs;
+        double minMs;
+        double avgMs;
+        double maxMs;
+    };
+
+    // RAII helper for beginScope/endScope
+    class Scope
+    {
+    public:
+        Scope(GpuProfiler& profiler, const char* name):
+            mProfiler(profiler)
+        {
+            mProfiler.beginScope(name);
+        }
+        ~Scope()
+        {
+            mProfiler.endScope();
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator =(const Scope&) = delete;
+
+    private:
+        GpuProfiler& mProfiler;
+    };
+
+    GpuProfiler();
+    ~GpuProfiler();
+
+    GpuProfiler(const GpuProfiler&) = delete;
+    GpuProfiler(GpuProfiler&&) = delete;
+    GpuProfiler& operator =(const GpuProfiler&) = delete;
+    GpuProfiler& operator =(GpuProfiler&&) = delete;
+
+    // returns false if timer queries are not supported; profiler is then
+    // a no-op
+    bool init();
+    bool isEnabled() const { return mEnabled; }
+
+    void beginFrame();
+    void endFrame();
+    // ends the frame without recording it, for frames that turned out to
+    // be skipped; their timings would only dilute the statistics
+    void discardFrame();
+
+    void beginScope(const char* name);
+    void endScope();
+
+    // min/avg/max over the last HISTORY_SIZE resolved frames
+    std::vector<ScopeStats> getStats() const;
+    bool getScopeStats(const std::string& name, ScopeStats& stats) const;
+
+    // dumps each resolved frame through the logger
+    void setFrameLogging(bool enabled) { mFrameLogging = enabled; }
+
+    // frames whose results were not ready in time and had to be discarded
+    uint32_t getDroppedFrames() const { return mDroppedFrames; }
+
+private:
+    struct Record
+    {
+        unsigned scope;
+        unsigned depth;
+        GLuint beginQuery;
+        GLuint endQuery;
+    };
+
+    struct Frame
+    {
+        std::vector<GLuint> queries;    // pool, grows as needed
+        size_t usedQueries;
+        std::vector<Record> records;
+        GLuint lastQuery;
+        bool pending;
+    };
+
+    struct ScopeHistory
+    {
+        std::string name;
+        unsigned depth;
+        double samples[HISTORY_SIZE];
+        unsigned numSamples;
+        unsigned next;
+    };
+
+    bool mEnabled;
+    bool mInFrame;
+    bool mFrameLogging;
+    uint32_t mDroppedFrames;
+
+    Frame mFrames[FRAME_LATENCY];
+    unsigned mCurrentFrame;
+    std::vector<size_t> mOpenRecords;
+
+    std::vector<ScopeHistory> mScopes;
+    std::unordered_map<std::string, unsigned> mScopeIds;
+
+    GLuint timestamp(Frame& frame);
+    unsigned getScopeId(const char* name, unsigned depth);
+    void resolve(Frame& frame);
+    ScopeStats makeStats(const ScopeHistory& history) const;
+};
+
+} // namespace sb
+
@@ -0,0 +1,372 @@
+#include "rendering/instance_batcher.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <tuple>
+
+#include "rendering/camera.h"
+#include "rendering/frame_uniforms.h"
+#include "rendering/draw_batcher.h"
+#include "rendering/gl_state.h"
+#include "rendering/stream_buffer.h"
+#include "utils/gl.h"
+#include "utils/logger.h"
+
+namespace sb {
+namespace {
+
+// instances that can share a single draw call compare equal
+bool lessByState(const Drawable* a,
+                 const Drawable* b)
+{
+    return std::make_tuple(a->getProgram(), a->getTexture(),
+                           a->getProjectionType(), &a->getMesh())
+           < std::make_tuple(b->getProgram(), b->getTexture(),
+                             b->getProjectionType(), &b->getMesh());
+}
+
+bool sameState(const Drawable* a,
+               const Drawable* b)
+{
+    return !lessByState(a, b) && !lessByState(b, a);
+}
+
+} // namespace
+
+InstanceBatcher::InstanceBatcher():
+    mQueue(),
+    mDeferred(),
+    mGroups(),
+    mInstances(),
+    mMeshes(),
+    mMatrixLocations(),
+    mState(NULL),
+    mStream(NULL),
+    mFallback(NULL),
+    mHardware(false),
+    mVertexAttribDivisor(NULL),
+    mDrawElementsInstanced(NULL),
+    mInstanceBuffer(0),
+    mInstanceBufferCapacity(0),
+    mFallbackInstances(0),
+    mStats(),
+    mPartiallyFlushed(false)
+{
+}
+
+InstanceBatcher::~InstanceBatcher()
+{
+    for (auto& it: mMeshes) {
+        mState->deleteVertexArray(it.second.vao);
+        mState->deleteBuffer(it.second.vertexBuffer);
+        mState->deleteBuffer(it.second.indexBuffer);
+    }
+    if (mInstanceBuffer) {
+        mState->deleteBuffer(mInstanceBuffer);
+    }
+}
+
+bool InstanceBatcher::init(GLState& state,
+                           StreamBuffer& stream,
+                           DrawBatcher& fallback)
+{
+    mState = &state;
+    mStream = &stream;
+    mFallback = &fallback;
+
+    // core entry points appear only with GL 3.1/3.3, a 3.0 context may
+    // still expose the ARB ones
+    mVertexAttribDivisor = glVertexAttribDivisor
+                           ? glVertexAttribDivisor
+                           : glVertexAttribDivisorARB;
+    mDrawElementsInstanced = glDrawElementsInstanced
+                             ? glDrawElementsInstanced
+                             : glDrawElementsInstancedARB;
+
+    mHardware = GLEW_ARB_instanced_arrays
+                && (GLEW_VERSION_3_1 || GLEW_ARB_draw_instanced)
+                && mVertexAttribDivisor
+                && mDrawElementsInstanced;
+    if (!mHardware) {
+        gLog.warn("instanced arrays not available, instances will be "
+                  "batched\n");
+        return true;
+    }
+
+    GL_CHECK_RET(glGenBuffers(1, &mInstanceBuffer), false);
+    return true;
+}
+
+void InstanceBatcher::add(const Drawable& d,
+                          const Mat44* transforms,
+                          const Color* colors,
+                          size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+
+    if (!mHardware) {
+        mFallback->addInstances(d, transforms, colors, count);
+        mFallbackInstances += count;
+        return;
+    }
+
+    mQueue.push_back({ &d, transforms, colors, count });
+}
+
+void InstanceBatcher::flush(Camera& camera)
+{
+    if (!mPartiallyFlushed) {
+        mStats = Stats();
+    }
+    mPartiallyFlushed = false;
+
+    if (!mHardware) {
+        // already drawn by the fallback batcher
+        mStats.instances = (uint32_t)mFallbackInstances;
+        mFallbackInstances = 0;
+        return;
+    }
+
+    drawQueue(camera);
+
+    releaseUnusedMeshes();
+    mStats.meshes = (uint32_t)mMeshes.size();
+}
+
+void InstanceBatcher::flush(Camera& camera,
+                            EProjectionType projection)
+{
+    if (!mPartiallyFlushed) {
+        mStats = Stats();
+        mPartiallyFlushed = true;
+    }
+
+    // the fallback batcher is flushed by projection on its own
+    if (!mHardware) {
+        return;
+    }
+
+    auto deferred = std::stable_partition(
+            mQueue.begin(), mQueue.end(),
+            [projection](const Submission& s) {
+                return s.drawable->getProjectionType() == projection;
+            });
+    mDeferred.assign(deferred, mQueue.end());
+    mQueue.erase(deferred, mQueue.end());
+
+    drawQueue(camera);
+    mQueue.swap(mDeferred);
+}
+
+void InstanceBatcher::discard()
+{
+    mQueue.clear();
+    mFallbackInstances = 0;
+    mPartiallyFlushed = false;
+}
+
+void InstanceBatcher::drawQueue(Camera& camera)
+{
+    if (!mQueue.empty()) {
+        build();
+
+        BufferId buffer = 0;
+        size_t offset = 0;
+        upload(buffer, offset);
+        submit(camera, buffer, offset);
+    }
+
+    mQueue.clear();
+}
+
+void InstanceBatcher::build()
+{
+    mGroups.clear();
+    mInstances.clear();
+
+    std::stable_sort(mQueue.begin(), mQueue.end(),
+                     [](const Submission& a, const Submission& b) {
+                         return lessByState(a.drawable, b.drawable);
+                     });
+
+    for (const Submission& s: mQueue) {
+        if (mGroups.empty() || !sameState(mGroups.back().drawable,
+                                          s.drawable)) {
+            mGroups.push_back({ s.drawable, mInstances.size(), 0 });
+        }
+
+        for (size_t i = 0; i < s.count; ++i) {
+            mInstances.push_back({ s.transforms[i],
+                                   s.colors ? s.colors[i] : Color::White });
+        }
+        mGroups.back().numInstances += s.count;
+    }
+
+    mStats.instances += (uint32_t)mInstances.size();
+    mStats.draws += (uint32_t)mGroups.size();
+}
+
+void InstanceBatcher::upload(BufferId& buffer,
+                             size_t& offset)
+{
+    size_t bytes = mInstances.size() * sizeof(InstanceData);
+
+    StreamBuffer::Allocation alloc = mStream->allocate(bytes);
+    if (alloc.isValid()) {
+        memcpy(alloc.ptr, mInstances.data(), bytes);
+        mStream->flush();
+
+        buffer = mStream->getId();
+        offset = alloc.offset;
+        return;
+    }
+
+    // stream buffer full for this frame, orphan a private one instead
+    if (bytes > mInstanceBufferCapacity) {
+        mInstanceBufferCapacity = std::max(bytes, mInstanceBufferCapacity * 2);
+    }
+    mState->bindBuffer(GL_ARRAY_BUFFER, mInstanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, mInstanceBufferCapacity, NULL,
+                 GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, mInstances.data());
+
+    buffer = mInstanceBuffer;
+    offset = 0;
+}
+
+// VAO must be bound
+void InstanceBatcher::setInstanceSource(BufferId buffer,
+                                        size_t offset)
+{
+    mState->bindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (GLuint column = 0; column < 4; ++column) {
+        glVertexAttribPointer(AttribInstanceTransform + column, 4, GL_FLOAT,
+                              GL_FALSE, sizeof(InstanceData),
+                              (void*)(offset
+                                      + offsetof(InstanceData, transform)
+                                      + column * sizeof(Vec4)));
+    }
+    glVertexAttribPointer(AttribInstanceColor, 4, GL_FLOAT, GL_FALSE,
+                          sizeof(InstanceData),
+                          (void*)(offset + offsetof(InstanceData, color)));
+}
+
+void InstanceBatcher::submit(Camera& camera,
+                             BufferId buffer,
+                             size_t offset)
+{
+    ProgramId currProgram = 0;
+    EProjectionType currProjection = ProjectionPerspective;
+    bool matrixSet = false;
+
+    for (const Group& group: mGroups) {
+        const Drawable& d = *group.drawable;
+        MeshBuffers& mesh = getMeshBuffers(d.getSharedMesh());
+
+        mState->bindVertexArray(mesh.vao);
+        setInstanceSource(buffer,
+                          offset + group.firstInstance * sizeof(InstanceData));
+
+        if (d.getProgram() != currProgram) {
+            mState->useProgram(d.getProgram());
+            currProgram = d.getProgram();
+            matrixSet = false;
+        }
+        mState->bindTexture(0, GL_TEXTURE_2D, d.getTexture());
+
+        GLint matrixLocation = mMatrixLocations.get(*mState, d.getProgram());
+        if (matrixLocation >= 0
+                && (!matrixSet || d.getProjectionType() != currProjection)) {
+            Mat44 viewProjection =
+                    camera.getViewProjectionMatrix(d.getProjectionType());
+            glUniformMatrix4fv(matrixLocation, 1, GL_FALSE,
+                               &viewProjection[0][0]);
+            currProjection = d.getProjectionType();
+            matrixSet = true;
+        }
+
+        mDrawElementsInstanced(mesh.shape, mesh.numIndices, GL_UNSIGNED_INT,
+                               NULL, (GLsizei)group.numInstances);
+    }
+
+    mState->bindVertexArray(0);
+}
+
+InstanceBatcher::MeshBuffers&
+InstanceBatcher::getMeshBuffers(const std::shared_ptr<const Mesh>& mesh)
+{
+    auto it = mMeshes.find(mesh.get());
+    if (it != mMeshes.end()) {
+        it->second.used = true;
+        return it->second;
+    }
+
+    const std::vector<Vertex>& vertices = mesh->getVertices();
+    std::vector<IndexType> indices;
+    mesh->appendListIndices(0, indices);
+
+    MeshBuffers buffers;
+    buffers.mesh = mesh;
+    buffers.shape = mesh->getListShape();
+    buffers.numIndices = (GLsizei)indices.size();
+    buffers.used = true;
+
+    glGenVertexArrays(1, &buffers.vao);
+    glGenBuffers(1, &buffers.vertexBuffer);
+    glGenBuffers(1, &buffers.indexBuffer);
+
+    mState->bindVertexArray(buffers.vao);
+
+    mState->bindBuffer(GL_ARRAY_BUFFER, buffers.vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
+                 vertices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(AttribPosition, 3, GL_FLOAT, GL_FALSE,
+                          sizeof(Vertex),
+                          (void*)offsetof(Vertex, position));
+    glVertexAttribPointer(AttribColor, 4, GL_FLOAT, GL_FALSE,
+                          sizeof(Vertex),
+                          (void*)offsetof(Vertex, color));
+    glVertexAttribPointer(AttribTexcoord, 2, GL_FLOAT, GL_FALSE,
+                          sizeof(Vertex),
+                          (void*)offsetof(Vertex, texcoord));
+    glEnableVertexAttribArray(AttribPosition);
+    glEnableVertexAttribArray(AttribColor);
+    glEnableVertexAttribArray(AttribTexcoord);
+
+    // divisors are VAO state, set once
+    for (GLuint column = 0; column < 4; ++column) {
+        glEnableVertexAttribArray(AttribInstanceTransform + column);
+        mVertexAttribDivisor(AttribInstanceTransform + column, 1);
+    }
+    glEnableVertexAttribArray(AttribInstanceColor);
+    mVertexAttribDivisor(AttribInstanceColor, 1);
+
+    mState->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(IndexType),
+                 indices.data(), GL_STATIC_DRAW);
+
+    return mMeshes[mesh.get()] = buffers;
+}
+
+// frees geometry of meshes not drawn this frame that nobody else owns
+void InstanceBatcher::releaseUnusedMeshes()
+{
+    for (auto it = mMeshes.begin(); it != mMeshes.end();) {
+        MeshBuffers& buffers = it->second;
+
+        if (!buffers.used && buffers.mesh.use_count() == 1) {
+            mState->deleteVertexArray(buffers.vao);
+            mState->deleteBuffer(buffers.vertexBuffer);
+            mState->deleteBuffer(buffers.indexBuffer);
+            it = mMeshes.erase(it);
+        } else {
+            buffers.used = false;
+            ++it;
+        }
+    }
+}
+
+} // namespace sb
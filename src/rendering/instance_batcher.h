@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "rendering/drawable.h"
+#include "rendering/frame_uniforms.h"
+#include "rendering/types.h"
+
+namespace sb {
+
+class Camera;
+class DrawBatcher;
+class GLState;
+class StreamBuffer;
+
+// Draws many copies of the same mesh with a single instanced draw call.
+// Per-instance transforms and colors are streamed every frame, mesh
+// geometry is uploaded once and kept for as long as the mesh is in use.
+// Without ARB_instanced_arrays instances are expanded into the DrawBatcher.
+class InstanceBatcher
+{
+public:
+    struct Stats
+    {
+        uint32_t instances;
+        uint32_t draws;
+        uint32_t meshes;    // with geometry resident in GPU buffers
+    };
+
+    InstanceBatcher();
+    ~InstanceBatcher();
+
+    InstanceBatcher(const InstanceBatcher&) = delete;
+    InstanceBatcher(InstanceBatcher&&) = delete;
+    InstanceBatcher& operator =(const InstanceBatcher&) = delete;
+    InstanceBatcher& operator =(InstanceBatcher&&) = delete;
+
+    // requires a current GL context; state, stream and fallback must
+    // outlive the batcher
+    bool init(GLState& state,
+              StreamBuffer& stream,
+              DrawBatcher& fallback);
+    bool isHardwareInstancing() const { return mHardware; }
+
+    // d provides mesh, program, texture and projection, its own transform
+    // is ignored; colors may be NULL. d and both arrays must stay alive
+    // until flush()
+    void add(const Drawable& d,
+             const Mat44* transforms,
+             const Color* colors,
+             size_t count);
+    void flush(Camera& camera);
+    // draws only what uses projection, the rest stays queued for a later
+    // flush; statistics cover all flushes up to the next full one
+    void flush(Camera& camera,
+               EProjectionType projection);
+    // forgets everything queued without drawing it; the fallback batcher
+    // has to be discarded separately
+    void discard();
+
+    // statistics of the last flushed frame
+    const Stats& getStats() const { return mStats; }
+
+private:
+    struct InstanceData
+    {
+        Mat44 transform;
+        Color color;
+    };
+
+    struct MeshBuffers
+    {
+        std::shared_ptr<const Mesh> mesh;
+        GLuint vao;
+        BufferId vertexBuffer;
+        BufferId indexBuffer;
+        GLenum shape;
+        GLsizei numIndices;
+        bool used;
+    };
+
+    struct Submission
+    {
+        const Drawable* drawable;
+        const Mat44* transforms;
+        const Color* colors;
+        size_t count;
+    };
+
+    struct Group
+    {
+        const Drawable* drawable;   // first one, provides state and mesh
+        size_t firstInstance;
+        size_t numInstances;
+    };
+
+    typedef void (*VertexAttribDivisorFunc)(GLuint, GLuint);
+    typedef void (*DrawElementsInstancedFunc)(GLenum, GLsizei, GLenum,
+                                              const void*, GLsizei);
+
+    std::vector<Submission> mQueue;
+    std::vector<Submission> mDeferred;
+    std::vector<Group> mGroups;
+    std::vector<InstanceData> mInstances;
+    std::unordered_map<const Mesh*, MeshBuffers> mMeshes;
+    MatrixLocations mMatrixLocations;
+
+    GLState* mState;
+    StreamBuffer* mStream;
+    DrawBatcher* mFallback;
+    bool mHardware;
+    VertexAttribDivisorFunc mVertexAttribDivisor;
+    DrawElementsInstancedFunc mDrawElementsInstanced;
+
+    BufferId mInstanceBuffer;
+    size_t mInstanceBufferCapacity;
+    size_t mFallbackInstances;
+
+    Stats mStats;
+    bool mPartiallyFlushed;
+
+    void drawQueue(Camera& camera);
+    void build();
+    void upload(BufferId& buffer,
+                size_t& offset);
+    void submit(Camera& camera,
+                BufferId buffer,
+                size_t offset);
+    void releaseUnusedMeshes();
+
+    MeshBuffers& getMeshBuffers(const std::shared_ptr<const Mesh>& mesh);
+    void setInstanceSource(BufferId buffer,
+                           size_t offset);
+};
+
+} // namespace sb
@@ -0,0 +1,51 @@
+#include "rendering/lod_drawable.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace sb {
+
+LodDrawable::LodDrawable(const std::vector<Level>& levels,
+                         ProgramId program,
+                         TextureId texture,
+                         EProjectionType projection):
+    mLevels(),
+    mMinScreenSizes(),
+    mRadius(0.f),
+    mTransform(1.f),
+    mState()
+{
+    assert(!levels.empty() && levels.size() <= MAX_LEVELS);
+
+    for (const Level& level: levels) {
+        assert(mMinScreenSizes.empty()
+               || level.minScreenSize <= mMinScreenSizes.back());
+
+        mLevels.push_back(Drawable(level.mesh, program, texture, projection));
+        mMinScreenSizes.push_back(level.minScreenSize);
+    }
+
+    float radiusSq = 0.f;
+    for (const Vertex& v: levels[0].mesh->getVertices()) {
+        const Vec3& p = v.position;
+        radiusSq = std::max(radiusSq, p.x * p.x + p.y * p.y + p.z * p.z);
+    }
+    mRadius = std::sqrt(radiusSq);
+}
+
+void LodDrawable::setLayer(uint8_t layer)
+{
+    for (Drawable& d: mLevels) {
+        d.setLayer(layer);
+    }
+}
+
+void LodDrawable::setTranslucent(bool translucent)
+{
+    for (Drawable& d: mLevels) {
+        d.setTranslucent(translucent);
+    }
+}
+
+} // namespace sb
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "rendering/drawable.h"
+#include "rendering/mesh.h"
+#include "rendering/types.h"
+#include "utils/types.h"
+
+namespace sb {
+
+// Level-of-detail selection state of a single instance, kept between
+// frames for hysteresis and cross-fading. Drawables keep their own,
+// instanced draws need one per instance.
+struct LodState
+{
+    static const uint8_t NO_LEVEL = 0xff;
+
+    uint8_t level;      // NO_LEVEL until selected for the first time
+    uint8_t previous;   // level faded out, valid while fade < 1
+    float fade;         // 0 right after a switch, 1 once complete
+
+    LodState():
+        level(NO_LEVEL),
+        previous(NO_LEVEL),
+        fade(1.f)
+    {}
+};
+
+// Drawable with several meshes of decreasing detail. Level i is used while
+// the instance covers at least getMinScreenSize(i) of the viewport height;
+// below the size of the last level nothing is drawn.
+class LodDrawable
+{
+public:
+    static const unsigned MAX_LEVELS = 8;
+
+    struct Level
+    {
+        std::shared_ptr<const Mesh> mesh;
+        // projected bounding sphere diameter relative to viewport height
+        float minScreenSize;
+    };
+
+    // levels go from the most detailed one, with decreasing minScreenSize
+    LodDrawable(const std::vector<Level>& levels,
+                ProgramId program,
+                TextureId texture = 0,
+                EProjectionType projection = ProjectionPerspective);
+
+    unsigned getNumLevels() const { return (unsigned)mLevels.size(); }
+    // transform of the returned drawable is not used
+    const Drawable& getLevel(unsigned level) const { return mLevels[level]; }
+    float getMinScreenSize(unsigned level) const
+    {
+        return mMinScreenSizes[level];
+    }
+    // bounding sphere of the most detailed mesh, centered at the origin
+    float getRadius() const { return mRadius; }
+    EProjectionType getProjectionType() const
+    {
+        return mLevels[0].getProjectionType();
+    }
+
+    const Mat44& getTransform() const { return mTransform; }
+    void setTransform(const Mat44& transform) { mTransform = transform; }
+
+    // see Drawable
+    uint8_t getLayer() const { return mLevels[0].getLayer(); }
+    void setLayer(uint8_t layer);
+    bool isTranslucent() const { return mLevels[0].isTranslucent(); }
+    void setTranslucent(bool translucent);
+
+    LodState& getState() { return mState; }
+
+private:
+    std::vector<Drawable> mLevels;
+    std::vector<float> mMinScreenSizes;
+    float mRadius;
+    Mat44 mTransform;
+    LodState mState;
+};
+
+} // namespace sb
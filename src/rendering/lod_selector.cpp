@@ -0,0 +1,291 @@
+#include "rendering/lod_selector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "rendering/camera.h"
+#include "rendering/draw_batcher.h"
+#include "rendering/instance_batcher.h"
+
+namespace sb {
+namespace {
+
+// bias change per frame while over or under the budget
+const float BIAS_STEP = 0.05f;
+// weight of the newest frame in the averaged work time
+const double AVERAGE_WEIGHT = 0.1;
+// bias only drops once frames are comfortably within the budget, so that
+// it does not oscillate around it
+const double BUDGET_SLACK = 0.85;
+
+} // namespace
+
+const float LodSelector::MAX_BIAS = 4.f;
+
+LodSelector::LodSelector():
+    mBias(0.f),
+    mHysteresis(0.1f),
+    mFadeDuration(0.25f),
+    mFrameTimeBudget(0.0),
+    mAverageWorkMs(0.0),
+    mFrameDelta(1.f / 60.f),
+    mColors(),
+    mTransformArrays(),
+    mColorArrays(),
+    mUsedArrays(0),
+    mEntries(),
+    mFrameStats(),
+    mStats()
+{
+}
+
+LodSelector::~LodSelector()
+{
+}
+
+void LodSelector::setBias(float bias)
+{
+    mBias = std::max(-MAX_BIAS, std::min(MAX_BIAS, bias));
+}
+
+void LodSelector::setHysteresis(float fraction)
+{
+    mHysteresis = std::max(0.f, fraction);
+}
+
+void LodSelector::setFadeDuration(float seconds)
+{
+    mFadeDuration = std::max(0.f, seconds);
+}
+
+void LodSelector::setFrameTimeBudget(double milliseconds)
+{
+    mFrameTimeBudget = std::max(0.0, milliseconds);
+    mAverageWorkMs = 0.0;
+}
+
+float LodSelector::getScreenSize(Camera& camera,
+                                 EProjectionType projection,
+                                 const Mat44& transform,
+                                 float radius) const
+{
+    // the sphere grows with the largest axis scale
+    float scaleSq = 0.f;
+    for (int axis = 0; axis < 3; ++axis) {
+        scaleSq = std::max(scaleSq, transform[axis][0] * transform[axis][0]
+                                    + transform[axis][1] * transform[axis][1]
+                                    + transform[axis][2] * transform[axis][2]);
+    }
+    float worldRadius = radius * std::sqrt(scaleSq);
+
+    if (projection == ProjectionOrthographic) {
+        return worldRadius * camera.getOrthographicProjectionMatrix()[1][1];
+    }
+
+    const Vec3& eye = camera.getEye();
+    Vec3 d(transform[3][0] - eye.x,
+           transform[3][1] - eye.y,
+           transform[3][2] - eye.z);
+    float distance = std::sqrt(d.x * d.x + d.y * d.y + d.z * d.z);
+    if (distance <= worldRadius) {
+        return std::numeric_limits<float>::max();
+    }
+
+    return worldRadius * camera.getPerspectiveProjectionMatrix()[1][1]
+           / distance;
+}
+
+unsigned LodSelector::getLevel(const LodDrawable& d,
+                               float screenSize) const
+{
+    unsigned level = 0;
+    while (level < d.getNumLevels()
+            && screenSize < d.getMinScreenSize(level)) {
+        ++level;
+    }
+    return level;
+}
+
+unsigned LodSelector::select(const LodDrawable& d,
+                             float screenSize,
+                             LodState& state)
+{
+    float size = screenSize * std::exp2(-mBias);
+    unsigned numLevels = d.getNumLevels();
+    unsigned level;
+
+    if (state.level == LodState::NO_LEVEL || state.level > numLevels) {
+        level = getLevel(d, size);
+        state.fade = 1.f;
+    } else {
+        // switch only when the size is past the threshold by more than
+        // the hysteresis, in either direction
+        unsigned finer = getLevel(d, size / (1.f + mHysteresis));
+        unsigned coarser = getLevel(d, size * (1.f + mHysteresis));
+
+        level = state.level;
+        if (finer < level) {
+            level = finer;
+        } else if (coarser > level) {
+            level = coarser;
+        }
+
+        if (level != state.level) {
+            ++mFrameStats.switches;
+            state.previous = state.level;
+            state.fade = 0.f;
+        }
+
+        if (mFadeDuration <= 0.f) {
+            state.fade = 1.f;
+        } else if (state.fade < 1.f && level == state.level) {
+            state.fade = std::min(1.f, state.fade
+                                       + mFrameDelta / mFadeDuration);
+        }
+    }
+    state.level = (uint8_t)level;
+
+    ++mFrameStats.instances;
+    if (level < numLevels) {
+        ++mFrameStats.levels[level];
+    } else {
+        ++mFrameStats.culled;
+    }
+    if (state.fade < 1.f) {
+        ++mFrameStats.fading;
+    }
+
+    return level;
+}
+
+void LodSelector::appendEntries(const LodDrawable& d,
+                                float screenSize,
+                                LodState& state,
+                                uint32_t instance)
+{
+    unsigned numLevels = d.getNumLevels();
+    unsigned level = select(d, screenSize, state);
+
+    if (state.fade < 1.f && state.previous < numLevels) {
+        mEntries.push_back({ instance, state.previous, state.fade - 1.f });
+    }
+    if (level < numLevels) {
+        mEntries.push_back({ instance, (uint8_t)level, state.fade });
+    }
+}
+
+void LodSelector::add(Camera& camera,
+                      LodDrawable& d,
+                      DrawBatcher& batcher)
+{
+    float size = getScreenSize(camera, d.getProjectionType(),
+                               d.getTransform(), d.getRadius());
+
+    mEntries.clear();
+    appendEntries(d, size, d.getState(), 0);
+
+    for (const Entry& e: mEntries) {
+        const Color* color = NULL;
+        if (e.alpha != 1.f) {
+            mColors.push_back(Color(Color::White, e.alpha));
+            color = &mColors.back();
+        }
+
+        batcher.addInstances(d.getLevel(e.level), &d.getTransform(), color,
+                             1);
+    }
+}
+
+void LodSelector::addInstances(Camera& camera,
+                               const LodDrawable& d,
+                               const Mat44* transforms,
+                               const Color* colors,
+                               LodState* states,
+                               size_t count,
+                               InstanceBatcher& batcher)
+{
+    mEntries.clear();
+    for (size_t i = 0; i < count; ++i) {
+        LodState stateless;
+        LodState& state = states ? states[i] : stateless;
+
+        float size = getScreenSize(camera, d.getProjectionType(),
+                                   transforms[i], d.getRadius());
+        appendEntries(d, size, state, (uint32_t)i);
+    }
+
+    // one instanced draw per level
+    for (unsigned level = 0; level < d.getNumLevels(); ++level) {
+        size_t levelCount = 0;
+        bool fading = false;
+        for (const Entry& e: mEntries) {
+            if (e.level == level) {
+                ++levelCount;
+                fading = fading || e.alpha != 1.f;
+            }
+        }
+        if (levelCount == 0) {
+            continue;
+        }
+
+        if (mUsedArrays == mTransformArrays.size()) {
+            mTransformArrays.emplace_back();
+            mColorArrays.emplace_back();
+        }
+        std::vector<Mat44>& levelTransforms = mTransformArrays[mUsedArrays];
+        std::vector<Color>& levelColors = mColorArrays[mUsedArrays];
+        ++mUsedArrays;
+
+        bool withColors = colors || fading;
+        levelTransforms.clear();
+        levelColors.clear();
+        for (const Entry& e: mEntries) {
+            if (e.level != level) {
+                continue;
+            }
+
+            levelTransforms.push_back(transforms[e.instance]);
+            if (withColors) {
+                const Color& c = colors ? colors[e.instance] : Color::White;
+                levelColors.push_back(Color(c, c.a * e.alpha));
+            }
+        }
+
+        batcher.add(d.getLevel(level), levelTransforms.data(),
+                    withColors ? levelColors.data() : NULL, levelCount);
+    }
+}
+
+void LodSelector::endFrame(double frameMs,
+                           double workMs)
+{
+    mFrameDelta = (float)(frameMs / 1000.0);
+    if (mFrameTimeBudget > 0.0 && workMs > 0.0) {
+        adjustBias(workMs);
+    }
+
+    mStats = mFrameStats;
+    mFrameStats = Stats();
+
+    mColors.clear();
+    mUsedArrays = 0;
+}
+
+void LodSelector::adjustBias(double workMs)
+{
+    if (mAverageWorkMs > 0.0) {
+        mAverageWorkMs += (workMs - mAverageWorkMs) * AVERAGE_WEIGHT;
+    } else {
+        mAverageWorkMs = workMs;
+    }
+
+    if (mAverageWorkMs > mFrameTimeBudget) {
+        setBias(mBias + BIAS_STEP);
+    } else if (mAverageWorkMs < mFrameTimeBudget * BUDGET_SLACK
+               && mBias > 0.f) {
+        setBias(std::max(0.f, mBias - BIAS_STEP));
+    }
+}
+
+} // namespace sb
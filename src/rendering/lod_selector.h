@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "rendering/color.h"
+#include "rendering/lod_drawable.h"
+#include "rendering/types.h"
+#include "utils/types.h"
+
+namespace sb {
+
+class Camera;
+class DrawBatcher;
+class InstanceBatcher;
+
+// Picks the level of detail of LodDrawable instances from their projected
+// size and queues the chosen meshes into the batchers.
+//
+// - hysteresis: a level is kept until the size leaves its range by more
+//   than the hysteresis fraction, so instances near a threshold do not
+//   switch back and forth,
+// - bias: sizes are scaled by 2^-bias before selection, positive values
+//   select coarser levels; with a frame time budget the bias is adjusted
+//   automatically, rising while frames take longer than the budget,
+// - cross-fade: after a switch both levels are drawn for the fade
+//   duration, with complementary screen-door patterns. The fade is passed
+//   in the alpha of the instance color (multiplied into vertex colors),
+//   negated for the level being faded out; programs drawing LOD meshes
+//   are expected to discard fragments accordingly, e.g.:
+//
+//     const float BAYER[16] = float[](0.0, 8.0, 2.0, 10.0, 12.0, 4.0,
+//                                     14.0, 6.0, 3.0, 11.0, 1.0, 9.0,
+//                                     15.0, 7.0, 13.0, 5.0);
+//     ivec2 p = ivec2(gl_FragCoord.xy) & 3;
+//     float t = (BAYER[p.y * 4 + p.x] + 0.5) / 16.0;
+//     if (color.a >= 0.0 ? color.a < t : -color.a < 1.0 - t) discard;
+class LodSelector
+{
+public:
+    static const float MAX_BIAS;
+
+    struct Stats
+    {
+        uint32_t instances;
+        uint32_t culled;        // smaller than the last level
+        uint32_t fading;
+        uint32_t switches;
+        uint32_t levels[LodDrawable::MAX_LEVELS];  // instances per level
+    };
+
+    LodSelector();
+    ~LodSelector();
+
+    LodSelector(const LodSelector&) = delete;
+    LodSelector(LodSelector&&) = delete;
+    LodSelector& operator =(const LodSelector&) = delete;
+    LodSelector& operator =(LodSelector&&) = delete;
+
+    // clamped to [-MAX_BIAS, MAX_BIAS]
+    void setBias(float bias);
+    float getBias() const { return mBias; }
+    // fraction of a level's size range, 0 disables hysteresis
+    void setHysteresis(float fraction);
+    float getHysteresis() const { return mHysteresis; }
+    // 0 switches levels immediately
+    void setFadeDuration(float seconds);
+    float getFadeDuration() const { return mFadeDuration; }
+    // 0 leaves the bias alone
+    void setFrameTimeBudget(double milliseconds);
+    double getFrameTimeBudget() const { return mFrameTimeBudget; }
+
+    // projected diameter of the transformed bounding sphere relative to the
+    // viewport height; very large when the eye is inside the sphere
+    float getScreenSize(Camera& camera,
+                        EProjectionType projection,
+                        const Mat44& transform,
+                        float radius) const;
+    // updates state and returns the selected level, d.getNumLevels() if
+    // the instance should not be drawn
+    unsigned select(const LodDrawable& d,
+                    float screenSize,
+                    LodState& state);
+
+    // d must stay alive until the batcher is flushed
+    void add(Camera& camera,
+             LodDrawable& d,
+             DrawBatcher& batcher);
+    // d's transform and state are ignored; states may be NULL, disabling
+    // hysteresis and cross-fading. d and all arrays must stay alive until
+    // the batcher is flushed
+    void addInstances(Camera& camera,
+                      const LodDrawable& d,
+                      const Mat44* transforms,
+                      const Color* colors,
+                      LodState* states,
+                      size_t count,
+                      InstanceBatcher& batcher);
+
+    // call once the batchers were flushed; frameMs advances cross-fades,
+    // workMs (frame time without deliberate waits) drives the bias, 0 for
+    // frames that were not measured
+    void endFrame(double frameMs,
+                  double workMs);
+
+    // statistics of the last finished frame
+    const Stats& getStats() const { return mStats; }
+
+private:
+    struct Entry
+    {
+        uint32_t instance;
+        uint8_t level;
+        float alpha;    // negative while fading out
+    };
+
+    float mBias;
+    float mHysteresis;
+    float mFadeDuration;
+    double mFrameTimeBudget;
+    double mAverageWorkMs;
+    float mFrameDelta;
+
+    // per-instance colors and transforms handed to the batchers, stable
+    // until endFrame()
+    std::deque<Color> mColors;
+    std::deque<std::vector<Mat44>> mTransformArrays;
+    std::deque<std::vector<Color>> mColorArrays;
+    size_t mUsedArrays;
+    std::vector<Entry> mEntries;
+
+    Stats mFrameStats;
+    Stats mStats;
+
+    unsigned getLevel(const LodDrawable& d,
+                      float screenSize) const;
+    void appendEntries(const LodDrawable& d,
+                       float screenSize,
+                       LodState& state,
+                       uint32_t instance);
+    void adjustBias(double workMs);
+};
+
+} // namespace sb
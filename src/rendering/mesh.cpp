@@ -0,0 +1,83 @@
+#include "rendering/mesh.h"
+
+#include <cassert>
+
+namespace sb {
+
+Mesh::Mesh(GLenum shape,
+           const std::vector<Vertex>& vertices,
+           const std::vector<IndexType>& indices):
+    mShape(shape),
+    mVertices(vertices),
+    mIndices(indices)
+{
+    assert(shape == SHAPE_POINTS
+           || shape == SHAPE_LINES
+           || shape == SHAPE_TRIANGLES
+           || shape == SHAPE_QUADS
+           || shape == SHAPE_TRIANGLE_STRIP);
+}
+
+GLenum Mesh::getListShape() const
+{
+    switch (mShape) {
+    case SHAPE_QUADS:
+    case SHAPE_TRIANGLE_STRIP:
+        return SHAPE_TRIANGLES;
+    default:
+        return mShape;
+    }
+}
+
+void Mesh::appendListIndices(IndexType base,
+                             std::vector<IndexType>& out) const
+{
+    // meshes without an index list are drawn in vertex order
+    size_t numIndices = mIndices.empty() ? mVertices.size() : mIndices.size();
+    auto index = [&](size_t i) {
+        return base + (mIndices.empty() ? (IndexType)i : mIndices[i]);
+    };
+
+    switch (mShape) {
+    case SHAPE_QUADS:
+        for (size_t i = 0; i + 3 < numIndices; i += 4) {
+            out.insert(out.end(), {
+                index(i), index(i + 1), index(i + 2),
+                index(i), index(i + 2), index(i + 3)
+            });
+        }
+        break;
+    case SHAPE_TRIANGLE_STRIP:
+        for (size_t i = 0; i + 2 < numIndices; ++i) {
+            // keep winding consistent on odd triangles
+            if (i % 2 == 0) {
+                out.insert(out.end(),
+                           { index(i), index(i + 1), index(i + 2) });
+            } else {
+                out.insert(out.end(),
+                           { index(i + 1), index(i), index(i + 2) });
+            }
+        }
+        break;
+    default:
+        for (size_t i = 0; i < numIndices; ++i) {
+            out.push_back(index(i));
+        }
+        break;
+    }
+}
+
+Mesh Mesh::quad(const Color& color)
+{
+    return Mesh(SHAPE_TRIANGLE_STRIP,
+                {
+                    Vertex(Vec3(-0.5f, -0.5f, 0.f), color, Vec2(0.f, 0.f)),
+                    Vertex(Vec3( 0.5f, -0.5f, 0.f), color, Vec2(1.f, 0.f)),
+                    Vertex(Vec3(-0.5f,  0.5f, 0.f), color, Vec2(0.f, 1.f)),
+                    Vertex(Vec3( 0.5f,  0.5f, 0.f), color, Vec2(1.f, 1.f))
+                },
+                { 0, 1, 2, 3 });
+}
+
+} // namespace sb
+
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "rendering/color.h"
+#include "rendering/types.h"
+#include "utils/types.h"
+
+namespace sb {
+
+struct Vertex
+{
+    Vec3 position;
+    Color color;
+    Vec2 texcoord;
+
+    Vertex() {}
+    Vertex(const Vec3& position,
+           const Color& color = Color::White,
+           const Vec2& texcoord = Vec2(0.f, 0.f)):
+        position(position),
+        color(color),
+        texcoord(texcoord)
+    {}
+};
+
+typedef uint32_t IndexType;
+
+class Mesh
+{
+public:
+    // shape is one of SHAPE_* macros
+    Mesh(GLenum shape,
+         const std::vector<Vertex>& vertices,
+         const std::vector<IndexType>& indices);
+
+    GLenum getShape() const { return mShape; }
+    const std::vector<Vertex>& getVertices() const { return mVertices; }
+    const std::vector<IndexType>& getIndices() const { return mIndices; }
+
+    // primitive the mesh is drawn with when merged with others: quads and
+    // triangle strips become triangle lists
+    GLenum getListShape() const;
+    // appends indices for getListShape(), offset by base
+    void appendListIndices(IndexType base,
+                           std::vector<IndexType>& out) const;
+
+    // unit quad in XY plane, centered at origin
+    static Mesh quad(const Color& color = Color::White);
+
+private:
+    GLenum mShape;
+    std::vector<Vertex> mVertices;
+    std::vector<IndexType> mIndices;
+};
+
+} // namespace sb
+
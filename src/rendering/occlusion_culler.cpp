@@ -0,0 +1,475 @@
+#include "rendering/occlusion_culler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+#include "rendering/camera.h"
+
+namespace sb {
+namespace {
+
+unsigned roundUp(unsigned value,
+                 unsigned multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+// signed distance from the near plane in clip space, inside if >= 0
+float nearDistance(const Vec4& v)
+{
+    return v.z + v.w;
+}
+
+} // namespace
+
+const unsigned OcclusionCuller::TILE_WIDTH;
+const unsigned OcclusionCuller::TILE_HEIGHT;
+
+OcclusionCuller::OcclusionCuller(unsigned width,
+                                 unsigned height,
+                                 unsigned threads):
+    mWidth(roundUp(std::max(width, 1u), TILE_WIDTH)),
+    mHeight(roundUp(std::max(height, 1u), TILE_HEIGHT)),
+    mTilesX(mWidth / TILE_WIDTH),
+    mTilesY(mHeight / TILE_HEIGHT),
+    mViewProjection(1.f),
+    mTriangles(),
+    mBins(mTilesX * mTilesY),
+    mLevels(),
+    mLevelWidths(),
+    mLevelHeights(),
+    mIndexScratch(),
+    mClipScratch(),
+    mWorkers(),
+    mMutex(),
+    mWake(),
+    mDone(),
+    mGeneration(0),
+    mBusyWorkers(0),
+    mQuit(false),
+    mNextTile(0),
+    mStats()
+{
+    unsigned w = mWidth;
+    unsigned h = mHeight;
+    for (;;) {
+        mLevels.push_back(std::vector<float>(w * h, 1.f));
+        mLevelWidths.push_back(w);
+        mLevelHeights.push_back(h);
+        if (w == 1 && h == 1) {
+            break;
+        }
+        w = std::max(1u, (w + 1) / 2);
+        h = std::max(1u, (h + 1) / 2);
+    }
+
+    // the calling thread rasterizes tiles too
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::min(threads, mTilesX * mTilesY);
+    for (unsigned i = 1; i < threads; ++i) {
+        mWorkers.push_back(std::thread(&OcclusionCuller::workerLoop, this));
+    }
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQuit = true;
+    }
+    mWake.notify_all();
+
+    for (std::thread& worker: mWorkers) {
+        worker.join();
+    }
+}
+
+void OcclusionCuller::beginFrame(Camera& camera)
+{
+    beginFrame(camera.getViewProjectionMatrix(ProjectionPerspective));
+}
+
+void OcclusionCuller::beginFrame(const Mat44& viewProjection)
+{
+    mViewProjection = viewProjection;
+    mTriangles.clear();
+    for (std::vector<uint32_t>& bin: mBins) {
+        bin.clear();
+    }
+    mStats = Stats();
+}
+
+void OcclusionCuller::addOccluder(const Mesh& mesh,
+                                  const Mat44& transform)
+{
+    if (mesh.getListShape() != GL_TRIANGLES) {
+        return;
+    }
+
+    Mat44 mvp = simd::multiply(mViewProjection, transform);
+
+    const std::vector<Vertex>& vertices = mesh.getVertices();
+    mClipScratch.clear();
+    for (const Vertex& v: vertices) {
+        mClipScratch.push_back(simd::transform(mvp,
+                                               Vec4(v.position.x, v.position.y,
+                                                    v.position.z, 1.f)));
+    }
+
+    mIndexScratch.clear();
+    mesh.appendListIndices(0, mIndexScratch);
+
+    for (size_t i = 0; i + 2 < mIndexScratch.size(); i += 3) {
+        Vec4 clip[3] = {
+            mClipScratch[mIndexScratch[i]],
+            mClipScratch[mIndexScratch[i + 1]],
+            mClipScratch[mIndexScratch[i + 2]]
+        };
+        addTriangle(clip);
+    }
+
+    ++mStats.occluders;
+}
+
+// clips against the near plane, the only one that matters for the
+// perspective divide; the rest is handled by the bounding box clamp
+void OcclusionCuller::addTriangle(const Vec4* clip)
+{
+    float dist[3];
+    unsigned inside = 0;
+    for (unsigned i = 0; i < 3; ++i) {
+        dist[i] = nearDistance(clip[i]);
+        inside += (dist[i] >= 0.f) ? 1 : 0;
+    }
+
+    if (inside == 3) {
+        setupTriangle(clip);
+        return;
+    }
+    if (inside == 0) {
+        return;
+    }
+
+    Vec4 polygon[4];
+    unsigned count = 0;
+    for (unsigned i = 0; i < 3; ++i) {
+        unsigned next = (i + 1) % 3;
+        if (dist[i] >= 0.f) {
+            polygon[count++] = clip[i];
+        }
+        if ((dist[i] >= 0.f) != (dist[next] >= 0.f)) {
+            float t = dist[i] / (dist[i] - dist[next]);
+            polygon[count++] = clip[i] + (clip[next] - clip[i]) * t;
+        }
+    }
+
+    for (unsigned i = 1; i + 1 < count; ++i) {
+        Vec4 fan[3] = { polygon[0], polygon[i], polygon[i + 1] };
+        setupTriangle(fan);
+    }
+}
+
+void OcclusionCuller::setupTriangle(const Vec4* clip)
+{
+    float x[3];
+    float y[3];
+    float z[3];
+    for (unsigned i = 0; i < 3; ++i) {
+        float invW = 1.f / clip[i].w;
+        x[i] = (clip[i].x * invW * 0.5f + 0.5f) * (float)mWidth;
+        y[i] = (clip[i].y * invW * 0.5f + 0.5f) * (float)mHeight;
+        z[i] = clip[i].z * invW * 0.5f + 0.5f;
+    }
+
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area <= 0.f) {
+        // back-facing or degenerate
+        return;
+    }
+
+    // pixels whose centers fall into the bounding box
+    float boxMinX = std::min(x[0], std::min(x[1], x[2]));
+    float boxMaxX = std::max(x[0], std::max(x[1], x[2]));
+    float boxMinY = std::min(y[0], std::min(y[1], y[2]));
+    float boxMaxY = std::max(y[0], std::max(y[1], y[2]));
+
+    Triangle t;
+    t.minX = std::max(0, (int)std::ceil(boxMinX - 0.5f));
+    t.maxX = std::min((int)mWidth - 1, (int)std::floor(boxMaxX - 0.5f));
+    t.minY = std::max(0, (int)std::ceil(boxMinY - 0.5f));
+    t.maxY = std::min((int)mHeight - 1, (int)std::floor(boxMaxY - 0.5f));
+    if (t.minX > t.maxX || t.minY > t.maxY) {
+        return;
+    }
+
+    for (unsigned i = 0; i < 3; ++i) {
+        unsigned j = (i + 1) % 3;
+        float a = y[i] - y[j];
+        float b = x[j] - x[i];
+        t.edges[i][0] = a;
+        t.edges[i][1] = b;
+        t.edges[i][2] = -(a * x[i] + b * y[i]);
+    }
+
+    t.depth[0] = ((z[1] - z[0]) * (y[2] - y[0])
+                  - (z[2] - z[0]) * (y[1] - y[0])) / area;
+    t.depth[1] = ((z[2] - z[0]) * (x[1] - x[0])
+                  - (z[1] - z[0]) * (x[2] - x[0])) / area;
+    t.depth[2] = z[0] - t.depth[0] * x[0] - t.depth[1] * y[0];
+
+    uint32_t index = (uint32_t)mTriangles.size();
+    mTriangles.push_back(t);
+    ++mStats.triangles;
+
+    for (unsigned ty = t.minY / TILE_HEIGHT; ty <= t.maxY / TILE_HEIGHT; ++ty) {
+        for (unsigned tx = t.minX / TILE_WIDTH; tx <= t.maxX / TILE_WIDTH;
+                ++tx) {
+            mBins[ty * mTilesX + tx].push_back(index);
+        }
+    }
+}
+
+void OcclusionCuller::rasterize()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    mNextTile = 0;
+    if (!mWorkers.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            ++mGeneration;
+            mBusyWorkers = (unsigned)mWorkers.size();
+        }
+        mWake.notify_all();
+    }
+
+    rasterizeTiles();
+
+    if (!mWorkers.empty()) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mDone.wait(lock, [this] { return mBusyWorkers == 0; });
+    }
+
+    buildPyramid();
+
+    mStats.rasterMs = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+void OcclusionCuller::workerLoop()
+{
+    uint64_t seen = 0;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWake.wait(lock, [&] { return mQuit || mGeneration != seen; });
+            if (mQuit) {
+                return;
+            }
+            seen = mGeneration;
+        }
+
+        rasterizeTiles();
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (--mBusyWorkers == 0) {
+            mDone.notify_one();
+        }
+    }
+}
+
+void OcclusionCuller::rasterizeTiles()
+{
+    const unsigned numTiles = mTilesX * mTilesY;
+    for (unsigned tile = mNextTile++; tile < numTiles; tile = mNextTile++) {
+        rasterizeTile(tile);
+    }
+}
+
+// keeps the nearest depth of each pixel; tiles are disjoint, so no
+// synchronization is needed
+void OcclusionCuller::rasterizeTile(unsigned tile)
+{
+    const int tileX = (int)((tile % mTilesX) * TILE_WIDTH);
+    const int tileY = (int)((tile / mTilesX) * TILE_HEIGHT);
+    float* depth = mLevels[0].data();
+
+    for (int y = tileY; y < tileY + (int)TILE_HEIGHT; ++y) {
+        std::fill(depth + y * mWidth + tileX,
+                  depth + y * mWidth + tileX + TILE_WIDTH, 1.f);
+    }
+
+    for (uint32_t index: mBins[tile]) {
+        const Triangle& t = mTriangles[index];
+
+        // rows are processed in aligned groups of 4 pixels, tiles are
+        // multiples of 4 wide
+        int minX = std::max(t.minX, tileX) & ~3;
+        int maxX = std::min(t.maxX, tileX + (int)TILE_WIDTH - 1);
+        int minY = std::max(t.minY, tileY);
+        int maxY = std::min(t.maxY, tileY + (int)TILE_HEIGHT - 1);
+
+        for (int y = minY; y <= maxY; ++y) {
+            float py = (float)y + 0.5f;
+            float e0 = t.edges[0][1] * py + t.edges[0][2];
+            float e1 = t.edges[1][1] * py + t.edges[1][2];
+            float e2 = t.edges[2][1] * py + t.edges[2][2];
+            float zRow = t.depth[1] * py + t.depth[2];
+            float* row = depth + y * mWidth;
+
+#if defined(__SSE2__)
+            const __m128 a0 = _mm_set1_ps(t.edges[0][0]);
+            const __m128 a1 = _mm_set1_ps(t.edges[1][0]);
+            const __m128 a2 = _mm_set1_ps(t.edges[2][0]);
+            const __m128 dzdx = _mm_set1_ps(t.depth[0]);
+            const __m128 zero = _mm_setzero_ps();
+
+            for (int x = minX; x <= maxX; x += 4) {
+                __m128 px = _mm_add_ps(_mm_set1_ps((float)x),
+                                       _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f));
+                __m128 inside = _mm_and_ps(
+                        _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px),
+                                                _mm_set1_ps(e0)), zero),
+                        _mm_and_ps(
+                            _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px),
+                                                    _mm_set1_ps(e1)), zero),
+                            _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px),
+                                                    _mm_set1_ps(e2)), zero)));
+                if (_mm_movemask_ps(inside) == 0) {
+                    continue;
+                }
+
+                __m128 z = _mm_add_ps(_mm_mul_ps(dzdx, px),
+                                      _mm_set1_ps(zRow));
+                __m128 old = _mm_loadu_ps(row + x);
+                __m128 nearest = _mm_min_ps(old, z);
+                _mm_storeu_ps(row + x,
+                              _mm_or_ps(_mm_and_ps(inside, nearest),
+                                        _mm_andnot_ps(inside, old)));
+            }
+#else
+            for (int x = minX; x <= maxX; ++x) {
+                float px = (float)x + 0.5f;
+                if (t.edges[0][0] * px + e0 >= 0.f
+                        && t.edges[1][0] * px + e1 >= 0.f
+                        && t.edges[2][0] * px + e2 >= 0.f) {
+                    row[x] = std::min(row[x], t.depth[0] * px + zRow);
+                }
+            }
+#endif
+        }
+    }
+}
+
+void OcclusionCuller::buildPyramid()
+{
+    for (size_t level = 1; level < mLevels.size(); ++level) {
+        const std::vector<float>& src = mLevels[level - 1];
+        std::vector<float>& dst = mLevels[level];
+        unsigned srcWidth = mLevelWidths[level - 1];
+        unsigned srcHeight = mLevelHeights[level - 1];
+        unsigned width = mLevelWidths[level];
+        unsigned height = mLevelHeights[level];
+
+        for (unsigned y = 0; y < height; ++y) {
+            unsigned y0 = std::min(2 * y, srcHeight - 1);
+            unsigned y1 = std::min(2 * y + 1, srcHeight - 1);
+
+            for (unsigned x = 0; x < width; ++x) {
+                unsigned x0 = std::min(2 * x, srcWidth - 1);
+                unsigned x1 = std::min(2 * x + 1, srcWidth - 1);
+
+                dst[y * width + x] = std::max(
+                        std::max(src[y0 * srcWidth + x0],
+                                 src[y0 * srcWidth + x1]),
+                        std::max(src[y1 * srcWidth + x0],
+                                 src[y1 * srcWidth + x1]));
+            }
+        }
+    }
+}
+
+bool OcclusionCuller::isVisible(const AABB& box)
+{
+    ++mStats.tested;
+
+    float minX = (float)mWidth;
+    float maxX = 0.f;
+    float minY = (float)mHeight;
+    float maxY = 0.f;
+    float minZ = 1.f;
+    unsigned behindNear = 0;
+
+    for (unsigned i = 0; i < 8; ++i) {
+        Vec4 corner((i & 1) ? box.max.x : box.min.x,
+                    (i & 2) ? box.max.y : box.min.y,
+                    (i & 4) ? box.max.z : box.min.z,
+                    1.f);
+        Vec4 clip = simd::transform(mViewProjection, corner);
+
+        if (nearDistance(clip) < 0.f || clip.w <= 0.f) {
+            ++behindNear;
+            continue;
+        }
+
+        float invW = 1.f / clip.w;
+        float x = (clip.x * invW * 0.5f + 0.5f) * (float)mWidth;
+        float y = (clip.y * invW * 0.5f + 0.5f) * (float)mHeight;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        minZ = std::min(minZ, clip.z * invW * 0.5f + 0.5f);
+    }
+
+    // entirely behind the near plane; crossing it, cannot be projected
+    // reliably
+    if (behindNear == 8) {
+        return false;
+    } else if (behindNear > 0) {
+        return true;
+    }
+
+    if (maxX < 0.f || maxY < 0.f || minX >= (float)mWidth
+            || minY >= (float)mHeight || minZ >= 1.f) {
+        return false;
+    }
+
+    int x0 = std::max(0, (int)minX);
+    int x1 = std::min((int)mWidth - 1, (int)maxX);
+    int y0 = std::max(0, (int)minY);
+    int y1 = std::min((int)mHeight - 1, (int)maxY);
+
+    // coarsest level at which the rectangle spans at most 2x2 texels, or
+    // 3x3 when not aligned
+    size_t level = 0;
+    while (level + 1 < mLevels.size()
+            && std::max(x1 - x0, y1 - y0) >> level > 1) {
+        ++level;
+    }
+
+    const std::vector<float>& hiZ = mLevels[level];
+    unsigned width = mLevelWidths[level];
+    float farthest = 0.f;
+    for (int y = y0 >> level; y <= y1 >> level; ++y) {
+        for (int x = x0 >> level; x <= x1 >> level; ++x) {
+            farthest = std::max(farthest, hiZ[y * width + x]);
+        }
+    }
+
+    if (minZ > farthest) {
+        ++mStats.occluded;
+        return false;
+    }
+    return true;
+}
+
+} // namespace sb
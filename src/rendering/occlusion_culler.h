@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "rendering/aabb_tree.h"
+#include "rendering/mesh.h"
+#include "utils/types.h"
+
+namespace sb {
+
+class Camera;
+
+// Software occlusion culling, entirely on the CPU. A few large occluder
+// meshes are rasterized into a small depth buffer, split into tiles that
+// worker threads fill in parallel, 4 pixels at a time with SSE when
+// available. The buffer is then reduced into a Hi-Z pyramid (farthest depth
+// of each 2x2 block) that occludee bounding boxes are tested against.
+//
+// Coverage is sampled at pixel centers, so occluder edges may hide objects
+// seen through less than a pixel.
+class OcclusionCuller
+{
+public:
+    static const unsigned TILE_WIDTH = 64;
+    static const unsigned TILE_HEIGHT = 32;
+
+    struct Stats
+    {
+        uint32_t occluders;
+        uint32_t triangles;     // after back-face culling and clipping
+        uint32_t tested;
+        uint32_t occluded;
+        double rasterMs;        // binning, rasterization and pyramid
+    };
+
+    // width and height are rounded up to whole tiles; threads = 0 uses one
+    // per hardware thread, the calling thread included
+    OcclusionCuller(unsigned width = 256,
+                    unsigned height = 128,
+                    unsigned threads = 0);
+    ~OcclusionCuller();
+
+    OcclusionCuller(const OcclusionCuller&) = delete;
+    OcclusionCuller(OcclusionCuller&&) = delete;
+    OcclusionCuller& operator =(const OcclusionCuller&) = delete;
+    OcclusionCuller& operator =(OcclusionCuller&&) = delete;
+
+    // forgets occluders of the previous frame, uses the camera's
+    // perspective view-projection
+    void beginFrame(Camera& camera);
+    void beginFrame(const Mat44& viewProjection);
+
+    // only triangle meshes (after getListShape()) are used; front faces are
+    // counter-clockwise
+    void addOccluder(const Mesh& mesh,
+                     const Mat44& transform);
+    // rasterizes all occluders and builds the pyramid, call before testing
+    void rasterize();
+
+    // false if box is off-screen or hidden behind occluders
+    bool isVisible(const AABB& box);
+
+    unsigned getWidth() const { return mWidth; }
+    unsigned getHeight() const { return mHeight; }
+    // window-space depth in [0, 1], row-major, bottom row first
+    const float* getDepth() const { return mLevels[0].data(); }
+
+    const Stats& getStats() const { return mStats; }
+
+private:
+    struct Triangle
+    {
+        // edge functions a*x + b*y + c, positive inside
+        float edges[3][3];
+        // depth plane z = a*x + b*y + c
+        float depth[3];
+        int minX, minY, maxX, maxY;
+    };
+
+    unsigned mWidth;
+    unsigned mHeight;
+    unsigned mTilesX;
+    unsigned mTilesY;
+    Mat44 mViewProjection;
+
+    std::vector<Triangle> mTriangles;
+    std::vector<std::vector<uint32_t>> mBins;
+    // level 0 is the depth buffer, each next one has half the size
+    std::vector<std::vector<float>> mLevels;
+    std::vector<unsigned> mLevelWidths;
+    std::vector<unsigned> mLevelHeights;
+    std::vector<IndexType> mIndexScratch;
+    std::vector<Vec4> mClipScratch;
+
+    std::vector<std::thread> mWorkers;
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mDone;
+    uint64_t mGeneration;
+    unsigned mBusyWorkers;
+    bool mQuit;
+    std::atomic<unsigned> mNextTile;
+
+    Stats mStats;
+
+    void addTriangle(const Vec4* clip);
+    void setupTriangle(const Vec4* clip);
+    void workerLoop();
+    void rasterizeTiles();
+    void rasterizeTile(unsigned tile);
+    void buildPyramid();
+};
+
+} // namespace sb
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cstring>
 
 #include "rendering/renderer.h"
 #include "utils/gl.h"
@@ -16,6 +17,16 @@ typedef GLXContext (*GLXCREATECTXATTRSARBPROC)(::Display*,
                                                GLXContext,
                                                Bool,
                                                const int*);
+// swap interval control, Renderer::setPresentMode
+typedef void (*GLXSWAPINTERVALEXTPROC)(::Display*,
+                                       GLXDrawable,
+                                       int);
+typedef int (*GLXSWAPINTERVALMESAPROC)(unsigned);
+
+// GLX_EXT_buffer_age, Renderer::drawAll
+#ifndef GLX_BACK_BUFFER_AGE_EXT
+# define GLX_BACK_BUFFER_AGE_EXT 0x20F4
+#endif
 
 namespace sb {
 
@@ -24,25 +35,43 @@ class NativeContextHandle
 public:
     ::Display *const display;
     const ::Window window;
+    const GLXPbuffer pbuffer;   // used instead of window if headless
     const GLXContext glContext;
+    // shares objects with glContext, NULL if not requested or unavailable
+    const GLXContext loaderContext;
 
     static std::shared_ptr<NativeContextHandle>
-    create(const NativeWindowHandle &window);
+    create(const NativeWindowHandle &window,
+           bool withLoaderContext);
 
     ~NativeContextHandle();
 
+    bool hasExtension(const char* name) const;
+    // negative interval: swap immediately if the previous swap was late
+    bool setSwapInterval(int interval) const;
+    // binds loaderContext to (or releases it from) the calling thread
+    bool makeLoaderCurrent(bool current) const;
+    // frames since the back buffer contents were presented, 0 if unknown;
+    // requires GLX_EXT_buffer_age
+    unsigned getBufferAge() const;
+
 private:
     NativeContextHandle(::Display *dpy,
                         ::Window wnd,
-                        GLXContext ctx):
+                        GLXPbuffer pbuf,
+                        GLXContext ctx,
+                        GLXContext loaderCtx):
         display(dpy),
         window(wnd),
-        glContext(ctx)
+        pbuffer(pbuf),
+        glContext(ctx),
+        loaderContext(loaderCtx)
     {}
 };
 
 std::shared_ptr<NativeContextHandle>
-NativeContextHandle::create(const NativeWindowHandle &handle)
+NativeContextHandle::create(const NativeWindowHandle &handle,
+                            bool withLoaderContext)
 {
     ::Display* dpy = handle.display;
     ::Window wnd = handle.window;
@@ -52,6 +81,10 @@ NativeContextHandle::create(const NativeWindowHandle &handle)
     int ctxAttribs[] = {
         GLX_CONTEXT_MAJOR_VERSION_ARB, 3,
         GLX_CONTEXT_MINOR_VERSION_ARB, 0,
+#ifdef GL_CHECK_ASYNC
+        // errors are reported through the debug output callback
+        GLX_CONTEXT_FLAGS_ARB, GLX_CONTEXT_DEBUG_BIT_ARB,
+#endif
         None
     };
 
@@ -67,22 +100,118 @@ NativeContextHandle::create(const NativeWindowHandle &handle)
     GLXContext ctx = glXCreateContextAttribsARB(dpy, fbc, 0, True, ctxAttribs);
     if (!ctx) {
         gLog.err("glXCreateContextAttribsARB failed\n");
-        return false;
+        return {};
     }
 
-    glXMakeCurrent(dpy, wnd, ctx);
+    GLXPbuffer pbuf = None;
+    if (handle.isHeadless()) {
+        // rendering goes to an FBO, the pbuffer only has to exist for the
+        // context to be made current
+        static const int PBUFFER_ATTRIBS[] = {
+            GLX_PBUFFER_WIDTH,  1,
+            GLX_PBUFFER_HEIGHT, 1,
+            None
+        };
 
-    auto ret = new NativeContextHandle(dpy, wnd, ctx);
+        pbuf = glXCreatePbuffer(dpy, fbc, PBUFFER_ATTRIBS);
+        if (!pbuf) {
+            gLog.err("glXCreatePbuffer failed\n");
+            glXDestroyContext(dpy, ctx);
+            return {};
+        }
+
+        glXMakeContextCurrent(dpy, pbuf, pbuf, ctx);
+    } else {
+        glXMakeCurrent(dpy, wnd, ctx);
+    }
+
+    GLXContext loaderCtx = NULL;
+    if (withLoaderContext) {
+        loaderCtx = glXCreateContextAttribsARB(dpy, fbc, ctx, True,
+                                               ctxAttribs);
+        if (!loaderCtx) {
+            gLog.warn("cannot create loader GL context\n");
+        }
+    }
+
+    auto ret = new NativeContextHandle(dpy, wnd, pbuf, ctx, loaderCtx);
     return std::shared_ptr<NativeContextHandle>(ret);
 }
 
 NativeContextHandle::~NativeContextHandle()
 {
+    if (loaderContext) {
+        glXDestroyContext(display, loaderContext);
+    }
     if (glContext) {
         glXMakeCurrent(display, 0, 0);
         glXDestroyContext(display, glContext);
         gLog.info("GL context deleted\n");
     }
+    if (pbuffer) {
+        glXDestroyPbuffer(display, pbuffer);
+    }
+}
+
+bool NativeContextHandle::hasExtension(const char* name) const
+{
+    const char* extensions = glXQueryExtensionsString(display,
+                                                      DefaultScreen(display));
+    size_t length = strlen(name);
+
+    // names may be prefixes of other names, match whole words only
+    for (const char* p = extensions; p && (p = strstr(p, name)); p += length) {
+        bool startsWord = (p == extensions || p[-1] == ' ');
+        bool endsWord = (p[length] == ' ' || p[length] == '\0');
+        if (startsWord && endsWord) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool NativeContextHandle::setSwapInterval(int interval) const
+{
+    if (hasExtension("GLX_EXT_swap_control")) {
+        GLXSWAPINTERVALEXTPROC glXSwapIntervalEXT =
+                (GLXSWAPINTERVALEXTPROC)glXGetProcAddress(
+                    (GLubyte*)"glXSwapIntervalEXT");
+        if (glXSwapIntervalEXT) {
+            glXSwapIntervalEXT(display, window, interval);
+            return true;
+        }
+    }
+
+    // MESA variant knows no late swaps
+    if (interval >= 0 && hasExtension("GLX_MESA_swap_control")) {
+        GLXSWAPINTERVALMESAPROC glXSwapIntervalMESA =
+                (GLXSWAPINTERVALMESAPROC)glXGetProcAddress(
+                    (GLubyte*)"glXSwapIntervalMESA");
+        if (glXSwapIntervalMESA) {
+            return glXSwapIntervalMESA((unsigned)interval) == 0;
+        }
+    }
+
+    return false;
+}
+
+bool NativeContextHandle::makeLoaderCurrent(bool current) const
+{
+    if (!loaderContext) {
+        return false;
+    }
+
+    // GL 3.0 contexts may be current without a drawable, the loader never
+    // draws anything
+    return glXMakeContextCurrent(display, None, None,
+                                 current ? loaderContext : NULL) == True;
+}
+
+unsigned NativeContextHandle::getBufferAge() const
+{
+    unsigned age = 0;
+    glXQueryDrawable(display, window, GLX_BACK_BUFFER_AGE_EXT, &age);
+    return age;
 }
 
 } // namespace sb
@@ -130,11 +259,24 @@ bool Renderer::initGLEW()
         FUNC_REQ(glBindBuffer, 0),
         FUNC_OPT(glCopyBufferSubData, "in-GPU copying no available, will use RAM\n"), // if present, GL_COPY_READ_BUFFER & GL_COPY_WRITE_BUFFER should be available too
         FUNC_REQ(glBufferSubData, 0),
+        FUNC_REQ(glMapBufferRange, 0),
+        FUNC_REQ(glFlushMappedBufferRange, 0),
+        FUNC_REQ(glUnmapBuffer, 0),
+        FUNC_OPT(glBufferStorage, "persistent mapping not available, will map unsynchronized\n"),
+        FUNC_OPT(glFenceSync, "sync objects not available, will orphan streamed buffers\n"),
+        FUNC_OPT(glClientWaitSync, 0),
+        FUNC_OPT(glDeleteSync, 0),
         FUNC_REQ(glGetBufferParameteriv, 0),
         FUNC_REQ(glActiveTexture, 0),
+        FUNC_REQ(glTexSubImage2D, 0),
+        FUNC_REQ(glReadPixels, 0),
         FUNC_OPT(glGenerateMipmap, "will use glGenerateMipmapEXT if available\n"),
         FUNC_OPT(glGenerateMipmapEXT, "bye bye mipmaps :(\n"),
         FUNC_REQ(glDrawElements, 0),
+        FUNC_OPT(glDrawElementsInstanced, "will use glDrawElementsInstancedARB if available\n"),
+        FUNC_OPT(glDrawElementsInstancedARB, "instanced drawing not available, will batch\n"),
+        FUNC_OPT(glVertexAttribDivisor, "will use glVertexAttribDivisorARB if available\n"),
+        FUNC_OPT(glVertexAttribDivisorARB, "instanced arrays not available, will batch\n"),
         FUNC_REQ(glUseProgram, 0),
         FUNC_REQ(glCreateProgram, 0),
         FUNC_REQ(glLinkProgram, 0),
@@ -144,13 +286,49 @@ bool Renderer::initGLEW()
         FUNC_REQ(glCompileShader, 0),
         FUNC_REQ(glAttachShader, 0),
         FUNC_REQ(glDeleteShader, 0),
+        FUNC_REQ(glGetShaderiv, 0),
+        FUNC_REQ(glGetShaderInfoLog, 0),
+        FUNC_REQ(glGetProgramiv, 0),
+        FUNC_REQ(glGetProgramInfoLog, 0),
+        FUNC_OPT(glGetProgramBinary, "shader binaries will not be cached\n"),
+        FUNC_OPT(glProgramBinary, 0),
+        FUNC_OPT(glProgramParameteri, 0),
         FUNC_REQ(glDrawElements, 0),
         FUNC_REQ(glUniform1iv, 0),
         FUNC_REQ(glUniform1fv, 0),
         FUNC_REQ(glUniform2fv, 0),
         FUNC_REQ(glUniform3fv, 0),
         FUNC_REQ(glUniform4fv, 0),
-        FUNC_REQ(glUniformMatrix4fv, 0)
+        FUNC_REQ(glUniformMatrix4fv, 0),
+        FUNC_REQ(glGetUniformLocation, 0),
+        FUNC_OPT(glGetUniformBlockIndex, "uniform buffers not available\n"),
+        FUNC_OPT(glUniformBlockBinding, 0),
+        FUNC_OPT(glBindBufferRange, 0),
+        FUNC_OPT(glQueryCounter, "GPU profiling not available\n"),
+        FUNC_OPT(glGetQueryObjectui64v, 0),
+        FUNC_OPT(glGenFramebuffers, "headless rendering not available\n"),
+        FUNC_OPT(glDeleteFramebuffers, 0),
+        FUNC_OPT(glBindFramebuffer, 0),
+        FUNC_OPT(glFramebufferRenderbuffer, 0),
+        FUNC_OPT(glGenRenderbuffers, 0),
+        FUNC_OPT(glDeleteRenderbuffers, 0),
+        FUNC_OPT(glRenderbufferStorage, 0),
+        FUNC_OPT(glFramebufferTexture2D, "render passes can only draw to the back buffer\n"),
+        FUNC_OPT(glCheckFramebufferStatus, 0),
+        FUNC_OPT(glBlitFramebuffer, "dynamic resolution not available\n"),
+        FUNC_OPT(glDrawBuffers, 0),
+        FUNC_REQ(glClearBufferfv, 0),
+        FUNC_REQ(glClearBufferfi, 0),
+        FUNC_OPT(glInvalidateFramebuffer, "dead attachments will not be invalidated\n"),
+        FUNC_OPT(glInvalidateTexImage, 0),
+        FUNC_OPT(glTexStorage2D, 0),
+        FUNC_OPT(glMultiDrawElementsIndirect, "static geometry will be baked per object\n"),
+        FUNC_OPT(glMultiDrawElements, 0),
+#ifdef GL_CHECK_ASYNC
+        FUNC_OPT(glDebugMessageCallback, "will use glDebugMessageCallbackARB if available\n"),
+        FUNC_OPT(glDebugMessageCallbackARB, "GL errors will not be reported\n"),
+#endif
+        FUNC_REQ(glBufferData, 0)
 #undef FUNC_OPT
 #undef FUNC_REQ
     };
@@ -181,46 +359,632 @@ bool Renderer::initGLEW()
 }
 
 Renderer::Renderer():
-    mContext(NULL)
+    mContext(NULL),
+    mHeadless(false),
+    mOffscreenFramebuffer(0),
+    mOffscreenColor(0),
+    mOffscreenDepth(0),
+    mViewport(),
+    mScalingSupported(false),
+    mUpscaleFramebuffer(0),
+    mGLState(),
+    mResources(),
+    mLoader(),
+    mProfiler(),
+    mFramePacer(),
+    mWorkStart(std::chrono::steady_clock::now()),
+    mShaderCache(),
+    mTextureAtlas(),
+    mFrameCapture(),
+    mCamera(),
+    mStreamBuffer(),
+    mFrameUniforms(),
+    mBatcher(),
+    mInstanceBatcher(),
+    mStaticBatcher(),
+    mLodSelector(),
+    mResolutionScaler(),
+    mFrameGraph(),
+    mScenePassAdded(false),
+    mScenePasses(0),
+    mSceneSize(),
+    mClearColor(Color::Black),
+    mDamage(),
+    mRedrawOnDemand(false),
+    mPartialRedraw(false),
+    mBufferAgeSupported(false),
+    mFrameSkipped(false),
+    mPartialFrame(false),
+    mPartialRect()
+{
+}
+
+Renderer::~Renderer()
 {
+    if (!mContext) {
+        return;
+    }
+
+    if (mOffscreenFramebuffer) {
+        glDeleteFramebuffers(1, &mOffscreenFramebuffer);
+        glDeleteRenderbuffers(1, &mOffscreenColor);
+        glDeleteRenderbuffers(1, &mOffscreenDepth);
+    }
+    if (mUpscaleFramebuffer) {
+        glDeleteFramebuffers(1, &mUpscaleFramebuffer);
+    }
 }
 
-bool Renderer::init(const NativeWindowHandle& handle)
+bool Renderer::init(const NativeWindowHandle& handle,
+                    bool backgroundLoading)
 {
     assert(handle.display);
-    mContext = NativeContextHandle::create(handle);
+    mContext = NativeContextHandle::create(handle, backgroundLoading);
+    if (!mContext) {
+        return false;
+    }
 
     if (!initGLEW()) {
         return false;
     }
 
-    GL_CHECK(glEnable(GL_DEPTH_TEST));
-    GL_CHECK(glDepthFunc(GL_LESS));
+#ifdef GL_CHECK_ASYNC
+    utils::installDebugCallback();
+#endif
+    GL_DEBUG_SCOPE("Renderer::init");
+
+    mGLState.enable(GL_DEPTH_TEST);
+    mGLState.depthFunc(GL_LESS);
+
+    mGLState.enable(GL_CULL_FACE);
+    mGLState.cullFace(GL_BACK);
+
+    mGLState.enable(GL_BLEND);
+    mGLState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    mGLState.enable(GL_TEXTURE_2D);
+
+    if (handle.isHeadless()
+            && !initOffscreenTarget(handle.width, handle.height)) {
+        return false;
+    }
+
+    mResources.init(mGLState);
+
+    ResourceLoader::LoaderContextFunc loaderContext;
+    if (mContext->loaderContext) {
+        std::shared_ptr<const NativeContextHandle> context = mContext;
+        loaderContext = [context](bool current) {
+            return context->makeLoaderCurrent(current);
+        };
+    }
+    mLoader.init(mGLState, mResources, loaderContext);
+
+    mProfiler.init();
+    mShaderCache.init();
+    mTextureAtlas.init(mGLState);
+    mFrameCapture.init(mGLState);
+
+    if (!mStreamBuffer.init(mGLState)) {
+        gLog.err("cannot initialize stream buffer\n");
+        return false;
+    }
+
+    mFrameUniforms.init(mGLState, mStreamBuffer);
+
+    if (!mBatcher.init(mGLState, mStreamBuffer)) {
+        gLog.err("cannot initialize draw batcher\n");
+        return false;
+    }
+
+    if (!mInstanceBatcher.init(mGLState, mStreamBuffer, mBatcher)) {
+        gLog.err("cannot initialize instance batcher\n");
+        return false;
+    }
 
-    GL_CHECK(glEnable(GL_CULL_FACE));
-    GL_CHECK(glCullFace(GL_BACK));
+    if (!mStaticBatcher.init(mGLState)) {
+        gLog.err("cannot initialize static batcher\n");
+        return false;
+    }
 
-    GL_CHECK(glEnable(GL_BLEND));
-    GL_CHECK(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+    mFrameGraph.init(mGLState, mOffscreenFramebuffer);
+    mScalingSupported = glGenFramebuffers && glFramebufferTexture2D
+                        && glBlitFramebuffer;
+    mBufferAgeSupported = !mHeadless
+                          && mContext->hasExtension("GLX_EXT_buffer_age");
+    return true;
+}
 
-    GL_CHECK(glEnable(GL_TEXTURE_2D));
+bool Renderer::initOffscreenTarget(unsigned width,
+                                   unsigned height)
+{
+    gLog.info("creating %ux%u offscreen target\n", width, height);
+
+    GL_CHECK_RET(glGenRenderbuffers(1, &mOffscreenColor), false);
+    GL_CHECK(glBindRenderbuffer(GL_RENDERBUFFER, mOffscreenColor));
+    GL_CHECK(glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height));
+
+    GL_CHECK_RET(glGenRenderbuffers(1, &mOffscreenDepth), false);
+    GL_CHECK(glBindRenderbuffer(GL_RENDERBUFFER, mOffscreenDepth));
+    GL_CHECK(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8,
+                                   width, height));
+    GL_CHECK(glBindRenderbuffer(GL_RENDERBUFFER, 0));
+
+    GL_CHECK_RET(glGenFramebuffers(1, &mOffscreenFramebuffer), false);
+    GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, mOffscreenFramebuffer));
+    GL_CHECK(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                       GL_RENDERBUFFER, mOffscreenColor));
+    GL_CHECK(glFramebufferRenderbuffer(GL_FRAMEBUFFER,
+                                       GL_DEPTH_STENCIL_ATTACHMENT,
+                                       GL_RENDERBUFFER, mOffscreenDepth));
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        gLog.err("offscreen framebuffer incomplete: 0x%x\n", status);
+        return false;
+    }
 
+    mHeadless = true;
     return true;
 }
 
 void Renderer::setClearColor(const Color& c)
 {
-    glClearColor(c.r, c.g, c.b, c.a);
+    mGLState.clearColor(c);
+    mClearColor = c;
 }
 
 void Renderer::clear()
 {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    mProfiler.beginFrame();
+    addScenePass(FrameGraph::LoadClear);
+}
+
+void Renderer::addScenePass(FrameGraph::ELoadOp load)
+{
+    unsigned width = 0;
+    unsigned height = 0;
+    mResolutionScaler.getRenderSize(mViewport[2], mViewport[3],
+                                    width, height);
+    if (mScalingSupported && (width < mViewport[2] || height < mViewport[3])) {
+        mSceneSize[0] = width;
+        mSceneSize[1] = height;
+        mFrameUniforms.setViewport(0, 0, width, height);
+        addScaledScenePass(width, height);
+        return;
+    }
+
+    mSceneSize[0] = mViewport[2];
+    mSceneSize[1] = mViewport[3];
+    mFrameUniforms.setViewport(mViewport[0], mViewport[1],
+                               mViewport[2], mViewport[3]);
+
+    // how much to redraw is only known in drawAll(), the pass clears the
+    // back buffer itself then
+    bool clear = (load == FrameGraph::LoadClear);
+    if (mRedrawOnDemand) {
+        load = FrameGraph::LoadKeep;
+    }
+
+    Color clearColor = mClearColor;
+    mFrameGraph.addPass("scene",
+                        [load, clearColor](FrameGraph::Builder& builder) {
+                            builder.write(FrameGraph::BACKBUFFER, load,
+                                          clearColor);
+                        },
+                        [this, clear](const FrameGraph&) {
+                            beginRedraw(clear);
+                            mStaticBatcher.draw(mCamera);
+                            mBatcher.flush(mCamera);
+                            mInstanceBatcher.flush(mCamera);
+                            endRedraw();
+                        });
+    mScenePassAdded = true;
+    mScenePasses = 1;
+}
+
+// the scene goes to transient targets of the reduced size, "upscale" then
+// stretches it over the back buffer and draws orthographic geometry on top
+void Renderer::addScaledScenePass(unsigned width,
+                                  unsigned height)
+{
+    Color clearColor = mClearColor;
+    FrameGraph::ResourceId color = FrameGraph::INVALID_RESOURCE;
+
+    mFrameGraph.addPass("scene",
+                        [&color, clearColor, width, height]
+                        (FrameGraph::Builder& builder) {
+                            color = builder.create("sceneColor",
+                                                   { width, height,
+                                                     GL_RGBA8 });
+                            FrameGraph::ResourceId depth = builder.create(
+                                    "sceneDepth",
+                                    { width, height, GL_DEPTH24_STENCIL8 });
+
+                            // transient targets have no contents to keep
+                            builder.write(color, FrameGraph::LoadClear,
+                                          clearColor);
+                            builder.write(depth, FrameGraph::LoadClear);
+                        },
+                        [this](const FrameGraph&) {
+                            mStaticBatcher.draw(mCamera);
+                            mBatcher.flush(mCamera, ProjectionPerspective);
+                            mInstanceBatcher.flush(mCamera,
+                                                   ProjectionPerspective);
+                        });
+    mFrameGraph.addPass("upscale",
+                        [color, clearColor](FrameGraph::Builder& builder) {
+                            builder.read(color);
+                            // clears depth for the orthographic draws
+                            builder.write(FrameGraph::BACKBUFFER,
+                                          FrameGraph::LoadClear, clearColor);
+                        },
+                        [this, color](const FrameGraph& graph) {
+                            upscale(graph.getTexture(color),
+                                    graph.getDesc(color));
+                            mBatcher.flush(mCamera);
+                            mInstanceBatcher.flush(mCamera);
+                        });
+    mScenePassAdded = true;
+    mScenePasses = 2;
+}
+
+void Renderer::upscale(TextureId texture,
+                       const FrameGraph::TextureDesc& desc)
+{
+    if (!mUpscaleFramebuffer) {
+        glGenFramebuffers(1, &mUpscaleFramebuffer);
+    }
+
+    // the pass framebuffer stays bound for drawing, FrameGraph binds both
+    // targets again for the passes after this one
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, mUpscaleFramebuffer);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, texture, 0);
+    glBlitFramebuffer(0, 0, desc.width, desc.height,
+                      mViewport[0], mViewport[1],
+                      mViewport[0] + mViewport[2], mViewport[1] + mViewport[3],
+                      GL_COLOR_BUFFER_BIT, GL_LINEAR);
+}
+
+// feeds state affecting the whole frame to the tracker and decides how
+// much of the frame to redraw; false if nothing
+bool Renderer::updateDamage()
+{
+    mDamage.addGlobal(&mCamera.getPerspectiveProjectionMatrix(),
+                      sizeof(Mat44));
+    mDamage.addGlobal(&mCamera.getViewMatrix(), sizeof(Mat44));
+    mDamage.addGlobal(&mCamera.getOrthographicProjectionMatrix(),
+                      sizeof(Mat44));
+    mDamage.addGlobal(mViewport, sizeof(mViewport));
+    mDamage.addGlobal(mSceneSize, sizeof(mSceneSize));
+    mDamage.addGlobal(&mClearColor, sizeof(mClearColor));
+    if (mStaticBatcher.hasChanges()
+            || mFrameGraph.getNumPasses() > mScenePasses) {
+        mDamage.invalidate();
+    }
+
+    // offscreen targets keep their contents, scaled scenes are rendered
+    // into fresh ones
+    unsigned bufferAge = mHeadless ? 1
+                         : mBufferAgeSupported ? mContext->getBufferAge()
+                         : 0;
+    bool partialAllowed = mPartialRedraw && mScenePasses == 1;
+
+    DamageTracker::Rect damage;
+    switch (mDamage.endFrame(bufferAge, partialAllowed, damage)) {
+    case DamageTracker::DamageNone:
+        return false;
+    case DamageTracker::DamagePartial:
+        mPartialFrame = true;
+        mPartialRect = damage;
+        break;
+    case DamageTracker::DamageFull:
+        mPartialFrame = false;
+        break;
+    }
+    return true;
+}
+
+void Renderer::beginRedraw(bool clear)
+{
+    if (!mRedrawOnDemand) {
+        return;
+    }
+
+    if (mPartialFrame) {
+        mGLState.enable(GL_SCISSOR_TEST);
+        mGLState.scissor(mPartialRect.x, mPartialRect.y,
+                         mPartialRect.width, mPartialRect.height);
+    }
+    if (clear) {
+        // clears honor the depth mask
+        mGLState.depthMask(true);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+}
+
+void Renderer::endRedraw()
+{
+    if (mRedrawOnDemand && mPartialFrame) {
+        mGLState.disable(GL_SCISSOR_TEST);
+    }
 }
 
 void Renderer::swapBuffers()
 {
-    glXSwapBuffers(mContext->display, mContext->window);
+    if (mFrameSkipped) {
+        // nothing to present, keep loading and releasing resources
+        mProfiler.discardFrame();
+        mLoader.update();
+        mResources.endFrame();
+        mLodSelector.endFrame(0.0, 0.0);
+        // the idle time must not show up as load on the next frame
+        mFramePacer.skipFrame();
+        mWorkStart = std::chrono::steady_clock::now();
+        return;
+    }
+
+    mFrameCapture.capture();
+    mProfiler.endFrame();
+    mStreamBuffer.endFrame();
+    mGLState.endFrame();
+    mLoader.update();
+    mResources.endFrame();
+#ifdef GL_CHECK_ASYNC
+    utils::drainDebugMessages();
+#endif
+
+    // excludes blocking in glXSwapBuffers with vsync, fence waits and
+    // sleeping to the target frame rate, all of which follow
+    double workMs = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - mWorkStart).count();
+
+    if (mHeadless) {
+        // nothing to present, just make sure the frame gets submitted
+        glFlush();
+    } else {
+        glXSwapBuffers(mContext->display, mContext->window);
+    }
+
+    // keeps the CPU from running arbitrarily far ahead of the GPU
+    mFramePacer.endFrame();
+
+    FramePacer::Stats pacing = mFramePacer.getStats();
+    mLodSelector.endFrame(pacing.frameTime.lastMs, workMs);
+
+    if (mResolutionScaler.isEnabled()) {
+        // GPU time is that of a frame FRAME_LATENCY frames back; waits for
+        // the GPU already show up there
+        GpuProfiler::ScopeStats gpuFrame;
+        double gpuMs = mProfiler.getScopeStats(GpuProfiler::FRAME_SCOPE,
+                                               gpuFrame)
+                       ? gpuFrame.lastMs : 0.0;
+        mResolutionScaler.endFrame(gpuMs, workMs);
+    }
+
+    mWorkStart = std::chrono::steady_clock::now();
+}
+
+bool Renderer::setPresentMode(EPresentMode mode)
+{
+    if (!mContext) {
+        gLog.err("cannot set present mode: renderer not initialized\n");
+        return false;
+    }
+    if (mHeadless) {
+        gLog.warn("present mode has no effect when headless\n");
+        return false;
+    }
+
+    int interval = 0;
+    switch (mode) {
+    case PresentImmediate:
+        interval = 0;
+        break;
+    case PresentVSync:
+        interval = 1;
+        break;
+    case PresentAdaptive:
+        if (mContext->hasExtension("GLX_EXT_swap_control_tear")) {
+            interval = -1;
+        } else {
+            gLog.warn("late swaps not supported, using vsync\n");
+            interval = 1;
+        }
+        break;
+    }
+
+    if (!mContext->setSwapInterval(interval)) {
+        gLog.err("cannot set swap interval %d: neither GLX_EXT_swap_control "
+                 "nor GLX_MESA_swap_control available\n", interval);
+        return false;
+    }
+
+    gLog.info("swap interval set to %d\n", interval);
+    return true;
+}
+
+ProgramId Renderer::loadProgram(const std::string& vertexPath,
+                                const std::string& fragmentPath,
+                                const std::vector<std::string>& defines)
+{
+    return mShaderCache.getProgram(vertexPath, fragmentPath, defines);
+}
+
+void Renderer::draw(const Drawable& d)
+{
+    mBatcher.add(d);
+    if (mRedrawOnDemand) {
+        trackDraw(d, &d.getTransform(), NULL, 1);
+    }
+}
+
+void Renderer::drawInstanced(const Drawable& d,
+                             const Mat44* transforms,
+                             const Color* colors,
+                             size_t count)
+{
+    mInstanceBatcher.add(d, transforms, colors, count);
+    if (mRedrawOnDemand) {
+        trackDraw(d, transforms, colors, count);
+    }
+}
+
+void Renderer::draw(LodDrawable& d)
+{
+    mLodSelector.add(mCamera, d, mBatcher);
+
+    if (mRedrawOnDemand) {
+        const LodState& state = d.getState();
+        const LodDrawable* drawable = &d;
+        uint64_t hash = DamageTracker::hash(&drawable, sizeof(drawable));
+        hash = DamageTracker::hash(&d.getTransform(), sizeof(Mat44), hash);
+        hash = DamageTracker::hash(&state.level, sizeof(state.level), hash);
+        hash = DamageTracker::hash(&state.previous, sizeof(state.previous),
+                                   hash);
+        hash = DamageTracker::hash(&state.fade, sizeof(state.fade), hash);
+        trackItem(d.getProjectionType(), hash, d.getLevel(0).getMesh(),
+                  d.getTransform());
+    }
+}
+
+void Renderer::drawInstanced(const LodDrawable& d,
+                             const Mat44* transforms,
+                             const Color* colors,
+                             LodState* states,
+                             size_t count)
+{
+    mLodSelector.addInstances(mCamera, d, transforms, colors, states, count,
+                              mInstanceBatcher);
+
+    if (mRedrawOnDemand) {
+        const LodDrawable* drawable = &d;
+        uint64_t seed = DamageTracker::hash(&drawable, sizeof(drawable));
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t hash = DamageTracker::hash(&transforms[i], sizeof(Mat44),
+                                                seed);
+            if (colors) {
+                hash = DamageTracker::hash(&colors[i], sizeof(Color), hash);
+            }
+            if (states) {
+                const LodState& state = states[i];
+                hash = DamageTracker::hash(&state.level, sizeof(state.level),
+                                           hash);
+                hash = DamageTracker::hash(&state.previous,
+                                           sizeof(state.previous), hash);
+                hash = DamageTracker::hash(&state.fade, sizeof(state.fade),
+                                           hash);
+            }
+            trackItem(d.getProjectionType(), hash, d.getLevel(0).getMesh(),
+                      transforms[i]);
+        }
+    }
+}
+
+void Renderer::trackDraw(const Drawable& d,
+                         const Mat44* transforms,
+                         const Color* colors,
+                         size_t count)
+{
+    const Mesh* mesh = &d.getMesh();
+    ProgramId program = d.getProgram();
+    TextureId texture = d.getTexture();
+    uint8_t layer = d.getLayer();
+    bool translucent = d.isTranslucent();
+
+    uint64_t seed = DamageTracker::hash(&mesh, sizeof(mesh));
+    seed = DamageTracker::hash(&program, sizeof(program), seed);
+    seed = DamageTracker::hash(&texture, sizeof(texture), seed);
+    seed = DamageTracker::hash(&layer, sizeof(layer), seed);
+    seed = DamageTracker::hash(&translucent, sizeof(translucent), seed);
+
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t hash = DamageTracker::hash(&transforms[i], sizeof(Mat44),
+                                            seed);
+        if (colors) {
+            hash = DamageTracker::hash(&colors[i], sizeof(Color), hash);
+        }
+        trackItem(d.getProjectionType(), hash, *mesh, transforms[i]);
+    }
+}
+
+// orthographic draws damage only the area they cover, anything else the
+// whole frame
+void Renderer::trackItem(EProjectionType projection,
+                         uint64_t hash,
+                         const Mesh& mesh,
+                         const Mat44& transform)
+{
+    if (projection == ProjectionOrthographic) {
+        mDamage.addLocal(hash, getScreenRect(mesh, transform));
+    } else {
+        mDamage.addGlobal(&hash, sizeof(hash));
+    }
+}
+
+DamageTracker::Rect Renderer::getScreenRect(const Mesh& mesh,
+                                            const Mat44& transform)
+{
+    Mat44 matrix = simd::multiply(mCamera.getOrthographicProjectionMatrix(),
+                                  transform);
+    Vec2 min(1.f, 1.f);
+    Vec2 max(-1.f, -1.f);
+
+    for (const Vertex& v: mesh.getVertices()) {
+        Vec4 p = simd::transform(matrix, Vec4(v.position.x, v.position.y,
+                                              v.position.z, 1.f));
+        min.x = std::min(min.x, p.x);
+        min.y = std::min(min.y, p.y);
+        max.x = std::max(max.x, p.x);
+        max.y = std::max(max.y, p.y);
+    }
+
+    // NDC to window coordinates, rounded outwards; partially covered
+    // pixels count
+    float x0 = mViewport[0] + (std::max(min.x, -1.f) + 1.f) * 0.5f * mViewport[2];
+    float y0 = mViewport[1] + (std::max(min.y, -1.f) + 1.f) * 0.5f * mViewport[3];
+    float x1 = mViewport[0] + (std::min(max.x, 1.f) + 1.f) * 0.5f * mViewport[2];
+    float y1 = mViewport[1] + (std::min(max.y, 1.f) + 1.f) * 0.5f * mViewport[3];
+
+    DamageTracker::Rect rect;
+    rect.x = (int)std::floor(x0) - 1;
+    rect.y = (int)std::floor(y0) - 1;
+    rect.width = (int)std::ceil(x1) + 1 - rect.x;
+    rect.height = (int)std::ceil(y1) + 1 - rect.y;
+    return rect;
+}
+
+void Renderer::drawAll()
+{
+    GL_DEBUG_SCOPE("Renderer::drawAll");
+    GpuProfiler::Scope profilerScope(mProfiler, "drawAll");
+    mTextureAtlas.update();
+
+    // clear() was not called this frame, draw over the previous contents
+    if (!mScenePassAdded) {
+        addScenePass(FrameGraph::LoadKeep);
+    }
+    mScenePassAdded = false;
+
+    mFrameSkipped = mRedrawOnDemand && !updateDamage();
+    if (mFrameSkipped) {
+        mFrameGraph.discard();
+        mBatcher.discard();
+        mInstanceBatcher.discard();
+        return;
+    }
+
+    // after the scene pass, which sets the viewport of the block
+    mFrameUniforms.update(mCamera);
+
+    if (!mFrameGraph.execute()) {
+        // errors already logged; still draw the scene, so that the queues
+        // do not grow
+        mStaticBatcher.draw(mCamera);
+        mBatcher.flush(mCamera);
+        mInstanceBatcher.flush(mCamera);
+    }
 }
 
 void Renderer::setViewport(unsigned x,
@@ -228,11 +992,54 @@ void Renderer::setViewport(unsigned x,
                            unsigned width,
                            unsigned height)
 {
-    glViewport(x, y, width, height);
+    mViewport[0] = x;
+    mViewport[1] = y;
+    mViewport[2] = width;
+    mViewport[3] = height;
+
+    // captured frames all have the size the capture started with
+    if (mFrameCapture.isActive()
+            && (width != mFrameCapture.getWidth()
+                || height != mFrameCapture.getHeight())) {
+        gLog.warn("viewport resized to %ux%u, stopping frame capture\n",
+                  width, height);
+        mFrameCapture.stop();
+    }
+
+    mGLState.viewport(x, y, width, height);
+    mFrameUniforms.setViewport(x, y, width, height);
+    mFrameGraph.setBackbufferViewport(x, y, width, height);
+
+    // the scene keeps the aspect ratio of the viewport when scaled
+    if (width > 0 && height > 0) {
+        mCamera.setAspectRatio((float)width / (float)height);
+    }
+}
+
+void Renderer::setRedrawOnDemand(bool enabled,
+                                 bool partial)
+{
+    mRedrawOnDemand = enabled;
+    mPartialRedraw = partial;
+    mFrameSkipped = false;
+    mPartialFrame = false;
+    mDamage.reset();
+}
+
+void Renderer::invalidate()
+{
+    mDamage.invalidate();
+}
 
-    // adjust aspect ratio
-    // TODO
-    //mCamera.setPerspectiveMatrix(PI_3, (float)cx / (float)cy);
+void Renderer::invalidate(unsigned x,
+                          unsigned y,
+                          unsigned width,
+                          unsigned height)
+{
+    DamageTracker::Rect rect = {
+        (int)x, (int)y, (int)width, (int)height
+    };
+    mDamage.invalidate(rect);
 }
 
 } // namespace sb
@@ -1,12 +1,35 @@
 #pragma once
 
+#include <chrono>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <GL/glew.h>
 #include <GL/gl.h>
 #include <GL/glu.h>
 
+#include "rendering/camera.h"
 #include "rendering/color.h"
+#include "rendering/damage_tracker.h"
+#include "rendering/draw_batcher.h"
+#include "rendering/drawable.h"
+#include "rendering/frame_capture.h"
+#include "rendering/frame_graph.h"
+#include "rendering/frame_pacer.h"
+#include "rendering/frame_uniforms.h"
+#include "rendering/gl_state.h"
+#include "rendering/gpu_profiler.h"
+#include "rendering/instance_batcher.h"
+#include "rendering/lod_drawable.h"
+#include "rendering/lod_selector.h"
+#include "rendering/resolution_scaler.h"
+#include "rendering/resource_loader.h"
+#include "rendering/resource_manager.h"
+#include "rendering/shader_cache.h"
+#include "rendering/static_batcher.h"
+#include "rendering/stream_buffer.h"
+#include "rendering/texture_atlas.h"
 
 namespace sb {
 
@@ -17,27 +40,207 @@ class Renderer
 {
 public:
     Renderer();
+    ~Renderer();
 
     Renderer(const Renderer&) = delete;
     Renderer(Renderer&&) = delete;
     Renderer& operator =(const Renderer&) = delete;
     Renderer& operator =(Renderer&&) = delete;
 
-    bool init(const NativeWindowHandle &handle);
+    // headless handle makes the renderer draw into an offscreen framebuffer;
+    // backgroundLoading creates a second context for the ResourceLoader
+    bool init(const NativeWindowHandle &handle,
+              bool backgroundLoading = true);
     void setClearColor(const Color& c);
     void clear();
     void swapBuffers();
+    // returns false if the mode is not supported; adaptive falls back to
+    // vsync when late swaps are not supported
+    bool setPresentMode(EPresentMode mode);
     void setViewport(unsigned x,
                      unsigned y,
                      unsigned width,
                      unsigned height);
 
+    // skips frames nothing changed in: drawAll() and swapBuffers() then
+    // neither draw nor present anything, see isFrameSkipped(). Submitted
+    // draws, camera, viewport, clear color and static objects are tracked,
+    // other changes (texture contents, passes added to the frame graph,
+    // ...) need invalidate(). With partial, frames in which only
+    // orthographic draws changed are redrawn within the area those cover,
+    // if the back buffer contents are known. Call between frames
+    void setRedrawOnDemand(bool enabled,
+                           bool partial = true);
+    bool isRedrawOnDemand() const { return mRedrawOnDemand; }
+    // makes the next frame redraw entirely or within a rectangle (window
+    // coordinates, origin in the bottom left corner)
+    void invalidate();
+    void invalidate(unsigned x,
+                    unsigned y,
+                    unsigned width,
+                    unsigned height);
+    // true if the last drawAll() found nothing to redraw
+    bool isFrameSkipped() const { return mFrameSkipped; }
+
+    // programs for drawables; built through the shader cache, so warm starts
+    // load linked binaries instead of compiling. Owned by the renderer,
+    // loading the same sources again returns the same program; 0 on failure
+    ProgramId loadProgram(const std::string& vertexPath,
+                          const std::string& fragmentPath,
+                          const std::vector<std::string>& defines = {});
+
+    // queues d for this frame; d must stay alive until drawAll()
+    void draw(const Drawable& d);
+    // draws count copies of d's mesh with per-instance transforms and
+    // (optional) colors in one call; d and both arrays must stay alive until
+    // drawAll()
+    void drawInstanced(const Drawable& d,
+                       const Mat44* transforms,
+                       const Color* colors,
+                       size_t count);
+    // queues the level of d selected by getLodSelector(), updating d's
+    // LOD state; d must stay alive until drawAll()
+    void draw(LodDrawable& d);
+    // per-instance level selection, see LodSelector::addInstances()
+    void drawInstanced(const LodDrawable& d,
+                       const Mat44* transforms,
+                       const Color* colors,
+                       LodState* states,
+                       size_t count);
+    void drawAll();
+
+    // objects drawn every frame until removed, before those queued with
+    // draw(); programs use the per-instance attributes
+    StaticBatcher& getStaticBatcher() { return mStaticBatcher; }
+
+    Camera& getCamera() { return mCamera; }
+    // contents of the FrameUniforms block of the current frame
+    const FrameUniforms& getFrameUniforms() const { return mFrameUniforms; }
+    // for code issuing GL calls alongside the renderer, keeps the shadowed
+    // state in sync
+    GLState& getGLState() { return mGLState; }
+    // textures, buffers and programs whose destruction waits for the GPU
+    ResourceManager& getResourceManager() { return mResources; }
+    // decodes and uploads resources off the render thread
+    ResourceLoader& getResourceLoader() { return mLoader; }
+
+    // hits and misses of loadProgram()
+    const ShaderCache& getShaderCache() const { return mShaderCache; }
+    TextureAtlas& getTextureAtlas() { return mTextureAtlas; }
+    // captures the back buffer in swapBuffers() while active
+    FrameCapture& getFrameCapture() { return mFrameCapture; }
+    // clear() adds the "scene" pass drawing everything queued with draw()
+    // into FrameGraph::BACKBUFFER; passes added after it that also write
+    // the back buffer run after it. The graph is executed by drawAll().
+    FrameGraph& getFrameGraph() { return mFrameGraph; }
+
+    // frames span from clear() to swapBuffers()
+    GpuProfiler& getProfiler() { return mProfiler; }
+    // frames-in-flight limit, frame rate cap and frame time statistics
+    FramePacer& getFramePacer() { return mFramePacer; }
+    // LOD bias, hysteresis and cross-fade settings
+    LodSelector& getLodSelector() { return mLodSelector; }
+    // once given a target frame time, perspective draws are rendered at a
+    // reduced resolution and upscaled, orthographic ones stay at full
+    // resolution; the FrameUniforms viewport is the reduced one
+    ResolutionScaler& getResolutionScaler() { return mResolutionScaler; }
+
+    bool isHeadless() const { return mHeadless; }
+    // framebuffer that plays the role of the window back buffer
+    GLuint getBackbuffer() const { return mOffscreenFramebuffer; }
+    const DrawBatcher::Stats& getBatchStats() const
+    {
+        return mBatcher.getStats();
+    }
+    const InstanceBatcher::Stats& getInstanceStats() const
+    {
+        return mInstanceBatcher.getStats();
+    }
+    const StaticBatcher::Stats& getStaticStats() const
+    {
+        return mStaticBatcher.getStats();
+    }
+    const GLState::Stats& getStateStats() const
+    {
+        return mGLState.getStats();
+    }
+    const StreamBuffer::Stats& getStreamStats() const
+    {
+        return mStreamBuffer.getStats();
+    }
+    const DamageTracker::Stats& getRedrawStats() const
+    {
+        return mDamage.getStats();
+    }
+
 private:
     // HACK: semantically should be unique_ptr, but that does not work with
     // incomplete typer
     std::shared_ptr<const NativeContextHandle> mContext;
 
+    bool mHeadless;
+    GLuint mOffscreenFramebuffer;
+    GLuint mOffscreenColor;
+    GLuint mOffscreenDepth;
+    unsigned mViewport[4];
+    bool mScalingSupported;
+    GLuint mUpscaleFramebuffer;
+
+    GLState mGLState;
+    ResourceManager mResources;
+    ResourceLoader mLoader;
+    GpuProfiler mProfiler;
+    FramePacer mFramePacer;
+    // end of the last swapBuffers(); CPU work of a frame is measured from
+    // there to presenting it, so that no kind of wait counts as load
+    std::chrono::steady_clock::time_point mWorkStart;
+    ShaderCache mShaderCache;
+    TextureAtlas mTextureAtlas;
+    FrameCapture mFrameCapture;
+    Camera mCamera;
+    StreamBuffer mStreamBuffer;
+    FrameUniforms mFrameUniforms;
+    DrawBatcher mBatcher;
+    InstanceBatcher mInstanceBatcher;
+    StaticBatcher mStaticBatcher;
+    LodSelector mLodSelector;
+    ResolutionScaler mResolutionScaler;
+    FrameGraph mFrameGraph;
+    bool mScenePassAdded;
+    size_t mScenePasses;
+    unsigned mSceneSize[2];
+    Color mClearColor;
+
+    DamageTracker mDamage;
+    bool mRedrawOnDemand;
+    bool mPartialRedraw;
+    bool mBufferAgeSupported;
+    bool mFrameSkipped;
+    bool mPartialFrame;
+    DamageTracker::Rect mPartialRect;
+
     bool initGLEW();
+    bool initOffscreenTarget(unsigned width,
+                             unsigned height);
+    void addScenePass(FrameGraph::ELoadOp load);
+    void addScaledScenePass(unsigned width,
+                            unsigned height);
+    void upscale(TextureId texture,
+                 const FrameGraph::TextureDesc& desc);
+
+    void trackDraw(const Drawable& d,
+                   const Mat44* transforms,
+                   const Color* colors,
+                   size_t count);
+    void trackItem(EProjectionType projection,
+                   uint64_t hash,
+                   const Mesh& mesh,
+                   const Mat44& transform);
+    DamageTracker::Rect getScreenRect(const Mesh& mesh,
+                                      const Mat44& transform);
+    bool updateDamage();
+    void beginRedraw(bool clear);
+    void endRedraw();
 };
 
 } // namespace sb
@@ -0,0 +1,117 @@
+#include "rendering/resolution_scaler.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace sb {
+namespace {
+
+// weight of the newest frame in the averaged frame time
+const double AVERAGE_WEIGHT = 0.1;
+// scale only rises once frames are comfortably within the target, so that
+// it does not oscillate around it
+const double TARGET_SLACK = 0.85;
+
+} // namespace
+
+ResolutionScaler::ResolutionScaler():
+    mTargetFrameTime(0.0),
+    mMinSteps(SCALE_STEPS / 2),
+    mMaxSteps(SCALE_STEPS),
+    mSteps(SCALE_STEPS),
+    mAverageFrameMs(0.0),
+    mFramesSinceChange(0),
+    mChanges(0)
+{
+}
+
+ResolutionScaler::~ResolutionScaler()
+{
+}
+
+unsigned ResolutionScaler::toSteps(float scale)
+{
+    int steps = (int)std::lround(scale * SCALE_STEPS);
+    return (unsigned)std::max(1, std::min((int)SCALE_STEPS, steps));
+}
+
+void ResolutionScaler::setTargetFrameTime(double milliseconds)
+{
+    mTargetFrameTime = std::max(0.0, milliseconds);
+    mSteps = mMaxSteps;
+    mAverageFrameMs = 0.0;
+    mFramesSinceChange = 0;
+    mChanges = 0;
+}
+
+void ResolutionScaler::setScaleRange(float minScale,
+                                     float maxScale)
+{
+    mMinSteps = toSteps(minScale);
+    mMaxSteps = std::max(mMinSteps, toSteps(maxScale));
+    mSteps = std::max(mMinSteps, std::min(mMaxSteps, mSteps));
+}
+
+void ResolutionScaler::getRenderSize(unsigned width,
+                                     unsigned height,
+                                     unsigned& renderWidth,
+                                     unsigned& renderHeight) const
+{
+    float scale = getScale();
+    renderWidth = std::max(1u, (unsigned)std::lround(width * scale));
+    renderHeight = std::max(1u, (unsigned)std::lround(height * scale));
+}
+
+void ResolutionScaler::endFrame(double gpuMs,
+                                double cpuMs)
+{
+    double frameMs = std::max(gpuMs, cpuMs);
+    if (!isEnabled() || frameMs <= 0.0) {
+        return;
+    }
+
+    if (mAverageFrameMs > 0.0) {
+        mAverageFrameMs += (frameMs - mAverageFrameMs) * AVERAGE_WEIGHT;
+    } else {
+        mAverageFrameMs = frameMs;
+    }
+
+    if (++mFramesSinceChange < CHANGE_INTERVAL) {
+        return;
+    }
+
+    // steps that would bring the average to the target
+    double ideal = mSteps * std::sqrt(mTargetFrameTime / mAverageFrameMs);
+    unsigned steps = mSteps;
+    if (mAverageFrameMs > mTargetFrameTime) {
+        // drop as far as needed right away
+        steps = (unsigned)std::min((double)mSteps - 1.0, std::floor(ideal));
+    } else if (mAverageFrameMs < mTargetFrameTime * TARGET_SLACK
+               && std::floor(ideal) > mSteps) {
+        // rise one step at a time, the estimate is optimistic for small
+        // scales where per-pixel work no longer dominates
+        steps = mSteps + 1;
+    }
+    steps = std::max(mMinSteps, std::min(mMaxSteps, steps));
+
+    if (steps == mSteps) {
+        return;
+    }
+
+    // frames measured so far were rendered at the old scale
+    mAverageFrameMs *= (double)(steps * steps) / (mSteps * mSteps);
+    mSteps = steps;
+    mFramesSinceChange = 0;
+    ++mChanges;
+}
+
+ResolutionScaler::Stats ResolutionScaler::getStats() const
+{
+    Stats stats;
+    stats.scale = getScale();
+    stats.averageFrameMs = mAverageFrameMs;
+    stats.changes = mChanges;
+    return stats;
+}
+
+} // namespace sb
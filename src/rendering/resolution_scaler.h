@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+
+namespace sb {
+
+// Picks the fraction of the viewport size the 3D scene is rendered at from
+// measured frame times: the scale drops while frames take longer than the
+// target and rises again once there is headroom.
+//
+// Rendering cost is assumed to be proportional to the rendered area, so
+// the scale moves by the square root of the ratio of target and averaged
+// frame time. Scales are multiples of 1 / SCALE_STEPS and change at most
+// once per CHANGE_INTERVAL frames; each new size means new render targets,
+// and frame times lag behind changes by a few frames anyway.
+class ResolutionScaler
+{
+public:
+    static const unsigned SCALE_STEPS = 20;
+    static const unsigned CHANGE_INTERVAL = 8;
+
+    struct Stats
+    {
+        float scale;
+        double averageFrameMs;  // max of GPU and CPU time, smoothed
+        uint32_t changes;       // since the target was last set
+    };
+
+    ResolutionScaler();
+    ~ResolutionScaler();
+
+    ResolutionScaler(const ResolutionScaler&) = delete;
+    ResolutionScaler(ResolutionScaler&&) = delete;
+    ResolutionScaler& operator =(const ResolutionScaler&) = delete;
+    ResolutionScaler& operator =(ResolutionScaler&&) = delete;
+
+    // 0 disables scaling, the scene is then rendered at full resolution
+    void setTargetFrameTime(double milliseconds);
+    double getTargetFrameTime() const { return mTargetFrameTime; }
+    bool isEnabled() const { return mTargetFrameTime > 0.0; }
+    // both rounded to multiples of 1 / SCALE_STEPS within (0, 1]
+    void setScaleRange(float minScale,
+                       float maxScale);
+    float getMinScale() const { return toScale(mMinSteps); }
+    float getMaxScale() const { return toScale(mMaxSteps); }
+
+    // 1 while disabled
+    float getScale() const { return isEnabled() ? toScale(mSteps) : 1.f; }
+    // size to render a width x height viewport at, at least 1x1
+    void getRenderSize(unsigned width,
+                       unsigned height,
+                       unsigned& renderWidth,
+                       unsigned& renderHeight) const;
+
+    // GPU and CPU time of a finished frame, 0 if not measured; the slower
+    // one drives the scale
+    void endFrame(double gpuMs,
+                  double cpuMs);
+
+    Stats getStats() const;
+
+private:
+    double mTargetFrameTime;
+    unsigned mMinSteps;
+    unsigned mMaxSteps;
+    unsigned mSteps;
+    double mAverageFrameMs;
+    unsigned mFramesSinceChange;
+    uint32_t mChanges;
+
+    static float toScale(unsigned steps) { return (float)steps / SCALE_STEPS; }
+    static unsigned toSteps(float scale);
+};
+
+} // namespace sb
@@ -0,0 +1,402 @@
+#include "rendering/resource_loader.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "rendering/gl_state.h"
+#include "utils/gl.h"
+#include "utils/logger.h"
+
+namespace sb {
+namespace {
+
+double toMilliseconds(std::chrono::steady_clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+unsigned getMipLevels(unsigned width,
+                      unsigned height)
+{
+    unsigned levels = 1;
+    for (unsigned size = std::max(width, height); size > 1; size >>= 1) {
+        ++levels;
+    }
+    return levels;
+}
+
+} // namespace
+
+ResourceLoader::ResourceLoader():
+    mState(NULL),
+    mResources(NULL),
+    mLoaderContext(),
+    mBackgroundUpload(false),
+    mThread(),
+    mMutex(),
+    mWake(),
+    mQueue(),
+    mQuit(false),
+    mFinished(MAX_FINISHED),
+    mWaiting(),
+    mStats(),
+    mTotalLatencyMs(0.0)
+{
+}
+
+ResourceLoader::~ResourceLoader()
+{
+    if (!mThread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQuit = true;
+    }
+    mWake.notify_all();
+    mThread.join();
+
+    // results nobody is going to pick up
+    std::shared_ptr<Job> job;
+    while (mFinished.pop(job)) {
+        mWaiting.push_back(job);
+    }
+    for (const std::shared_ptr<Job>& j: mWaiting) {
+        deleteObject(*j, mState);
+        j->request->mState = StateFailed;
+    }
+    for (const std::shared_ptr<Job>& j: mQueue) {
+        j->request->mState = StateFailed;
+    }
+}
+
+bool ResourceLoader::init(GLState& state,
+                          ResourceManager& resources,
+                          const LoaderContextFunc& loaderContext)
+{
+    mState = &state;
+    mResources = &resources;
+    mLoaderContext = loaderContext;
+
+    std::promise<bool> started;
+    std::future<bool> hasContext = started.get_future();
+    mThread = std::thread(&ResourceLoader::threadMain, this, &started);
+
+    mBackgroundUpload = hasContext.get();
+    if (!mBackgroundUpload) {
+        gLog.warn("no loader context, resources will be uploaded on the "
+                  "render thread\n");
+    }
+    return true;
+}
+
+std::shared_ptr<const ResourceLoader::Request>
+ResourceLoader::loadTexture(const DecodeImageFunc& decode,
+                            bool mipmaps)
+{
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->decodeImage = decode;
+    job->mipmaps = mipmaps;
+    return enqueue(job);
+}
+
+std::shared_ptr<const ResourceLoader::Request>
+ResourceLoader::loadBuffer(const DecodeBufferFunc& decode,
+                           GLenum usage)
+{
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->decodeBuffer = decode;
+    job->usage = usage;
+    return enqueue(job);
+}
+
+std::shared_ptr<const ResourceLoader::Request>
+ResourceLoader::enqueue(const std::shared_ptr<Job>& job)
+{
+    assert(mThread.joinable());
+
+    job->request = std::shared_ptr<Request>(new Request());
+    job->requested = Clock::now();
+    job->decoded = false;
+    job->uploaded = false;
+    job->object = 0;
+    job->levels = 1;
+    job->fence = 0;
+    job->bytes = 0;
+    job->decodeMs = 0.0;
+    job->uploadMs = 0.0;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQueue.push_back(job);
+    }
+    mWake.notify_one();
+
+    ++mStats.requested;
+    ++mStats.pending;
+    return job->request;
+}
+
+void ResourceLoader::threadMain(std::promise<bool>* started)
+{
+    bool hasContext = mLoaderContext && mLoaderContext(true);
+    started->set_value(hasContext);
+
+    while (true) {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWake.wait(lock, [this]() { return mQuit || !mQueue.empty(); });
+            if (mQuit) {
+                break;
+            }
+
+            job = mQueue.front();
+            mQueue.pop_front();
+        }
+
+        job->request->mState = StateLoading;
+        decode(*job);
+        if (job->decoded && hasContext) {
+            upload(*job, NULL);
+        }
+
+        // update() may be a few frames behind
+        while (!mFinished.push(job)) {
+            std::unique_lock<std::mutex> lock(mMutex);
+            if (mQuit) {
+                deleteObject(*job, NULL);
+                break;
+            }
+            lock.unlock();
+            std::this_thread::yield();
+        }
+    }
+
+    if (hasContext) {
+        mLoaderContext(false);
+    }
+}
+
+void ResourceLoader::decode(Job& job)
+{
+    Clock::time_point start = Clock::now();
+
+    if (job.decodeImage) {
+        Image& image = job.image;
+        job.decoded = job.decodeImage(image)
+                      && image.width > 0 && image.height > 0
+                      && image.rgba.size() >= (size_t)image.width
+                                              * image.height * 4;
+        job.bytes = (size_t)image.width * image.height * 4;
+    } else {
+        job.decoded = job.decodeBuffer(job.data);
+        job.bytes = job.data.size();
+    }
+
+    job.decodeMs = toMilliseconds(Clock::now() - start);
+}
+
+bool ResourceLoader::upload(Job& job,
+                            GLState* state)
+{
+    Clock::time_point start = Clock::now();
+    bool failed = false;
+
+    if (job.decodeImage) {
+        const Image& image = job.image;
+        if (GL_CHECK(glGenTextures(1, &job.object))) {
+            return false;
+        }
+
+        if (state) {
+            state->bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            state->activeTexture(0);
+            state->bindTexture(0, GL_TEXTURE_2D, job.object);
+        } else {
+            glBindTexture(GL_TEXTURE_2D, job.object);
+        }
+
+        if (GL_CHECK(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image.width,
+                                  image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                                  image.rgba.data()))) {
+            failed = true;
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        if (job.mipmaps && (glGenerateMipmap || glGenerateMipmapEXT)) {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                            GL_LINEAR_MIPMAP_LINEAR);
+            if (glGenerateMipmap) {
+                glGenerateMipmap(GL_TEXTURE_2D);
+            } else {
+                glGenerateMipmapEXT(GL_TEXTURE_2D);
+            }
+            job.levels = getMipLevels(image.width, image.height);
+        } else {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        }
+
+        if (!state) {
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+    } else {
+        if (GL_CHECK(glGenBuffers(1, &job.object))) {
+            return false;
+        }
+
+        if (state) {
+            state->bindBuffer(GL_ARRAY_BUFFER, job.object);
+        } else {
+            glBindBuffer(GL_ARRAY_BUFFER, job.object);
+        }
+
+        if (GL_CHECK(glBufferData(GL_ARRAY_BUFFER, job.data.size(),
+                                  job.data.data(), job.usage))) {
+            failed = true;
+        }
+
+        if (!state) {
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+    }
+
+    if (failed) {
+        gLog.err("cannot upload %s of %zu bytes\n",
+                 job.decodeImage ? "texture" : "buffer", job.bytes);
+        deleteObject(job, state);
+        return false;
+    }
+
+    if (!state) {
+        // the render thread must not use the object before the upload is
+        // done; flushing makes sure the fence ever signals
+        if (GLEW_ARB_sync) {
+            job.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+        } else {
+            glFinish();
+        }
+    }
+
+    // decoded data is not needed anymore
+    std::vector<uint8_t>().swap(job.image.rgba);
+    std::vector<uint8_t>().swap(job.data);
+
+    job.uploaded = true;
+    job.uploadMs = toMilliseconds(Clock::now() - start);
+    return true;
+}
+
+void ResourceLoader::update()
+{
+    std::shared_ptr<Job> finished;
+    while (mFinished.pop(finished)) {
+        mWaiting.push_back(finished);
+    }
+
+    size_t uploadedBytes = 0;
+    for (size_t i = 0; i < mWaiting.size();) {
+        Job& job = *mWaiting[i];
+
+        if (job.decoded && !job.uploaded && !mBackgroundUpload) {
+            if (uploadedBytes >= MAX_UPLOAD_BYTES) {
+                ++i;
+                continue;
+            }
+
+            upload(job, mState);
+            uploadedBytes += job.bytes;
+        }
+
+        if (job.fence) {
+            if (glClientWaitSync(job.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+                ++i;
+                continue;
+            }
+
+            glDeleteSync(job.fence);
+            job.fence = 0;
+        }
+
+        publish(job);
+        mWaiting[i] = mWaiting.back();
+        mWaiting.pop_back();
+    }
+}
+
+void ResourceLoader::publish(Job& job)
+{
+    Request& request = *job.request;
+
+    --mStats.pending;
+    mStats.decodeMs += job.decodeMs;
+
+    if (!job.uploaded) {
+        ++mStats.failed;
+        request.mState = StateFailed;
+        return;
+    }
+
+    if (job.decodeImage) {
+        ResourceManager::TextureDesc desc = {
+            job.image.width, job.image.height, GL_RGBA8, job.levels
+        };
+        request.mTexture = mResources->adoptTexture(job.object, desc);
+    } else {
+        ResourceManager::BufferDesc desc = { job.bytes, job.usage };
+        request.mBuffer = mResources->adoptBuffer(job.object, desc);
+    }
+    job.object = 0;
+
+    ++mStats.completed;
+    mStats.bytesUploaded += job.bytes;
+    mStats.uploadMs += job.uploadMs;
+    mTotalLatencyMs += toMilliseconds(Clock::now() - job.requested);
+
+    request.mState = StateReady;
+}
+
+void ResourceLoader::deleteObject(Job& job,
+                                  GLState* state)
+{
+    if (job.fence) {
+        glDeleteSync(job.fence);
+        job.fence = 0;
+    }
+    if (!job.object) {
+        return;
+    }
+
+    if (job.decodeImage) {
+        if (state) {
+            state->deleteTexture(job.object);
+        } else {
+            glDeleteTextures(1, &job.object);
+        }
+    } else {
+        if (state) {
+            state->deleteBuffer(job.object);
+        } else {
+            glDeleteBuffers(1, &job.object);
+        }
+    }
+    job.object = 0;
+}
+
+ResourceLoader::Stats ResourceLoader::getStats() const
+{
+    Stats stats = mStats;
+    stats.uploadMBps = stats.uploadMs > 0.0
+                       ? stats.bytesUploaded / (1024.0 * 1024.0)
+                         / (stats.uploadMs / 1000.0)
+                       : 0.0;
+    stats.averageLatencyMs = stats.completed > 0
+                             ? mTotalLatencyMs / stats.completed
+                             : 0.0;
+    return stats;
+}
+
+} // namespace sb
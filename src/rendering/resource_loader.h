@@ -0,0 +1,183 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "rendering/resource_manager.h"
+#include "rendering/types.h"
+#include "utils/lockfree_queue.h"
+
+namespace sb {
+
+class GLState;
+
+// Decodes and uploads textures and buffers on a background thread, so that
+// streaming does not stall frames.
+//
+// With a loader context sharing objects with the render one, GL objects
+// are also created and filled on the loader thread, followed by a fence.
+// update() polls the fences on the render thread without blocking, hands
+// the finished objects over to the ResourceManager and only then marks
+// their requests ready. Without a loader context only decoding runs in
+// the background and update() uploads up to MAX_UPLOAD_BYTES per frame.
+class ResourceLoader
+{
+public:
+    // bytes uploaded by update() per frame without a loader context; a
+    // single larger resource is still uploaded whole
+    static const size_t MAX_UPLOAD_BYTES = 8 * 1024 * 1024;
+    // finished requests the loader may get ahead of update()
+    static const size_t MAX_FINISHED = 256;
+
+    enum EState {
+        StateQueued,
+        StateLoading,
+        StateReady,
+        StateFailed
+    };
+
+    struct Image
+    {
+        unsigned width;
+        unsigned height;
+        std::vector<uint8_t> rgba;  // tightly packed, bottom row first
+    };
+
+    // run on the loader thread; return false on failure
+    typedef std::function<bool(Image&)> DecodeImageFunc;
+    typedef std::function<bool(std::vector<uint8_t>&)> DecodeBufferFunc;
+    // makes the loader context current on the calling thread (true) or
+    // releases it (false); returns false on failure
+    typedef std::function<bool(bool)> LoaderContextFunc;
+
+    // shared between the caller and the loader; read it on the render
+    // thread only
+    class Request
+    {
+    public:
+        EState getState() const { return mState.load(); }
+        bool isReady() const { return getState() == StateReady; }
+        bool isFailed() const { return getState() == StateFailed; }
+
+        // valid once ready, owned by the ResourceManager
+        TextureHandle getTexture() const { return mTexture; }
+        BufferHandle getBuffer() const { return mBuffer; }
+
+    private:
+        friend class ResourceLoader;
+
+        std::atomic<EState> mState;
+        TextureHandle mTexture;
+        BufferHandle mBuffer;
+
+        Request():
+            mState(StateQueued),
+            mTexture(),
+            mBuffer()
+        {}
+    };
+
+    struct Stats
+    {
+        uint64_t requested;
+        uint64_t completed;
+        uint64_t failed;
+        uint32_t pending;           // requested, not yet ready or failed
+        uint64_t bytesUploaded;
+        double decodeMs;            // total on the loader thread
+        double uploadMs;            // total spent issuing uploads
+        double uploadMBps;          // bytesUploaded / uploadMs
+        double averageLatencyMs;    // request to ready
+    };
+
+    ResourceLoader();
+    ~ResourceLoader();
+
+    ResourceLoader(const ResourceLoader&) = delete;
+    ResourceLoader(ResourceLoader&&) = delete;
+    ResourceLoader& operator =(const ResourceLoader&) = delete;
+    ResourceLoader& operator =(ResourceLoader&&) = delete;
+
+    // requires a current GL context; state and resources must outlive the
+    // loader. loaderContext may be empty, uploads then happen in update()
+    bool init(GLState& state,
+              ResourceManager& resources,
+              const LoaderContextFunc& loaderContext);
+    // true if GL objects are created on the loader thread
+    bool isUploadingInBackground() const { return mBackgroundUpload; }
+
+    // RGBA8 texture, mipmapped if requested
+    std::shared_ptr<const Request> loadTexture(const DecodeImageFunc& decode,
+                                               bool mipmaps = true);
+    std::shared_ptr<const Request> loadBuffer(const DecodeBufferFunc& decode,
+                                              GLenum usage = GL_STATIC_DRAW);
+
+    // publishes finished requests; call once per frame on the render
+    // thread
+    void update();
+
+    Stats getStats() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Job
+    {
+        std::shared_ptr<Request> request;
+        DecodeImageFunc decodeImage;    // set for textures
+        DecodeBufferFunc decodeBuffer;  // set for buffers
+        bool mipmaps;
+        GLenum usage;
+        Clock::time_point requested;
+
+        Image image;
+        std::vector<uint8_t> data;
+        bool decoded;
+        bool uploaded;
+        GLuint object;      // texture or buffer
+        unsigned levels;
+        GLsync fence;       // 0 if the upload is already complete
+        size_t bytes;
+        double decodeMs;
+        double uploadMs;
+    };
+
+    GLState* mState;
+    ResourceManager* mResources;
+    LoaderContextFunc mLoaderContext;
+    bool mBackgroundUpload;
+
+    std::thread mThread;
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::deque<std::shared_ptr<Job>> mQueue;
+    bool mQuit;
+    // loader thread to update()
+    utils::LockFreeQueue<std::shared_ptr<Job>> mFinished;
+    // update() only
+    std::vector<std::shared_ptr<Job>> mWaiting;
+
+    Stats mStats;
+    double mTotalLatencyMs;
+
+    std::shared_ptr<const Request> enqueue(const std::shared_ptr<Job>& job);
+    void threadMain(std::promise<bool>* started);
+    void decode(Job& job);
+    // state is NULL on the loader thread, which has its own bindings
+    bool upload(Job& job,
+                GLState* state);
+    void publish(Job& job);
+    void deleteObject(Job& job,
+                      GLState* state);
+};
+
+} // namespace sb
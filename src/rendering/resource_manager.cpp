@@ -0,0 +1,490 @@
+#include "rendering/resource_manager.h"
+
+#include <algorithm>
+#include <cassert>
+#include <tuple>
+
+#include "rendering/gl_state.h"
+#include "utils/gl.h"
+#include "utils/logger.h"
+
+namespace sb {
+namespace {
+
+const char* const TYPE_NAMES[ResourceTypeCount] = {
+    "texture",
+    "buffer",
+    "program"
+};
+
+// format and type glTexImage2D accepts together with the internal format,
+// used only without immutable texture storage
+void getPixelTransfer(GLenum internalFormat,
+                      GLenum& format,
+                      GLenum& type)
+{
+    switch (internalFormat) {
+    case GL_DEPTH_COMPONENT16:
+    case GL_DEPTH_COMPONENT24:
+    case GL_DEPTH_COMPONENT32:
+    case GL_DEPTH_COMPONENT32F:
+        format = GL_DEPTH_COMPONENT;
+        type = GL_FLOAT;
+        break;
+    case GL_DEPTH24_STENCIL8:
+    case GL_DEPTH32F_STENCIL8:
+        format = GL_DEPTH_STENCIL;
+        type = GL_UNSIGNED_INT_24_8;
+        break;
+    default:
+        format = GL_RGBA;
+        type = GL_UNSIGNED_BYTE;
+        break;
+    }
+}
+
+} // namespace
+
+bool ResourceManager::PoolKey::operator <(const PoolKey& k) const
+{
+    return std::tie(type, format, width, height, levels, size)
+           < std::tie(k.type, k.format, k.width, k.height, k.levels, k.size);
+}
+
+ResourceManager::ResourceManager():
+    mState(NULL),
+    mFrame(0),
+    mCompletedFrames(0),
+    mTables(),
+    mPending(),
+    mPool(),
+    mFences(),
+    mStats()
+{
+}
+
+ResourceManager::~ResourceManager()
+{
+    if (!mState) {
+        return;
+    }
+
+    for (unsigned type = 0; type < ResourceTypeCount; ++type) {
+        for (const Slot& slot: mTables[type].slots) {
+            if (slot.id) {
+                deleteObject((EResourceType)type, slot.id);
+            }
+        }
+    }
+    for (const Pending& p: mPending) {
+        deleteObject(p.type, p.id);
+    }
+    for (const auto& it: mPool) {
+        for (const Pooled& p: it.second) {
+            deleteObject(it.first.type, p.id);
+        }
+    }
+    for (const FrameFence& f: mFences) {
+        glDeleteSync(f.fence);
+    }
+}
+
+bool ResourceManager::init(GLState& state)
+{
+    mState = &state;
+    return true;
+}
+
+TextureHandle ResourceManager::createTexture(const TextureDesc& desc)
+{
+    PoolKey key = { ResourceTexture, desc.format, desc.width, desc.height,
+                    std::max(1u, desc.levels), 0 };
+
+    GLuint texture = takePooled(key);
+    if (!texture) {
+        if (GL_CHECK(glGenTextures(1, &texture))) {
+            return TextureHandle();
+        }
+
+        mState->activeTexture(0);
+        mState->bindTexture(0, GL_TEXTURE_2D, texture);
+
+        bool failed = false;
+        if (glTexStorage2D) {
+            if (GL_CHECK(glTexStorage2D(GL_TEXTURE_2D, key.levels,
+                                        desc.format, desc.width,
+                                        desc.height))) {
+                failed = true;
+            }
+        } else {
+            GLenum format;
+            GLenum type;
+            getPixelTransfer(desc.format, format, type);
+
+            for (unsigned level = 0; level < key.levels && !failed; ++level) {
+                if (GL_CHECK(glTexImage2D(GL_TEXTURE_2D, level, desc.format,
+                                          std::max(1u, desc.width >> level),
+                                          std::max(1u, desc.height >> level),
+                                          0, format, type, NULL))) {
+                    failed = true;
+                }
+            }
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                            key.levels - 1);
+        }
+
+        if (failed) {
+            gLog.err("cannot allocate %ux%u texture of format 0x%x\n",
+                     desc.width, desc.height, desc.format);
+            mState->deleteTexture(texture);
+            return TextureHandle();
+        }
+        ++mStats.created;
+    }
+
+    uint32_t index = allocateSlot(ResourceTexture, texture, key);
+    Slot& slot = mTables[ResourceTexture].slots[index];
+    slot.texture = desc;
+    slot.texture.levels = key.levels;
+    return TextureHandle(index, slot.generation);
+}
+
+BufferHandle ResourceManager::createBuffer(const BufferDesc& desc)
+{
+    PoolKey key = { ResourceBuffer, desc.usage, 0, 0, 0, desc.size };
+
+    GLuint buffer = takePooled(key);
+    if (!buffer) {
+        if (GL_CHECK(glGenBuffers(1, &buffer))) {
+            return BufferHandle();
+        }
+
+        mState->bindBuffer(GL_ARRAY_BUFFER, buffer);
+        if (GL_CHECK(glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)desc.size,
+                                  NULL, desc.usage))) {
+            gLog.err("cannot allocate buffer of %zu bytes\n", desc.size);
+            mState->deleteBuffer(buffer);
+            return BufferHandle();
+        }
+        ++mStats.created;
+    }
+
+    uint32_t index = allocateSlot(ResourceBuffer, buffer, key);
+    mTables[ResourceBuffer].slots[index].buffer = desc;
+    return BufferHandle(index, mTables[ResourceBuffer].slots[index].generation);
+}
+
+TextureHandle ResourceManager::adoptTexture(TextureId texture,
+                                            const TextureDesc& desc)
+{
+    if (!texture) {
+        return TextureHandle();
+    }
+
+    PoolKey key = { ResourceTexture, desc.format, desc.width, desc.height,
+                    std::max(1u, desc.levels), 0 };
+    uint32_t index = allocateSlot(ResourceTexture, texture, key);
+    Slot& slot = mTables[ResourceTexture].slots[index];
+    slot.texture = desc;
+    slot.texture.levels = key.levels;
+    return TextureHandle(index, slot.generation);
+}
+
+BufferHandle ResourceManager::adoptBuffer(BufferId buffer,
+                                          const BufferDesc& desc)
+{
+    if (!buffer) {
+        return BufferHandle();
+    }
+
+    PoolKey key = { ResourceBuffer, desc.usage, 0, 0, 0, desc.size };
+    uint32_t index = allocateSlot(ResourceBuffer, buffer, key);
+    mTables[ResourceBuffer].slots[index].buffer = desc;
+    return BufferHandle(index, mTables[ResourceBuffer].slots[index].generation);
+}
+
+ProgramHandle ResourceManager::adoptProgram(ProgramId program)
+{
+    if (!program) {
+        return ProgramHandle();
+    }
+
+    PoolKey key = { ResourceProgram, 0, 0, 0, 0, 0 };
+    uint32_t index = allocateSlot(ResourceProgram, program, key);
+    return ProgramHandle(index,
+                         mTables[ResourceProgram].slots[index].generation);
+}
+
+uint32_t ResourceManager::allocateSlot(EResourceType type,
+                                       GLuint id,
+                                       const PoolKey& key)
+{
+    Table& table = mTables[type];
+
+    uint32_t index;
+    if (table.freeSlots.empty()) {
+        index = (uint32_t)table.slots.size();
+        assert(index < ((ResourceHandle)1 << TextureHandle::INDEX_BITS));
+        table.slots.push_back(Slot());
+        table.slots.back().generation = 1;
+    } else {
+        index = table.freeSlots.back();
+        table.freeSlots.pop_back();
+    }
+
+    Slot& slot = table.slots[index];
+    slot.id = id;
+    slot.lastUsedFrame = mFrame;
+    slot.key = key;
+    slot.texture = TextureDesc();
+    slot.buffer = BufferDesc();
+
+    ++mStats.live[type];
+    return index;
+}
+
+const ResourceManager::Slot*
+ResourceManager::findSlot(EResourceType type,
+                          ResourceHandle value,
+                          uint32_t index,
+                          uint32_t generation) const
+{
+    const Table& table = mTables[type];
+    if (value == 0 || index >= table.slots.size()) {
+        return NULL;
+    }
+
+    const Slot& slot = table.slots[index];
+    if (slot.generation != generation || !slot.id) {
+        return NULL;
+    }
+    return &slot;
+}
+
+GLuint ResourceManager::lookup(EResourceType type,
+                               ResourceHandle value,
+                               uint32_t index,
+                               uint32_t generation)
+{
+    const Slot* slot = findSlot(type, value, index, generation);
+    if (!slot) {
+        if (value != 0) {
+            ++mStats.staleLookups;
+            gLog.warn("stale %s handle %llx\n", TYPE_NAMES[type],
+                      (unsigned long long)value);
+        }
+        return 0;
+    }
+
+    mTables[type].slots[index].lastUsedFrame = mFrame;
+    return slot->id;
+}
+
+TextureId ResourceManager::getTexture(TextureHandle handle)
+{
+    return lookup(ResourceTexture, handle.getValue(), handle.getIndex(),
+                  handle.getGeneration());
+}
+
+BufferId ResourceManager::getBuffer(BufferHandle handle)
+{
+    return lookup(ResourceBuffer, handle.getValue(), handle.getIndex(),
+                  handle.getGeneration());
+}
+
+ProgramId ResourceManager::getProgram(ProgramHandle handle)
+{
+    return lookup(ResourceProgram, handle.getValue(), handle.getIndex(),
+                  handle.getGeneration());
+}
+
+const ResourceManager::TextureDesc&
+ResourceManager::getDesc(TextureHandle handle) const
+{
+    assert(isAlive(handle));
+    return mTables[ResourceTexture].slots[handle.getIndex()].texture;
+}
+
+const ResourceManager::BufferDesc&
+ResourceManager::getDesc(BufferHandle handle) const
+{
+    assert(isAlive(handle));
+    return mTables[ResourceBuffer].slots[handle.getIndex()].buffer;
+}
+
+bool ResourceManager::isAlive(TextureHandle handle) const
+{
+    return findSlot(ResourceTexture, handle.getValue(), handle.getIndex(),
+                    handle.getGeneration()) != NULL;
+}
+
+bool ResourceManager::isAlive(BufferHandle handle) const
+{
+    return findSlot(ResourceBuffer, handle.getValue(), handle.getIndex(),
+                    handle.getGeneration()) != NULL;
+}
+
+bool ResourceManager::isAlive(ProgramHandle handle) const
+{
+    return findSlot(ResourceProgram, handle.getValue(), handle.getIndex(),
+                    handle.getGeneration()) != NULL;
+}
+
+void ResourceManager::destroy(TextureHandle handle)
+{
+    if (isAlive(handle)) {
+        release(ResourceTexture, handle.getIndex(), handle.getGeneration());
+    }
+}
+
+void ResourceManager::destroy(BufferHandle handle)
+{
+    if (isAlive(handle)) {
+        release(ResourceBuffer, handle.getIndex(), handle.getGeneration());
+    }
+}
+
+void ResourceManager::destroy(ProgramHandle handle)
+{
+    if (isAlive(handle)) {
+        release(ResourceProgram, handle.getIndex(), handle.getGeneration());
+    }
+}
+
+void ResourceManager::release(EResourceType type,
+                              uint32_t index,
+                              uint32_t generation)
+{
+    Table& table = mTables[type];
+    Slot& slot = table.slots[index];
+
+    mPending.push_back({ type, slot.id, slot.key, slot.lastUsedFrame });
+
+    // zero is never a valid generation
+    uint32_t next = (generation + 1)
+                    & (((ResourceHandle)1 << TextureHandle::GENERATION_BITS)
+                       - 1);
+    slot.generation = next ? next : 1;
+    slot.id = 0;
+    table.freeSlots.push_back(index);
+
+    --mStats.live[type];
+    ++mStats.pending;
+}
+
+GLuint ResourceManager::takePooled(const PoolKey& key)
+{
+    auto it = mPool.find(key);
+    if (it == mPool.end() || it->second.empty()) {
+        return 0;
+    }
+
+    // most recently released first, the oldest ones get trimmed
+    GLuint id = it->second.back().id;
+    it->second.pop_back();
+
+    --mStats.pooled;
+    ++mStats.reused;
+    return id;
+}
+
+void ResourceManager::deleteObject(EResourceType type,
+                                   GLuint id)
+{
+    switch (type) {
+    case ResourceTexture:
+        mState->deleteTexture(id);
+        break;
+    case ResourceBuffer:
+        mState->deleteBuffer(id);
+        break;
+    case ResourceProgram:
+        mState->deleteProgram(id);
+        break;
+    default:
+        assert(!"invalid resource type");
+        break;
+    }
+
+    ++mStats.deleted;
+}
+
+void ResourceManager::endFrame()
+{
+    if (GLEW_ARB_sync) {
+        GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        mFences.push_back({ mFrame, fence });
+        retireFences();
+    } else if (mFrame + 1 >= FRAMES_WITHOUT_FENCE) {
+        mCompletedFrames = mFrame + 1 - FRAMES_WITHOUT_FENCE;
+    }
+
+    recyclePending();
+    trimPool();
+
+    ++mFrame;
+}
+
+void ResourceManager::retireFences()
+{
+    while (!mFences.empty()) {
+        const FrameFence& f = mFences.front();
+        if (glClientWaitSync(f.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+
+        mCompletedFrames = f.frame + 1;
+        glDeleteSync(f.fence);
+        mFences.pop_front();
+    }
+}
+
+void ResourceManager::recyclePending()
+{
+    // resources destroyed later may have been used earlier, so the whole
+    // queue is scanned
+    for (size_t i = 0; i < mPending.size();) {
+        const Pending& p = mPending[i];
+
+        if (p.lastUsedFrame >= mCompletedFrames) {
+            ++i;
+            continue;
+        }
+
+        if (p.type == ResourceProgram) {
+            deleteObject(p.type, p.id);
+        } else {
+            mPool[p.key].push_back({ p.id, mFrame });
+            ++mStats.pooled;
+        }
+
+        mPending[i] = mPending.back();
+        mPending.pop_back();
+        --mStats.pending;
+    }
+}
+
+void ResourceManager::trimPool()
+{
+    for (auto it = mPool.begin(); it != mPool.end();) {
+        std::vector<Pooled>& pooled = it->second;
+
+        // sorted by release frame, oldest first
+        size_t expired = 0;
+        while (expired < pooled.size()
+               && mFrame - pooled[expired].releasedFrame > MAX_POOLED_FRAMES) {
+            deleteObject(it->first.type, pooled[expired].id);
+            ++expired;
+        }
+        pooled.erase(pooled.begin(), pooled.begin() + expired);
+        mStats.pooled -= (uint32_t)expired;
+
+        if (pooled.empty()) {
+            it = mPool.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+} // namespace sb
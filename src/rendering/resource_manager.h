@@ -0,0 +1,239 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "rendering/types.h"
+
+namespace sb {
+
+class GLState;
+
+enum EResourceType {
+    ResourceTexture,
+    ResourceBuffer,
+    ResourceProgram,
+    ResourceTypeCount
+};
+
+// Slot index in the low bits, generation of the slot in the high ones; the
+// generation changes whenever the slot is freed, so handles to destroyed
+// resources are recognized as stale. A zero value is never valid.
+template<EResourceType Type>
+class Handle
+{
+public:
+    static const unsigned INDEX_BITS = sizeof(ResourceHandle) == 8 ? 32 : 20;
+    static const unsigned GENERATION_BITS = sizeof(ResourceHandle) * 8
+                                            - INDEX_BITS;
+
+    Handle(): mValue(0) {}
+
+    bool isValid() const { return mValue != 0; }
+    ResourceHandle getValue() const { return mValue; }
+
+    bool operator ==(const Handle& h) const { return mValue == h.mValue; }
+    bool operator !=(const Handle& h) const { return mValue != h.mValue; }
+
+private:
+    friend class ResourceManager;
+
+    ResourceHandle mValue;
+
+    Handle(uint32_t index,
+           uint32_t generation):
+        mValue(((ResourceHandle)generation << INDEX_BITS) | index)
+    {}
+
+    uint32_t getIndex() const
+    {
+        return (uint32_t)(mValue & (((ResourceHandle)1 << INDEX_BITS) - 1));
+    }
+    uint32_t getGeneration() const
+    {
+        return (uint32_t)(mValue >> INDEX_BITS);
+    }
+};
+
+typedef Handle<ResourceTexture> TextureHandle;
+typedef Handle<ResourceBuffer> BufferHandle;
+typedef Handle<ResourceProgram> ProgramHandle;
+
+// Owns GL textures, buffers and programs behind generational handles kept
+// in one dense slot array per resource type.
+//
+// Looking a handle up marks the resource as used by the current frame.
+// destroy() invalidates the handle immediately, but the GL object is only
+// released once the fence of the last frame that used it has signaled.
+// Released textures and buffers go to a pool and are handed out again by
+// create calls with the same description, skipping storage allocation;
+// pooled objects unused for MAX_POOLED_FRAMES frames are deleted.
+class ResourceManager
+{
+public:
+    // frames a pooled object is kept for
+    static const unsigned MAX_POOLED_FRAMES = 60;
+    // without ARB_sync, frames after which the GPU is assumed to be done
+    static const unsigned FRAMES_WITHOUT_FENCE = 3;
+
+    struct TextureDesc
+    {
+        unsigned width;
+        unsigned height;
+        GLenum format;      // sized internal format, e.g. GL_RGBA8
+        unsigned levels;    // mip levels allocated
+    };
+
+    struct BufferDesc
+    {
+        size_t size;
+        GLenum usage;       // e.g. GL_STATIC_DRAW
+    };
+
+    struct Stats
+    {
+        uint32_t live[ResourceTypeCount];
+        uint32_t pending;       // destroyed, waiting for the GPU
+        uint32_t pooled;
+        uint64_t created;       // GL objects ever created
+        uint64_t reused;        // create calls served from the pool
+        uint64_t deleted;       // GL objects ever deleted
+        uint64_t staleLookups;
+    };
+
+    ResourceManager();
+    ~ResourceManager();
+
+    ResourceManager(const ResourceManager&) = delete;
+    ResourceManager(ResourceManager&&) = delete;
+    ResourceManager& operator =(const ResourceManager&) = delete;
+    ResourceManager& operator =(ResourceManager&&) = delete;
+
+    // requires a current GL context; state must outlive the manager
+    bool init(GLState& state);
+
+    // 2D texture with uninitialized storage, contents of reused ones are
+    // undefined; invalid handle on failure
+    TextureHandle createTexture(const TextureDesc& desc);
+    // buffer with uninitialized storage of desc.size bytes
+    BufferHandle createBuffer(const BufferDesc& desc);
+    // takes ownership of objects created elsewhere, e.g. by a context
+    // sharing objects with this one; desc must match their storage
+    TextureHandle adoptTexture(TextureId texture,
+                               const TextureDesc& desc);
+    BufferHandle adoptBuffer(BufferId buffer,
+                             const BufferDesc& desc);
+    // takes ownership of a linked program
+    ProgramHandle adoptProgram(ProgramId program);
+
+    // 0 for stale or invalid handles
+    TextureId getTexture(TextureHandle handle);
+    BufferId getBuffer(BufferHandle handle);
+    ProgramId getProgram(ProgramHandle handle);
+    // valid handles only
+    const TextureDesc& getDesc(TextureHandle handle) const;
+    const BufferDesc& getDesc(BufferHandle handle) const;
+
+    bool isAlive(TextureHandle handle) const;
+    bool isAlive(BufferHandle handle) const;
+    bool isAlive(ProgramHandle handle) const;
+
+    // stale handles are ignored
+    void destroy(TextureHandle handle);
+    void destroy(BufferHandle handle);
+    void destroy(ProgramHandle handle);
+
+    // call once per frame, after the frame was submitted
+    void endFrame();
+
+    const Stats& getStats() const { return mStats; }
+
+private:
+    // textures and buffers of equal descriptions are interchangeable
+    struct PoolKey
+    {
+        EResourceType type;
+        GLenum format;      // or buffer usage
+        unsigned width;
+        unsigned height;
+        unsigned levels;
+        size_t size;
+
+        bool operator <(const PoolKey& k) const;
+    };
+
+    struct Slot
+    {
+        GLuint id;          // 0 while free
+        uint32_t generation;
+        uint64_t lastUsedFrame;
+        PoolKey key;
+        TextureDesc texture;
+        BufferDesc buffer;
+    };
+
+    struct Table
+    {
+        std::vector<Slot> slots;
+        std::vector<uint32_t> freeSlots;
+    };
+
+    struct Pending
+    {
+        EResourceType type;
+        GLuint id;
+        PoolKey key;
+        uint64_t lastUsedFrame;
+    };
+
+    struct Pooled
+    {
+        GLuint id;
+        uint64_t releasedFrame;
+    };
+
+    struct FrameFence
+    {
+        uint64_t frame;
+        GLsync fence;
+    };
+
+    GLState* mState;
+    uint64_t mFrame;
+    // frames before this one are known to be finished by the GPU
+    uint64_t mCompletedFrames;
+
+    Table mTables[ResourceTypeCount];
+    std::deque<Pending> mPending;
+    std::map<PoolKey, std::vector<Pooled>> mPool;
+    std::deque<FrameFence> mFences;
+
+    Stats mStats;
+
+    uint32_t allocateSlot(EResourceType type,
+                          GLuint id,
+                          const PoolKey& key);
+    const Slot* findSlot(EResourceType type,
+                         ResourceHandle value,
+                         uint32_t index,
+                         uint32_t generation) const;
+    GLuint lookup(EResourceType type,
+                  ResourceHandle value,
+                  uint32_t index,
+                  uint32_t generation);
+    void release(EResourceType type,
+                 uint32_t index,
+                 uint32_t generation);
+
+    GLuint takePooled(const PoolKey& key);
+    void deleteObject(EResourceType type,
+                      GLuint id);
+    void retireFences();
+    void recyclePending();
+    void trimPool();
+};
+
+} // namespace sb
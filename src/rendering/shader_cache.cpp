@@ -0,0 +1,331 @@
+#include "rendering/shader_cache.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+#ifdef PLATFORM_LINUX
+# include <sys/stat.h>
+# include <sys/types.h>
+#endif
+
+#include "rendering/frame_uniforms.h"
+#include "utils/logger.h"
+#include "utils/string.h"
+
+namespace sb {
+namespace {
+
+const uint32_t BINARY_MAGIC = 0x53424350; // "SBCP"
+
+struct BinaryHeader
+{
+    uint32_t magic;
+    uint32_t format;
+    uint32_t length;
+};
+
+uint64_t hashFNV1a(const std::string& data,
+                   uint64_t hash = 14695981039346656037ULL)
+{
+    for (unsigned char c: data) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string insertDefines(const std::string& source,
+                          const std::vector<std::string>& defines)
+{
+    if (defines.empty()) {
+        return source;
+    }
+
+    std::string lines;
+    for (const std::string& define: defines) {
+        lines += "#define " + define + "\n";
+    }
+
+    // #version has to stay the first directive
+    size_t at = 0;
+    if (source.compare(0, 8, "#version") == 0) {
+        at = source.find('\n');
+        at = (at == std::string::npos) ? source.size() : at + 1;
+    }
+
+    return source.substr(0, at) + lines + source.substr(at);
+}
+
+ShaderId compileShader(GLenum type,
+                       const std::string& source,
+                       const std::string& name)
+{
+    ShaderId shader = glCreateShader(type);
+    const GLchar* src = source.c_str();
+    glShaderSource(shader, 1, &src, NULL);
+    glCompileShader(shader);
+
+    GLint status = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+        char log[4096];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        gLog.err("cannot compile %s shader of %s:\n%s\n",
+                 type == GL_VERTEX_SHADER ? "vertex" : "fragment",
+                 name.c_str(), log);
+        glDeleteShader(shader);
+        return 0;
+    }
+
+    return shader;
+}
+
+bool isLinked(ProgramId program)
+{
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    return status == GL_TRUE;
+}
+
+} // namespace
+
+ShaderCache::ShaderCache(const std::string& cacheDir):
+    mCacheDir(cacheDir),
+    mDriverId(),
+    mBinariesSupported(false),
+    mPrograms(),
+    mEntries()
+{
+}
+
+ShaderCache::~ShaderCache()
+{
+    for (auto& it: mPrograms) {
+        glDeleteProgram(it.second);
+    }
+}
+
+bool ShaderCache::init()
+{
+    mDriverId = utils::makeString((const char*)glGetString(GL_VENDOR), '|',
+                                  (const char*)glGetString(GL_RENDERER), '|',
+                                  (const char*)glGetString(GL_VERSION));
+
+    GLint numFormats = 0;
+    if (GLEW_ARB_get_program_binary) {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    }
+
+    mBinariesSupported = numFormats > 0;
+    if (!mBinariesSupported) {
+        gLog.warn("program binaries not supported, shaders will be "
+                  "compiled on every run\n");
+        return true;
+    }
+
+#ifdef PLATFORM_LINUX
+    mkdir(mCacheDir.c_str(), 0755);
+#endif
+
+    return true;
+}
+
+std::string ShaderCache::getBinaryPath(uint64_t key) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return mCacheDir + "/" + name;
+}
+
+ProgramId ShaderCache::loadBinary(uint64_t key, bool& rejected)
+{
+    rejected = false;
+
+    std::string data = utils::readFile(getBinaryPath(key));
+    if (data.size() < sizeof(BinaryHeader)) {
+        return 0;
+    }
+
+    BinaryHeader header;
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.magic != BINARY_MAGIC
+            || header.length != data.size() - sizeof(header)) {
+        rejected = true;
+        return 0;
+    }
+
+    ProgramId program = glCreateProgram();
+    glProgramBinary(program, header.format, data.data() + sizeof(header),
+                    header.length);
+
+    // drivers reject binaries e.g. after an update, despite matching key
+    if (!isLinked(program)) {
+        glDeleteProgram(program);
+        rejected = true;
+        return 0;
+    }
+
+    return program;
+}
+
+void ShaderCache::storeBinary(uint64_t key, ProgramId program)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, NULL, &format, binary.data());
+
+    BinaryHeader header = { BINARY_MAGIC, format, (uint32_t)length };
+
+    std::string path = getBinaryPath(key);
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        gLog.warn("cannot write program binary to %s\n", path.c_str());
+        return;
+    }
+
+    file.write((const char*)&header, sizeof(header));
+    file.write(binary.data(), binary.size());
+}
+
+ProgramId ShaderCache::build(const std::string& name,
+                             const std::string& vertexSource,
+                             const std::string& fragmentSource)
+{
+    ShaderId vs = compileShader(GL_VERTEX_SHADER, vertexSource, name);
+    ShaderId fs = compileShader(GL_FRAGMENT_SHADER, fragmentSource, name);
+    if (!vs || !fs) {
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+        return 0;
+    }
+
+    ProgramId program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+
+    glBindAttribLocation(program, AttribPosition, "position");
+    glBindAttribLocation(program, AttribColor, "color");
+    glBindAttribLocation(program, AttribTexcoord, "texcoord");
+    glBindAttribLocation(program, AttribInstanceTransform, "instanceTransform");
+    glBindAttribLocation(program, AttribInstanceColor, "instanceColor");
+
+    if (mBinariesSupported) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                            GL_TRUE);
+    }
+
+    glLinkProgram(program);
+
+    // shaders are flagged for deletion, freed along with the program
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    if (!isLinked(program)) {
+        char log[4096];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        gLog.err("cannot link %s:\n%s\n", name.c_str(), log);
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+ProgramId ShaderCache::getProgram(const std::string& vertexPath,
+                                  const std::string& fragmentPath,
+                                  const std::vector<std::string>& defines)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::string name = vertexPath + " + " + fragmentPath;
+    std::string vertexSource = insertDefines(utils::readFile(vertexPath),
+                                             defines);
+    std::string fragmentSource = insertDefines(utils::readFile(fragmentPath),
+                                               defines);
+
+    if (vertexSource.empty() || fragmentSource.empty()) {
+        gLog.err("cannot read shader sources of %s\n", name.c_str());
+        mEntries.push_back({ name, ResultFailed, 0.0 });
+        return 0;
+    }
+
+    uint64_t key = hashFNV1a(vertexSource);
+    key = hashFNV1a(fragmentSource, key);
+    key = hashFNV1a(mDriverId, key);
+
+    EResult result;
+    ProgramId program = 0;
+
+    auto it = mPrograms.find(key);
+    if (it != mPrograms.end()) {
+        program = it->second;
+        result = ResultMemoryHit;
+    } else {
+        bool rejected = false;
+        if (mBinariesSupported) {
+            program = loadBinary(key, rejected);
+        }
+
+        if (program) {
+            result = ResultBinaryHit;
+        } else {
+            program = build(name, vertexSource, fragmentSource);
+            result = rejected ? ResultRejected : ResultCompiled;
+
+            if (program && mBinariesSupported) {
+                storeBinary(key, program);
+            }
+        }
+
+        if (program) {
+            // block bindings are not guaranteed to survive in binaries
+            FrameUniforms::bindProgram(program);
+            mPrograms[key] = program;
+        } else {
+            result = ResultFailed;
+        }
+    }
+
+    std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+    mEntries.push_back({ name, result, elapsed.count() });
+
+    return program;
+}
+
+void ShaderCache::logReport() const
+{
+    static const char* RESULT_NAMES[] = {
+        "memory hit", "binary hit", "compiled", "rejected, compiled", "FAILED"
+    };
+
+    unsigned hits = 0;
+    unsigned misses = 0;
+    double totalMs = 0.0;
+
+    gLog.info("shader cache report:\n");
+    for (const Entry& entry: mEntries) {
+        gLog.info("  %-20s%8.2f ms  %s\n", RESULT_NAMES[entry.result],
+                  entry.milliseconds, entry.name.c_str());
+
+        if (entry.result == ResultMemoryHit || entry.result == ResultBinaryHit) {
+            ++hits;
+        } else {
+            ++misses;
+        }
+        totalMs += entry.milliseconds;
+    }
+
+    gLog.info("shader cache: %u hits, %u misses, %.2f ms total\n",
+              hits, misses, totalMs);
+}
+
+} // namespace sb
+
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "rendering/types.h"
+
+namespace sb {
+
+// Builds programs from shader files and keeps their linked binaries on
+// disk, so that later runs can skip the shader compiler entirely. Binaries
+// are keyed by a hash of sources, defines and the driver identification;
+// a binary rejected by the driver is transparently rebuilt from sources.
+class ShaderCache
+{
+public:
+    enum EResult {
+        ResultMemoryHit,    // already loaded in this run
+        ResultBinaryHit,    // program binary loaded from disk
+        ResultCompiled,     // no usable binary, built from sources
+        ResultRejected,     // binary rejected by the driver, rebuilt
+        ResultFailed
+    };
+
+    struct Entry
+    {
+        std::string name;
+        EResult result;
+        double milliseconds;
+    };
+
+    explicit ShaderCache(const std::string& cacheDir = "shader_cache");
+    ~ShaderCache();
+
+    ShaderCache(const ShaderCache&) = delete;
+    ShaderCache(ShaderCache&&) = delete;
+    ShaderCache& operator =(const ShaderCache&) = delete;
+    ShaderCache& operator =(ShaderCache&&) = delete;
+
+    // requires a current GL context
+    bool init();
+
+    // defines are inserted as "#define <define>" lines right after #version;
+    // returns 0 on failure
+    ProgramId getProgram(const std::string& vertexPath,
+                         const std::string& fragmentPath,
+                         const std::vector<std::string>& defines = {});
+
+    const std::vector<Entry>& getEntries() const { return mEntries; }
+    void logReport() const;
+
+private:
+    std::string mCacheDir;
+    std::string mDriverId;
+    bool mBinariesSupported;
+
+    std::unordered_map<uint64_t, ProgramId> mPrograms;
+    std::vector<Entry> mEntries;
+
+    std::string getBinaryPath(uint64_t key) const;
+    ProgramId loadBinary(uint64_t key, bool& rejected);
+    void storeBinary(uint64_t key, ProgramId program);
+    ProgramId build(const std::string& name,
+                    const std::string& vertexSource,
+                    const std::string& fragmentSource);
+};
+
+} // namespace sb
+
@@ -0,0 +1,116 @@
+#include "rendering/sort_key.h"
+
+#include <cstring>
+#include <utility>
+
+namespace sb {
+namespace {
+
+uint64_t bits(uint64_t value,
+              unsigned count)
+{
+    return value & ((1ull << count) - 1);
+}
+
+// bit patterns of non-negative floats sort like the floats themselves, so
+// dropping the sign and low mantissa bits keeps the order with relative
+// precision
+uint64_t quantizeDepth(float depth)
+{
+    uint32_t u;
+    memcpy(&u, &depth, sizeof(u));
+    if (u & 0x80000000u) {
+        return 0;
+    }
+    return u >> (31 - SortKey::DEPTH_BITS);
+}
+
+} // namespace
+
+static_assert(SortKey::LAYER_BITS + 2 + SortKey::PROGRAM_BITS
+              + SortKey::TEXTURE_BITS + SortKey::SHAPE_BITS
+              + SortKey::DEPTH_BITS == 64,
+              "SortKey fields do not fill 64 bits");
+
+uint64_t SortKey::make(uint8_t layer,
+                       bool translucent,
+                       EProjectionType projection,
+                       ProgramId program,
+                       TextureId texture,
+                       uint32_t shape,
+                       float depth)
+{
+    uint64_t key = bits(layer, LAYER_BITS);
+    key = (key << 1) | (translucent ? 1 : 0);
+    key = (key << 1) | (projection == ProjectionPerspective ? 1 : 0);
+
+    uint64_t state = bits(program, PROGRAM_BITS);
+    state = (state << TEXTURE_BITS) | bits(texture, TEXTURE_BITS);
+    state = (state << SHAPE_BITS) | bits(shape, SHAPE_BITS);
+
+    uint64_t depthBits = quantizeDepth(depth);
+    const unsigned STATE_BITS = PROGRAM_BITS + TEXTURE_BITS + SHAPE_BITS;
+
+    if (translucent) {
+        // furthest first
+        depthBits = bits(~depthBits, DEPTH_BITS);
+        key = (key << DEPTH_BITS) | depthBits;
+        return (key << STATE_BITS) | state;
+    }
+
+    key = (key << STATE_BITS) | state;
+    return (key << DEPTH_BITS) | depthBits;
+}
+
+void radixSort(std::vector<SortEntry>& entries,
+               std::vector<SortEntry>& scratch)
+{
+    const size_t PASSES = sizeof(uint64_t);
+    const size_t count = entries.size();
+    if (count < 2) {
+        return;
+    }
+
+    // all histograms in a single read of the input
+    uint32_t histograms[PASSES][256];
+    memset(histograms, 0, sizeof(histograms));
+
+    for (const SortEntry& e: entries) {
+        for (size_t pass = 0; pass < PASSES; ++pass) {
+            ++histograms[pass][(e.key >> (pass * 8)) & 0xff];
+        }
+    }
+
+    scratch.resize(count);
+    SortEntry* src = entries.data();
+    SortEntry* dst = scratch.data();
+
+    for (size_t pass = 0; pass < PASSES; ++pass) {
+        uint32_t* histogram = histograms[pass];
+        unsigned shift = (unsigned)(pass * 8);
+
+        // every key has the same byte here, order would not change
+        if (histogram[(src[0].key >> shift) & 0xff] == count) {
+            continue;
+        }
+
+        uint32_t offset = 0;
+        for (size_t bucket = 0; bucket < 256; ++bucket) {
+            uint32_t n = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += n;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            dst[histogram[(src[i].key >> shift) & 0xff]++] = src[i];
+        }
+
+        std::swap(src, dst);
+    }
+
+    if (src != entries.data()) {
+        entries.swap(scratch);
+    }
+}
+
+} // namespace sb
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "rendering/types.h"
+
+namespace sb {
+
+// Packed 64-bit draw ordering key, most significant bits first:
+//
+//   opaque:      layer:4 | 0:1 | projection:1 | program:14 | texture:14
+//                | shape:2 | depth:28
+//   translucent: layer:4 | 1:1 | projection:1 | ~depth:28 | program:14
+//                | texture:14 | shape:2
+//
+// Sorting in ascending order draws layers in order and opaque geometry
+// before translucent one. Opaque draws are grouped by state, front-to-back
+// within a group; translucent draws go back-to-front regardless of state.
+// Program and texture ids are truncated, so distinct ones may share a group;
+// the key only orders draws, it does not identify their state.
+struct SortKey
+{
+    static const unsigned LAYER_BITS = 4;
+    static const unsigned PROGRAM_BITS = 14;
+    static const unsigned TEXTURE_BITS = 14;
+    static const unsigned SHAPE_BITS = 2;
+    static const unsigned DEPTH_BITS = 28;
+
+    static const uint8_t MAX_LAYER = (1 << LAYER_BITS) - 1;
+
+    // depth is the distance from the viewer, must not be negative; shape is
+    // a small index, not a GL enum
+    static uint64_t make(uint8_t layer,
+                         bool translucent,
+                         EProjectionType projection,
+                         ProgramId program,
+                         TextureId texture,
+                         uint32_t shape,
+                         float depth);
+};
+
+struct SortEntry
+{
+    uint64_t key;
+    uint32_t index;
+};
+
+// Stable LSD radix sort on SortEntry::key, 8 bits per pass. Passes over
+// bytes that are equal for all entries are skipped. scratch is resized to
+// entries.size() and its contents are undefined afterwards.
+void radixSort(std::vector<SortEntry>& entries,
+               std::vector<SortEntry>& scratch);
+
+} // namespace sb
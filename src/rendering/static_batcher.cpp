@@ -0,0 +1,410 @@
+#include "rendering/static_batcher.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <tuple>
+
+#include "rendering/camera.h"
+#include "rendering/frame_uniforms.h"
+#include "rendering/gl_state.h"
+#include "utils/gl.h"
+#include "utils/logger.h"
+
+namespace sb {
+
+StaticBatcher::StaticBatcher():
+    mObjects(),
+    mFreeObjects(),
+    mMeshRanges(),
+    mOrder(),
+    mGroups(),
+    mCommands(),
+    mDrawData(),
+    mCounts(),
+    mOffsets(),
+    mMatrixLocations(),
+    mState(NULL),
+    mIndirect(false),
+    mVertexAttribDivisor(NULL),
+    mVAO(0),
+    mVertexBuffer(0),
+    mIndexBuffer(0),
+    mDrawDataBuffer(0),
+    mCommandBuffer(0),
+    mGeometryDirty(false),
+    mCommandsDirty(false),
+    mNumObjects(0),
+    mStats()
+{
+}
+
+StaticBatcher::~StaticBatcher()
+{
+    if (mVAO) {
+        mState->deleteVertexArray(mVAO);
+    }
+    for (BufferId buffer: { mVertexBuffer, mIndexBuffer, mDrawDataBuffer,
+                            mCommandBuffer }) {
+        if (buffer) {
+            mState->deleteBuffer(buffer);
+        }
+    }
+}
+
+bool StaticBatcher::init(GLState& state)
+{
+    mState = &state;
+
+    mVertexAttribDivisor = glVertexAttribDivisor
+                           ? glVertexAttribDivisor
+                           : glVertexAttribDivisorARB;
+
+    // baseInstance of indirect commands is only honored with
+    // ARB_base_instance, which is what selects the per-draw data
+    mIndirect = (GLEW_VERSION_4_3
+                 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance))
+                && GLEW_ARB_instanced_arrays
+                && glMultiDrawElementsIndirect
+                && mVertexAttribDivisor;
+    if (!mIndirect) {
+        gLog.warn("multi-draw-indirect not available, static geometry "
+                  "will be baked per object\n");
+    }
+
+    GL_CHECK_RET(glGenVertexArrays(1, &mVAO), false);
+    GL_CHECK_RET(glGenBuffers(1, &mVertexBuffer), false);
+    GL_CHECK_RET(glGenBuffers(1, &mIndexBuffer), false);
+    if (mIndirect) {
+        GL_CHECK_RET(glGenBuffers(1, &mDrawDataBuffer), false);
+        GL_CHECK_RET(glGenBuffers(1, &mCommandBuffer), false);
+    }
+
+    // buffers are only ever respecified, so the bindings stay valid
+    mState->bindVertexArray(mVAO);
+
+    mState->bindBuffer(GL_ARRAY_BUFFER, mVertexBuffer);
+    GL_CHECK(glVertexAttribPointer(AttribPosition, 3, GL_FLOAT, GL_FALSE,
+                                   sizeof(Vertex),
+                                   (void*)offsetof(Vertex, position)));
+    GL_CHECK(glVertexAttribPointer(AttribColor, 4, GL_FLOAT, GL_FALSE,
+                                   sizeof(Vertex),
+                                   (void*)offsetof(Vertex, color)));
+    GL_CHECK(glVertexAttribPointer(AttribTexcoord, 2, GL_FLOAT, GL_FALSE,
+                                   sizeof(Vertex),
+                                   (void*)offsetof(Vertex, texcoord)));
+    GL_CHECK(glEnableVertexAttribArray(AttribPosition));
+    GL_CHECK(glEnableVertexAttribArray(AttribColor));
+    GL_CHECK(glEnableVertexAttribArray(AttribTexcoord));
+
+    if (mIndirect) {
+        mState->bindBuffer(GL_ARRAY_BUFFER, mDrawDataBuffer);
+        for (GLuint column = 0; column < 4; ++column) {
+            GL_CHECK(glVertexAttribPointer(
+                    AttribInstanceTransform + column, 4, GL_FLOAT, GL_FALSE,
+                    sizeof(DrawData),
+                    (void*)(offsetof(DrawData, transform)
+                            + column * sizeof(Vec4))));
+            GL_CHECK(glEnableVertexAttribArray(AttribInstanceTransform
+                                               + column));
+            mVertexAttribDivisor(AttribInstanceTransform + column, 1);
+        }
+        GL_CHECK(glVertexAttribPointer(AttribInstanceColor, 4, GL_FLOAT,
+                                       GL_FALSE, sizeof(DrawData),
+                                       (void*)offsetof(DrawData, color)));
+        GL_CHECK(glEnableVertexAttribArray(AttribInstanceColor));
+        mVertexAttribDivisor(AttribInstanceColor, 1);
+    }
+
+    mState->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIndexBuffer);
+    mState->bindVertexArray(0);
+
+    return true;
+}
+
+StaticBatcher::ObjectId StaticBatcher::add(const Drawable& d,
+                                           const Color& color)
+{
+    ObjectId id;
+    if (mFreeObjects.empty()) {
+        id = (ObjectId)mObjects.size();
+        mObjects.push_back(Object());
+    } else {
+        id = mFreeObjects.back();
+        mFreeObjects.pop_back();
+    }
+
+    Object& o = mObjects[id];
+    o.mesh = d.getSharedMesh();
+    o.program = d.getProgram();
+    o.texture = d.getTexture();
+    o.projection = d.getProjectionType();
+    o.shape = d.getMesh().getListShape();
+    o.transform = d.getTransform();
+    o.color = color;
+    o.visible = true;
+
+    auto it = mMeshRanges.find(o.mesh.get());
+    if (mIndirect && it != mMeshRanges.end()) {
+        o.firstIndex = it->second.firstIndex;
+        o.numIndices = it->second.numIndices;
+        o.baseVertex = it->second.baseVertex;
+    } else {
+        mGeometryDirty = true;
+    }
+
+    mCommandsDirty = true;
+    ++mNumObjects;
+    return id;
+}
+
+void StaticBatcher::remove(ObjectId object)
+{
+    assert(object < mObjects.size() && mObjects[object].mesh);
+
+    // the geometry stays in the shared buffers until they are rebuilt
+    mObjects[object].mesh.reset();
+    mFreeObjects.push_back(object);
+    mCommandsDirty = true;
+    --mNumObjects;
+}
+
+void StaticBatcher::setTransform(ObjectId object,
+                                 const Mat44& transform)
+{
+    assert(object < mObjects.size() && mObjects[object].mesh);
+
+    mObjects[object].transform = transform;
+    if (mIndirect) {
+        mCommandsDirty = true;
+    } else {
+        mGeometryDirty = true;
+    }
+}
+
+void StaticBatcher::setVisible(ObjectId object,
+                               bool visible)
+{
+    assert(object < mObjects.size() && mObjects[object].mesh);
+
+    if (mObjects[object].visible != visible) {
+        mObjects[object].visible = visible;
+        mCommandsDirty = true;
+    }
+}
+
+void StaticBatcher::draw(Camera& camera)
+{
+    mStats.draws = 0;
+    mStats.commandRebuilds = 0;
+    mStats.geometryRebuilds = 0;
+
+    if (mGeometryDirty) {
+        rebuildGeometry();
+    }
+    if (mCommandsDirty) {
+        rebuildCommands();
+    }
+
+    mStats.objects = mNumObjects;
+    mStats.visible = (uint32_t)mOrder.size();
+
+    if (!mGroups.empty()) {
+        submit(camera);
+    }
+}
+
+void StaticBatcher::rebuildGeometry()
+{
+    std::vector<Vertex> vertices;
+    std::vector<IndexType> indices;
+
+    mMeshRanges.clear();
+
+    for (Object& o: mObjects) {
+        if (!o.mesh) {
+            continue;
+        }
+
+        if (mIndirect) {
+            // meshes are stored once, transforms come from the draw data
+            auto it = mMeshRanges.find(o.mesh.get());
+            if (it == mMeshRanges.end()) {
+                MeshRange range = { o.mesh, (uint32_t)indices.size(), 0,
+                                    (uint32_t)vertices.size() };
+                vertices.insert(vertices.end(), o.mesh->getVertices().begin(),
+                                o.mesh->getVertices().end());
+                o.mesh->appendListIndices(0, indices);
+                range.numIndices = (uint32_t)indices.size()
+                                   - range.firstIndex;
+
+                it = mMeshRanges.insert({ o.mesh.get(), range }).first;
+            }
+
+            o.firstIndex = it->second.firstIndex;
+            o.numIndices = it->second.numIndices;
+            o.baseVertex = it->second.baseVertex;
+        } else {
+            IndexType base = (IndexType)vertices.size();
+            for (const Vertex& v: o.mesh->getVertices()) {
+                Vec4 pos = simd::transform(o.transform,
+                                           Vec4(v.position.x, v.position.y,
+                                                v.position.z, 1.f));
+                vertices.push_back(Vertex(Vec3(pos.x, pos.y, pos.z),
+                                          v.color * o.color, v.texcoord));
+            }
+
+            o.firstIndex = (uint32_t)indices.size();
+            o.mesh->appendListIndices(base, indices);
+            o.numIndices = (uint32_t)indices.size() - o.firstIndex;
+            o.baseVertex = 0;
+        }
+    }
+
+    mState->bindVertexArray(mVAO);
+    mState->bindBuffer(GL_ARRAY_BUFFER, mVertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
+                 vertices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(IndexType),
+                 indices.data(), GL_STATIC_DRAW);
+    mState->bindVertexArray(0);
+
+    mGeometryDirty = false;
+    mCommandsDirty = true;
+
+    ++mStats.geometryRebuilds;
+    mStats.vertices = (uint32_t)vertices.size();
+    mStats.indices = (uint32_t)indices.size();
+}
+
+void StaticBatcher::rebuildCommands()
+{
+    mOrder.clear();
+    for (ObjectId id = 0; id < mObjects.size(); ++id) {
+        if (mObjects[id].mesh && mObjects[id].visible) {
+            mOrder.push_back(id);
+        }
+    }
+
+    // one multi-draw per state; objects sharing a mesh end up adjacent
+    auto stateOf = [this](ObjectId id) {
+        const Object& o = mObjects[id];
+        return std::make_tuple(o.projection, o.program, o.texture, o.shape);
+    };
+    std::sort(mOrder.begin(), mOrder.end(),
+              [&](ObjectId a, ObjectId b) {
+                  return std::make_tuple(stateOf(a), mObjects[a].firstIndex, a)
+                         < std::make_tuple(stateOf(b), mObjects[b].firstIndex,
+                                           b);
+              });
+
+    mGroups.clear();
+    mCommands.clear();
+    mDrawData.clear();
+    mCounts.clear();
+    mOffsets.clear();
+
+    size_t numCommands = 0;
+    for (ObjectId id: mOrder) {
+        const Object& o = mObjects[id];
+
+        if (mGroups.empty() || stateOf(mGroups.back().object) != stateOf(id)) {
+            mGroups.push_back({ id, numCommands, 0 });
+        }
+
+        if (mIndirect) {
+            mCommands.push_back({ o.numIndices, 1, o.firstIndex,
+                                  (GLint)o.baseVertex,
+                                  (GLuint)mDrawData.size() });
+            mDrawData.push_back({ o.transform, o.color });
+        } else {
+            mCounts.push_back((GLsizei)o.numIndices);
+            mOffsets.push_back((const void*)(o.firstIndex
+                                             * sizeof(IndexType)));
+        }
+
+        ++numCommands;
+        ++mGroups.back().numCommands;
+    }
+
+    if (mIndirect) {
+        mState->bindBuffer(GL_DRAW_INDIRECT_BUFFER, mCommandBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                     mCommands.size() * sizeof(DrawCommand),
+                     mCommands.data(), GL_DYNAMIC_DRAW);
+        mState->bindBuffer(GL_ARRAY_BUFFER, mDrawDataBuffer);
+        glBufferData(GL_ARRAY_BUFFER, mDrawData.size() * sizeof(DrawData),
+                     mDrawData.data(), GL_DYNAMIC_DRAW);
+    }
+
+    mCommandsDirty = false;
+    ++mStats.commandRebuilds;
+}
+
+void StaticBatcher::submit(Camera& camera)
+{
+    ProgramId currProgram = 0;
+    EProjectionType currProjection = ProjectionPerspective;
+    bool matrixSet = false;
+
+    mState->bindVertexArray(mVAO);
+
+    if (mIndirect) {
+        mState->bindBuffer(GL_DRAW_INDIRECT_BUFFER, mCommandBuffer);
+    } else {
+        // instanced attributes are not arrays here, transforms and colors
+        // are already baked into the geometry
+        for (GLuint column = 0; column < 4; ++column) {
+            glVertexAttrib4f(AttribInstanceTransform + column,
+                             column == 0 ? 1.f : 0.f,
+                             column == 1 ? 1.f : 0.f,
+                             column == 2 ? 1.f : 0.f,
+                             column == 3 ? 1.f : 0.f);
+        }
+        glVertexAttrib4f(AttribInstanceColor, 1.f, 1.f, 1.f, 1.f);
+    }
+
+    for (const Group& group: mGroups) {
+        const Object& o = mObjects[group.object];
+
+        if (o.program != currProgram) {
+            mState->useProgram(o.program);
+            currProgram = o.program;
+            matrixSet = false;
+        }
+        mState->bindTexture(0, GL_TEXTURE_2D, o.texture);
+
+        GLint matrixLocation = mMatrixLocations.get(*mState, o.program);
+        if (matrixLocation >= 0
+                && (!matrixSet || o.projection != currProjection)) {
+            Mat44 viewProjection = camera.getViewProjectionMatrix(o.projection);
+            glUniformMatrix4fv(matrixLocation, 1, GL_FALSE,
+                               &viewProjection[0][0]);
+            currProjection = o.projection;
+            matrixSet = true;
+        }
+
+        if (mIndirect) {
+            glMultiDrawElementsIndirect(
+                    o.shape, GL_UNSIGNED_INT,
+                    (const void*)(group.firstCommand * sizeof(DrawCommand)),
+                    (GLsizei)group.numCommands, 0);
+        } else if (glMultiDrawElements) {
+            glMultiDrawElements(o.shape, &mCounts[group.firstCommand],
+                                GL_UNSIGNED_INT,
+                                &mOffsets[group.firstCommand],
+                                (GLsizei)group.numCommands);
+        } else {
+            for (size_t i = 0; i < group.numCommands; ++i) {
+                glDrawElements(o.shape, mCounts[group.firstCommand + i],
+                               GL_UNSIGNED_INT,
+                               mOffsets[group.firstCommand + i]);
+            }
+        }
+        ++mStats.draws;
+    }
+
+    mState->bindVertexArray(0);
+}
+
+} // namespace sb
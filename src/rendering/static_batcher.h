@@ -0,0 +1,169 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "rendering/color.h"
+#include "rendering/drawable.h"
+#include "rendering/frame_uniforms.h"
+#include "rendering/types.h"
+#include "utils/types.h"
+
+namespace sb {
+
+class Camera;
+class GLState;
+
+// Draws objects that stay in the scene for many frames. Their meshes live
+// in one shared vertex and index buffer, and every visible object becomes
+// a command of a GL_DRAW_INDIRECT_BUFFER; objects sharing program, texture,
+// primitive and projection then go out with a single
+// glMultiDrawElementsIndirect call. Commands are only rebuilt when objects
+// are added, removed, moved or change visibility, so the CPU cost of a
+// frame does not depend on the number of objects.
+//
+// Each command's baseInstance is its draw index, which selects the
+// per-draw transform and color from a buffer bound to the same instanced
+// attributes InstanceBatcher uses; programs written for instancing work
+// unchanged.
+//
+// Without multi-draw-indirect, transforms and colors are baked into a copy
+// of the geometry of every object and each group is drawn with
+// glMultiDrawElements.
+class StaticBatcher
+{
+public:
+    typedef uint32_t ObjectId;
+    static const ObjectId INVALID_OBJECT = (ObjectId)-1;
+
+    struct Stats
+    {
+        uint32_t objects;
+        uint32_t visible;
+        uint32_t draws;             // multi-draw calls
+        uint32_t commandRebuilds;   // since the last frame
+        uint32_t geometryRebuilds;
+        uint32_t vertices;          // in the shared buffer
+        uint32_t indices;
+    };
+
+    StaticBatcher();
+    ~StaticBatcher();
+
+    StaticBatcher(const StaticBatcher&) = delete;
+    StaticBatcher(StaticBatcher&&) = delete;
+    StaticBatcher& operator =(const StaticBatcher&) = delete;
+    StaticBatcher& operator =(StaticBatcher&&) = delete;
+
+    // requires a current GL context; state must outlive the batcher
+    bool init(GLState& state);
+    bool isIndirect() const { return mIndirect; }
+
+    // copies mesh, program, texture, projection and transform of d, layer
+    // and translucency are ignored. Adding a mesh not used by other objects
+    // rebuilds the shared buffers on the next draw(); without
+    // multi-draw-indirect any change to the set of objects or their
+    // transforms does.
+    ObjectId add(const Drawable& d,
+                 const Color& color = Color::White);
+    void remove(ObjectId object);
+    void setTransform(ObjectId object,
+                      const Mat44& transform);
+    void setVisible(ObjectId object,
+                    bool visible);
+
+    // draws all visible objects, rebuilding buffers first if needed
+    void draw(Camera& camera);
+    // true if objects changed since the last draw()
+    bool hasChanges() const { return mGeometryDirty || mCommandsDirty; }
+
+    // statistics of the last draw() call
+    const Stats& getStats() const { return mStats; }
+
+private:
+    struct Object
+    {
+        std::shared_ptr<const Mesh> mesh;   // NULL if removed
+        ProgramId program;
+        TextureId texture;
+        EProjectionType projection;
+        GLenum shape;
+        Mat44 transform;
+        Color color;
+        bool visible;
+
+        // location in the shared buffers
+        uint32_t firstIndex;
+        uint32_t numIndices;
+        uint32_t baseVertex;
+    };
+
+    struct MeshRange
+    {
+        // keeps the address from being reused while the range is
+        // in the shared buffers
+        std::shared_ptr<const Mesh> mesh;
+        uint32_t firstIndex;
+        uint32_t numIndices;
+        uint32_t baseVertex;
+    };
+
+    // matches the layout glMultiDrawElementsIndirect expects
+    struct DrawCommand
+    {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    struct DrawData
+    {
+        Mat44 transform;
+        Color color;
+    };
+
+    struct Group
+    {
+        ObjectId object;    // first one, provides state
+        size_t firstCommand;
+        size_t numCommands;
+    };
+
+    typedef void (*VertexAttribDivisorFunc)(GLuint, GLuint);
+
+    std::vector<Object> mObjects;
+    std::vector<ObjectId> mFreeObjects;
+    std::unordered_map<const Mesh*, MeshRange> mMeshRanges;
+    std::vector<ObjectId> mOrder;
+    std::vector<Group> mGroups;
+    std::vector<DrawCommand> mCommands;
+    std::vector<DrawData> mDrawData;
+    // glMultiDrawElements arguments of the fallback path
+    std::vector<GLsizei> mCounts;
+    std::vector<const void*> mOffsets;
+    MatrixLocations mMatrixLocations;
+
+    GLState* mState;
+    bool mIndirect;
+    VertexAttribDivisorFunc mVertexAttribDivisor;
+    GLuint mVAO;
+    BufferId mVertexBuffer;
+    BufferId mIndexBuffer;
+    BufferId mDrawDataBuffer;
+    BufferId mCommandBuffer;
+
+    bool mGeometryDirty;
+    bool mCommandsDirty;
+    uint32_t mNumObjects;
+    Stats mStats;
+
+    void rebuildGeometry();
+    void rebuildCommands();
+    void submit(Camera& camera);
+};
+
+} // namespace sb
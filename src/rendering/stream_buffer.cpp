@@ -0,0 +1,285 @@
+#include "rendering/stream_buffer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+#include "rendering/gl_state.h"
+#include "utils/gl.h"
+#include "utils/logger.h"
+#include "utils/math.h"
+
+namespace sb {
+namespace {
+
+const GLbitfield PERSISTENT_FLAGS = GL_MAP_WRITE_BIT
+                                    | GL_MAP_PERSISTENT_BIT
+                                    | GL_MAP_COHERENT_BIT;
+
+// 1ms per glClientWaitSync call
+const GLuint64 FENCE_WAIT_TIMEOUT_NS = 1000000;
+
+size_t alignUp(size_t value,
+               size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+const size_t StreamBuffer::DEFAULT_FRAME_SIZE;
+const unsigned StreamBuffer::DEFAULT_NUM_FRAMES;
+
+StreamBuffer::StreamBuffer(size_t frameSize,
+                           unsigned numFrames):
+    mFrameSize(frameSize),
+    mRequiredFrameSize(frameSize),
+    mNumFrames(numFrames),
+    mState(NULL),
+    mBuffer(0),
+    mMode(ModeNone),
+    mPersistentPtr(NULL),
+    mMappedPtr(NULL),
+    mMappedOffset(0),
+    mFences(numFrames, (GLsync)0),
+    mRegion(0),
+    mCursor(0),
+    mFrameStarted(false),
+    mStats(),
+    mFrameStats()
+{
+    assert(numFrames > 0);
+}
+
+StreamBuffer::~StreamBuffer()
+{
+    destroyStorage();
+}
+
+bool StreamBuffer::init(GLState& state)
+{
+    mState = &state;
+    bool haveSync = GLEW_ARB_sync;
+
+    if (GLEW_ARB_buffer_storage && haveSync) {
+        mMode = ModePersistent;
+    } else if (GLEW_ARB_map_buffer_range) {
+        mMode = haveSync ? ModeUnsynchronized : ModeOrphaning;
+    } else {
+        gLog.err("glMapBufferRange not available, cannot stream buffers\n");
+        return false;
+    }
+
+    static const char* MODE_NAMES[] = {
+        "none", "persistent", "unsynchronized", "orphaning"
+    };
+    gLog.info("stream buffer: %u x %lu bytes, %s mapping\n",
+              mNumFrames, (unsigned long)mFrameSize, MODE_NAMES[mMode]);
+
+    return createStorage();
+}
+
+bool StreamBuffer::createStorage()
+{
+    GLsizeiptr totalSize = (GLsizeiptr)(mFrameSize * mNumFrames);
+
+    GL_CHECK_RET(glGenBuffers(1, &mBuffer), false);
+    mState->bindBuffer(GL_ARRAY_BUFFER, mBuffer);
+
+    if (mMode == ModePersistent) {
+        GL_CHECK_RET(glBufferStorage(GL_ARRAY_BUFFER, totalSize, NULL,
+                                     PERSISTENT_FLAGS), false);
+        mPersistentPtr = (uint8_t*)glMapBufferRange(GL_ARRAY_BUFFER, 0,
+                                                    totalSize,
+                                                    PERSISTENT_FLAGS);
+        if (!mPersistentPtr) {
+            gLog.err("cannot persistently map stream buffer\n");
+            return false;
+        }
+    } else {
+        GL_CHECK_RET(glBufferData(GL_ARRAY_BUFFER, totalSize, NULL,
+                                  GL_STREAM_DRAW), false);
+    }
+
+    return true;
+}
+
+void StreamBuffer::destroyStorage()
+{
+    for (GLsync& fence: mFences) {
+        if (fence) {
+            glDeleteSync(fence);
+            fence = 0;
+        }
+    }
+
+    if (mBuffer) {
+        if (mPersistentPtr || mMappedPtr) {
+            mState->bindBuffer(GL_ARRAY_BUFFER, mBuffer);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+        mState->deleteBuffer(mBuffer);
+    }
+
+    mBuffer = 0;
+    mPersistentPtr = NULL;
+    mMappedPtr = NULL;
+}
+
+void StreamBuffer::waitForRegion(unsigned region)
+{
+    GLsync fence = mFences[region];
+    if (!fence) {
+        return;
+    }
+
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    if (result == GL_TIMEOUT_EXPIRED) {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        do {
+            result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                      FENCE_WAIT_TIMEOUT_NS);
+        } while (result == GL_TIMEOUT_EXPIRED);
+
+        auto waited = std::chrono::high_resolution_clock::now() - start;
+        ++mFrameStats.fenceWaits;
+        mFrameStats.fenceWaitMicroseconds +=
+                std::chrono::duration_cast<std::chrono::microseconds>(waited).count();
+    }
+
+    if (result == GL_WAIT_FAILED) {
+        gLog.err("glClientWaitSync failed on stream buffer region %u\n",
+                 region);
+    }
+
+    glDeleteSync(fence);
+    mFences[region] = 0;
+}
+
+void StreamBuffer::beginFrame()
+{
+    if (mRequiredFrameSize > mFrameSize) {
+        // everything in flight has to finish before storage is replaced
+        for (unsigned i = 0; i < mNumFrames; ++i) {
+            waitForRegion(i);
+        }
+
+        EMode mode = mMode;
+        destroyStorage();
+        mMode = mode;
+
+        mFrameSize = (size_t)math::nextPowerOf2((uint64_t)mRequiredFrameSize);
+        mRegion = 0;
+        gLog.info("stream buffer grown to %u x %lu bytes\n",
+                  mNumFrames, (unsigned long)mFrameSize);
+
+        if (!createStorage()) {
+            mMode = ModeNone;
+        }
+    }
+
+    if (mMode == ModeOrphaning) {
+        if (mRegion == 0) {
+            mState->bindBuffer(GL_ARRAY_BUFFER, mBuffer);
+            glBufferData(GL_ARRAY_BUFFER,
+                         (GLsizeiptr)(mFrameSize * mNumFrames), NULL,
+                         GL_STREAM_DRAW);
+        }
+    } else {
+        waitForRegion(mRegion);
+    }
+
+    mCursor = 0;
+    mFrameStarted = true;
+}
+
+StreamBuffer::Allocation StreamBuffer::allocate(size_t bytes,
+                                                size_t alignment)
+{
+    if (mMode == ModeNone) {
+        return { 0, NULL };
+    }
+
+    if (!mFrameStarted) {
+        beginFrame();
+    }
+
+    size_t offset = alignUp(mCursor, alignment);
+    if (offset + bytes > mFrameSize) {
+        ++mFrameStats.failedAllocations;
+        mRequiredFrameSize = std::max(mRequiredFrameSize, offset + bytes);
+        return { 0, NULL };
+    }
+
+    size_t regionStart = mRegion * mFrameSize;
+    uint8_t* ptr = NULL;
+
+    if (mMode == ModePersistent) {
+        ptr = mPersistentPtr + regionStart + offset;
+    } else {
+        if (!mMappedPtr) {
+            // region is either fenced or freshly orphaned, so no need for
+            // the driver to synchronize
+            mMappedOffset = offset;
+            mState->bindBuffer(GL_ARRAY_BUFFER, mBuffer);
+            mMappedPtr = (uint8_t*)glMapBufferRange(
+                    GL_ARRAY_BUFFER,
+                    (GLintptr)(regionStart + offset),
+                    (GLsizeiptr)(mFrameSize - offset),
+                    GL_MAP_WRITE_BIT
+                    | GL_MAP_UNSYNCHRONIZED_BIT
+                    | GL_MAP_INVALIDATE_RANGE_BIT
+                    | GL_MAP_FLUSH_EXPLICIT_BIT);
+
+            if (!mMappedPtr) {
+                gLog.err("cannot map stream buffer region\n");
+                return { 0, NULL };
+            }
+        }
+
+        ptr = mMappedPtr + (offset - mMappedOffset);
+    }
+
+    mCursor = offset + bytes;
+    ++mFrameStats.allocations;
+    mFrameStats.bytesStreamed += bytes;
+
+    return { regionStart + offset, ptr };
+}
+
+void StreamBuffer::flush()
+{
+    if (!mMappedPtr) {
+        return;
+    }
+
+    mState->bindBuffer(GL_ARRAY_BUFFER, mBuffer);
+    glFlushMappedBufferRange(GL_ARRAY_BUFFER, 0,
+                             (GLsizeiptr)(mCursor - mMappedOffset));
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    mMappedPtr = NULL;
+}
+
+void StreamBuffer::endFrame()
+{
+    if (!mFrameStarted) {
+        mStats = Stats();
+        return;
+    }
+
+    flush();
+
+    if (mMode != ModeOrphaning && mMode != ModeNone) {
+        mFences[mRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    mRegion = (mRegion + 1) % mNumFrames;
+    mFrameStarted = false;
+
+    mStats = mFrameStats;
+    mFrameStats = Stats();
+}
+
+} // namespace sb
+
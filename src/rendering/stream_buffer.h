@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "rendering/types.h"
+
+namespace sb {
+
+class GLState;
+
+// One GL buffer split into per-frame regions that are written by the CPU
+// and fenced, so that a region is never overwritten while the GPU may still
+// read it.
+class StreamBuffer
+{
+public:
+    static const size_t DEFAULT_FRAME_SIZE = 4 * 1024 * 1024;
+    static const unsigned DEFAULT_NUM_FRAMES = 3;
+
+    enum EMode {
+        ModeNone,
+        ModePersistent,     // ARB_buffer_storage, mapped once
+        ModeUnsynchronized, // glMapBufferRange(UNSYNCHRONIZED) + fences
+        ModeOrphaning       // no sync objects, orphan on ring wrap
+    };
+
+    struct Allocation
+    {
+        size_t offset;  // in bytes, from the start of the buffer
+        void* ptr;
+
+        bool isValid() const { return ptr != NULL; }
+    };
+
+    struct Stats
+    {
+        size_t bytesStreamed;
+        uint32_t allocations;
+        uint32_t failedAllocations;
+        uint32_t fenceWaits;
+        uint64_t fenceWaitMicroseconds;
+    };
+
+    StreamBuffer(size_t frameSize = DEFAULT_FRAME_SIZE,
+                 unsigned numFrames = DEFAULT_NUM_FRAMES);
+    ~StreamBuffer();
+
+    StreamBuffer(const StreamBuffer&) = delete;
+    StreamBuffer(StreamBuffer&&) = delete;
+    StreamBuffer& operator =(const StreamBuffer&) = delete;
+    StreamBuffer& operator =(StreamBuffer&&) = delete;
+
+    // requires a current GL context, state must outlive the stream buffer
+    bool init(GLState& state);
+
+    // returned pointer is valid until flush() or endFrame(); an invalid
+    // allocation means the frame region is full - the region grows on the
+    // next frame, caller has to upload the data in some other way
+    Allocation allocate(size_t bytes,
+                        size_t alignment = 16);
+
+    // makes written data visible to GL, must be called before any draw that
+    // sources data from this buffer
+    void flush();
+
+    // fences the current region and advances to the next one
+    void endFrame();
+
+    BufferId getId() const { return mBuffer; }
+    EMode getMode() const { return mMode; }
+
+    // statistics of the last finished frame
+    const Stats& getStats() const { return mStats; }
+
+private:
+    size_t mFrameSize;
+    size_t mRequiredFrameSize;
+    const unsigned mNumFrames;
+
+    GLState* mState;
+    BufferId mBuffer;
+    EMode mMode;
+    uint8_t* mPersistentPtr;
+    uint8_t* mMappedPtr;
+    size_t mMappedOffset;   // region-relative offset of mMappedPtr
+
+    std::vector<GLsync> mFences;
+    unsigned mRegion;
+    size_t mCursor;         // region-relative
+    bool mFrameStarted;
+
+    Stats mStats;
+    Stats mFrameStats;
+
+    bool createStorage();
+    void destroyStorage();
+    void beginFrame();
+    void waitForRegion(unsigned region);
+};
+
+} // namespace sb
+
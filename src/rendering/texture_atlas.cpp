@@ -0,0 +1,394 @@
+#include "rendering/texture_atlas.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+#include "rendering/gl_state.h"
+#include "utils/gl.h"
+#include "utils/logger.h"
+#include "utils/math.h"
+
+namespace sb {
+namespace {
+
+typedef TextureAtlas::Rect Rect;
+
+uint32_t alignUp(uint32_t value,
+                 uint32_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+bool intersects(const Rect& a,
+                const Rect& b)
+{
+    return a.x < b.x + b.width && b.x < a.x + a.width
+           && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+bool contains(const Rect& outer,
+              const Rect& inner)
+{
+    return inner.x >= outer.x && inner.y >= outer.y
+           && inner.x + inner.width <= outer.x + outer.width
+           && inner.y + inner.height <= outer.y + outer.height;
+}
+
+// MaxRects, best short side fit
+bool findPosition(const std::vector<Rect>& freeRects,
+                  uint32_t width,
+                  uint32_t height,
+                  Rect& result)
+{
+    uint32_t bestShortSide = std::numeric_limits<uint32_t>::max();
+    uint32_t bestLongSide = std::numeric_limits<uint32_t>::max();
+
+    for (const Rect& r: freeRects) {
+        if (r.width < width || r.height < height) {
+            continue;
+        }
+
+        uint32_t leftoverX = r.width - width;
+        uint32_t leftoverY = r.height - height;
+        uint32_t shortSide = std::min(leftoverX, leftoverY);
+        uint32_t longSide = std::max(leftoverX, leftoverY);
+
+        if (shortSide < bestShortSide
+                || (shortSide == bestShortSide && longSide < bestLongSide)) {
+            result = { r.x, r.y, width, height };
+            bestShortSide = shortSide;
+            bestLongSide = longSide;
+        }
+    }
+
+    return bestShortSide != std::numeric_limits<uint32_t>::max();
+}
+
+void pruneFreeRects(std::vector<Rect>& freeRects)
+{
+    for (size_t i = 0; i < freeRects.size(); ++i) {
+        for (size_t j = i + 1; j < freeRects.size(); ++j) {
+            if (contains(freeRects[j], freeRects[i])) {
+                freeRects.erase(freeRects.begin() + i);
+                --i;
+                break;
+            }
+            if (contains(freeRects[i], freeRects[j])) {
+                freeRects.erase(freeRects.begin() + j);
+                --j;
+            }
+        }
+    }
+}
+
+// replaces every free rect overlapping used with the (up to 4) maximal
+// rects surrounding it
+void splitFreeRects(std::vector<Rect>& freeRects,
+                    const Rect& used)
+{
+    std::vector<Rect> split;
+
+    for (auto it = freeRects.begin(); it != freeRects.end();) {
+        const Rect r = *it;
+        if (!intersects(r, used)) {
+            ++it;
+            continue;
+        }
+
+        uint32_t usedRight = used.x + used.width;
+        uint32_t usedBottom = used.y + used.height;
+        uint32_t right = r.x + r.width;
+        uint32_t bottom = r.y + r.height;
+
+        if (used.x > r.x) {
+            split.push_back({ r.x, r.y, used.x - r.x, r.height });
+        }
+        if (usedRight < right) {
+            split.push_back({ usedRight, r.y, right - usedRight, r.height });
+        }
+        if (used.y > r.y) {
+            split.push_back({ r.x, r.y, r.width, used.y - r.y });
+        }
+        if (usedBottom < bottom) {
+            split.push_back({ r.x, usedBottom, r.width, bottom - usedBottom });
+        }
+
+        it = freeRects.erase(it);
+    }
+
+    freeRects.insert(freeRects.end(), split.begin(), split.end());
+    pruneFreeRects(freeRects);
+}
+
+} // namespace
+
+const TextureAtlas::Handle TextureAtlas::INVALID_HANDLE;
+
+TextureAtlas::TextureAtlas(unsigned pageSize,
+                           unsigned gutter,
+                           unsigned mipLevels):
+    mState(NULL),
+    mPageSize(math::nextPowerOf2((uint32_t)pageSize)),
+    mGutter(gutter),
+    mMipLevels(mipLevels),
+    mAlignment(1u << mipLevels),
+    mPages(),
+    mEntries(),
+    mFreeHandles(),
+    mScratch()
+{
+}
+
+TextureAtlas::~TextureAtlas()
+{
+    for (Page& page: mPages) {
+        releasePage(page);
+    }
+}
+
+bool TextureAtlas::init(GLState& state)
+{
+    mState = &state;
+    return true;
+}
+
+bool TextureAtlas::createPage(uint32_t size,
+                              uint32_t& index)
+{
+    TextureId texture = 0;
+    GL_CHECK_RET(glGenTextures(1, &texture), false);
+
+    mState->activeTexture(0);
+    mState->bindTexture(0, GL_TEXTURE_2D, texture);
+    GL_CHECK(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0,
+                          GL_RGBA, GL_UNSIGNED_BYTE, NULL));
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                             mMipLevels > 0 ? GL_LINEAR_MIPMAP_LINEAR
+                                            : GL_LINEAR));
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+                             GL_LINEAR));
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+                             GL_CLAMP_TO_EDGE));
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+                             GL_CLAMP_TO_EDGE));
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                             mMipLevels));
+
+    Page page = { texture, size, { { 0, 0, size, size } }, 0, 0, false };
+
+    // reuse slots of released pages, entries refer to pages by index
+    for (index = 0; index < mPages.size(); ++index) {
+        if (!mPages[index].texture) {
+            mPages[index] = page;
+            return true;
+        }
+    }
+
+    mPages.push_back(page);
+    return true;
+}
+
+void TextureAtlas::releasePage(Page& page)
+{
+    if (page.texture) {
+        mState->deleteTexture(page.texture);
+    }
+    page.texture = 0;
+    page.freeRects.clear();
+}
+
+bool TextureAtlas::allocate(uint32_t width,
+                            uint32_t height,
+                            uint32_t& pageIdx,
+                            Rect& rect)
+{
+    for (size_t i = 0; i < mPages.size(); ++i) {
+        if (mPages[i].texture
+                && findPosition(mPages[i].freeRects, width, height, rect)) {
+            pageIdx = (uint32_t)i;
+            return true;
+        }
+    }
+
+    uint32_t size = std::max(mPageSize,
+                             math::nextPowerOf2(std::max(width, height)));
+
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    if (size > (uint32_t)maxSize) {
+        gLog.err("%ux%u image does not fit in a texture\n", width, height);
+        return false;
+    }
+
+    if (size > mPageSize) {
+        gLog.debug("creating dedicated %ux%u atlas page\n", size, size);
+    }
+
+    if (!createPage(size, pageIdx)) {
+        return false;
+    }
+
+    return findPosition(mPages[pageIdx].freeRects, width, height, rect);
+}
+
+void TextureAtlas::upload(const Page& page,
+                          const Rect& rect,
+                          const uint8_t* rgba,
+                          uint32_t width,
+                          uint32_t height)
+{
+    // replicate edge texels into the gutter and the alignment padding, so
+    // that mip levels never average in texels of a previous occupant
+    uint32_t outWidth = rect.width;
+    uint32_t outHeight = rect.height;
+    mScratch.resize(outWidth * outHeight * 4);
+
+    for (uint32_t y = 0; y < outHeight; ++y) {
+        uint32_t srcY = math::clamp<int32_t>((int32_t)y - (int32_t)mGutter,
+                                             0, (int32_t)height - 1);
+        for (uint32_t x = 0; x < outWidth; ++x) {
+            uint32_t srcX = math::clamp<int32_t>((int32_t)x - (int32_t)mGutter,
+                                                 0, (int32_t)width - 1);
+            const uint8_t* src = rgba + (srcY * width + srcX) * 4;
+            std::copy(src, src + 4, &mScratch[(y * outWidth + x) * 4]);
+        }
+    }
+
+    mState->bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    mState->activeTexture(0);
+    mState->bindTexture(0, GL_TEXTURE_2D, page.texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, outWidth, outHeight,
+                    GL_RGBA, GL_UNSIGNED_BYTE, mScratch.data());
+}
+
+TextureAtlas::Handle TextureAtlas::makeHandle(const Entry& entry)
+{
+    if (!mFreeHandles.empty()) {
+        Handle handle = mFreeHandles.back();
+        mFreeHandles.pop_back();
+        mEntries[handle - 1] = entry;
+        return handle;
+    }
+
+    mEntries.push_back(entry);
+    return (Handle)mEntries.size();
+}
+
+TextureAtlas::Handle TextureAtlas::add(const uint8_t* rgba,
+                                       unsigned width,
+                                       unsigned height)
+{
+    assert(mState && "TextureAtlas not initialized");
+
+    if (width == 0 || height == 0) {
+        return INVALID_HANDLE;
+    }
+
+    uint32_t paddedWidth = alignUp(width + 2 * mGutter, mAlignment);
+    uint32_t paddedHeight = alignUp(height + 2 * mGutter, mAlignment);
+
+    uint32_t pageIdx = 0;
+    Rect rect;
+    if (!allocate(paddedWidth, paddedHeight, pageIdx, rect)) {
+        return INVALID_HANDLE;
+    }
+
+    Page& page = mPages[pageIdx];
+    splitFreeRects(page.freeRects, rect);
+    ++page.numImages;
+    page.usedTexels += (uint64_t)rect.width * rect.height;
+    page.mipsDirty = true;
+
+    upload(page, rect, rgba, width, height);
+
+    float size = (float)page.size;
+    Entry entry = {
+        pageIdx,
+        rect,
+        {
+            Vec2((float)(rect.x + mGutter) / size,
+                 (float)(rect.y + mGutter) / size),
+            Vec2((float)(rect.x + mGutter + width) / size,
+                 (float)(rect.y + mGutter + height) / size)
+        },
+        true
+    };
+
+    return makeHandle(entry);
+}
+
+void TextureAtlas::remove(Handle handle)
+{
+    if (handle == INVALID_HANDLE) {
+        return;
+    }
+
+    assert(handle <= mEntries.size() && mEntries[handle - 1].used);
+    Entry& entry = mEntries[handle - 1];
+    Page& page = mPages[entry.page];
+
+    entry.used = false;
+    mFreeHandles.push_back(handle);
+
+    --page.numImages;
+    page.usedTexels -= (uint64_t)entry.rect.width * entry.rect.height;
+
+    if (page.numImages > 0) {
+        // texels are left as they are, the space gets overwritten on reuse
+        page.freeRects.push_back(entry.rect);
+        pruneFreeRects(page.freeRects);
+    } else if (page.size > mPageSize) {
+        releasePage(page);
+    } else {
+        page.freeRects.assign(1, { 0, 0, page.size, page.size });
+    }
+}
+
+TextureId TextureAtlas::getTexture(Handle handle) const
+{
+    assert(handle != INVALID_HANDLE && handle <= mEntries.size());
+    return mPages[mEntries[handle - 1].page].texture;
+}
+
+const TextureAtlas::UVRect& TextureAtlas::getUV(Handle handle) const
+{
+    assert(handle != INVALID_HANDLE && handle <= mEntries.size());
+    return mEntries[handle - 1].uv;
+}
+
+void TextureAtlas::update()
+{
+    if (mMipLevels == 0) {
+        return;
+    }
+
+    for (Page& page: mPages) {
+        if (page.texture && page.mipsDirty) {
+            mState->activeTexture(0);
+            mState->bindTexture(0, GL_TEXTURE_2D, page.texture);
+            if (glGenerateMipmap) {
+                glGenerateMipmap(GL_TEXTURE_2D);
+            } else {
+                glGenerateMipmapEXT(GL_TEXTURE_2D);
+            }
+            page.mipsDirty = false;
+        }
+    }
+}
+
+TextureAtlas::Stats TextureAtlas::getStats() const
+{
+    Stats stats = Stats();
+    for (const Page& page: mPages) {
+        if (page.texture) {
+            ++stats.pages;
+            stats.images += page.numImages;
+            stats.usedTexels += page.usedTexels;
+            stats.totalTexels += (uint64_t)page.size * page.size;
+        }
+    }
+    return stats;
+}
+
+} // namespace sb
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "rendering/types.h"
+#include "utils/types.h"
+
+namespace sb {
+
+class GLState;
+
+// Packs small RGBA8 images into shared power-of-two texture pages, so that
+// sprites and UI elements using different images can still be batched
+// together. Images can be added and evicted at any time; free space is
+// tracked per page with a MaxRects packer.
+//
+// Each image is placed on a grid aligned to 2^mipLevels texels and its
+// whole cell outside the image, a gutter of at least the requested width,
+// is filled with copies of the edge texels. Bilinear filtering therefore
+// never samples a neighbour, and neither do mip levels up to mipLevels;
+// coarser levels are not generated.
+class TextureAtlas
+{
+public:
+    typedef uint32_t Handle;
+    static const Handle INVALID_HANDLE = 0;
+
+    struct UVRect
+    {
+        Vec2 min;
+        Vec2 max;
+
+        // maps texcoords of a standalone image into the atlas page
+        Vec2 map(const Vec2& uv) const
+        {
+            return Vec2(min.x + uv.x * (max.x - min.x),
+                        min.y + uv.y * (max.y - min.y));
+        }
+    };
+
+    struct Rect
+    {
+        uint32_t x, y;
+        uint32_t width, height;
+    };
+
+    struct Stats
+    {
+        uint32_t pages;
+        uint32_t images;
+        uint64_t usedTexels;    // including gutters
+        uint64_t totalTexels;
+    };
+
+    // pageSize is rounded up to a power of two; images larger than a page
+    // get a dedicated page
+    explicit TextureAtlas(unsigned pageSize = 1024,
+                          unsigned gutter = 1,
+                          unsigned mipLevels = 2);
+    ~TextureAtlas();
+
+    TextureAtlas(const TextureAtlas&) = delete;
+    TextureAtlas(TextureAtlas&&) = delete;
+    TextureAtlas& operator =(const TextureAtlas&) = delete;
+    TextureAtlas& operator =(TextureAtlas&&) = delete;
+
+    // requires a current GL context; state must outlive the atlas
+    bool init(GLState& state);
+
+    // rgba: width * height tightly packed RGBA8 texels
+    Handle add(const uint8_t* rgba,
+               unsigned width,
+               unsigned height);
+    void remove(Handle handle);
+
+    TextureId getTexture(Handle handle) const;
+    const UVRect& getUV(Handle handle) const;
+
+    // regenerates mipmaps of pages modified since the last call; call
+    // once per frame, before drawing
+    void update();
+
+    Stats getStats() const;
+
+private:
+    struct Page
+    {
+        TextureId texture;
+        uint32_t size;
+        std::vector<Rect> freeRects;
+        uint32_t numImages;
+        uint64_t usedTexels;
+        bool mipsDirty;
+    };
+
+    struct Entry
+    {
+        uint32_t page;
+        Rect rect;      // including gutter and alignment
+        UVRect uv;
+        bool used;
+    };
+
+    GLState* mState;
+    uint32_t mPageSize;
+    uint32_t mGutter;
+    uint32_t mMipLevels;
+    uint32_t mAlignment;
+
+    std::vector<Page> mPages;
+    std::vector<Entry> mEntries;
+    std::vector<Handle> mFreeHandles;
+    std::vector<uint8_t> mScratch;
+
+    bool allocate(uint32_t width,
+                  uint32_t height,
+                  uint32_t& page,
+                  Rect& rect);
+    bool createPage(uint32_t size,
+                    uint32_t& index);
+    void releasePage(Page& page);
+    void upload(const Page& page,
+                const Rect& rect,
+                const uint8_t* rgba,
+                uint32_t width,
+                uint32_t height);
+    Handle makeHandle(const Entry& entry);
+};
+
+} // namespace sb
@@ -28,6 +28,27 @@ namespace sb
         ProjectionOrthographic,
         ProjectionPerspective
     };
+
+    enum EPresentMode {
+        PresentImmediate,   // no vsync, may tear
+        PresentVSync,
+        PresentAdaptive     // vsync, but tears instead of waiting when late
+    };
+
+    // attribute locations shared by all programs
+    enum EVertexAttrib {
+        AttribPosition = 0,
+        AttribColor = 1,
+        AttribTexcoord = 2,
+        // per-instance, mat4 takes 4 consecutive locations
+        AttribInstanceTransform = 3,
+        AttribInstanceColor = 7
+    };
+
+    // uniform block binding points shared by all programs
+    enum EUniformBinding {
+        UniformBindingFrame = 0
+    };
 } // namespace sb
 
 #define SHAPE_POINTS                GL_POINTS
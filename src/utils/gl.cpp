@@ -3,6 +3,7 @@
 #endif
 
 #include "utils/gl.h"
+#include "utils/lockfree_queue.h"
 #include "utils/logger.h"
 
 #ifdef PLATFORM_WIN32
@@ -10,8 +11,15 @@
 # include <Windows.h>
 #endif // PLATFORM_WIN32
 
+#include <GL/glew.h>
 #include <GL/glu.h>
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
 namespace sb
 {
     namespace utils
@@ -42,6 +50,206 @@ namespace sb
             print_integer("ELEMENT_ARRAY_BUFFER", GL_ELEMENT_ARRAY_BUFFER_BINDING);
             print_integer("TEXTURE_2D", GL_TEXTURE_BINDING_2D);
         }
+
+        namespace
+        {
+            enum EDebugOutput {
+                DebugOutputNone,
+                DebugOutputKHR,
+                DebugOutputARB
+            };
+
+            struct DebugMessage
+            {
+                GLenum source;
+                GLenum type;
+                GLenum severity;
+                GLuint id;
+                char text[256];
+            };
+
+            // filled by the driver, possibly from its own threads
+            LockFreeQueue<DebugMessage> gDebugMessages(1024);
+            std::atomic<unsigned> gDroppedDebugMessages(0);
+            EDebugOutput gDebugOutput = DebugOutputNone;
+
+            void pushDebugMessage(GLenum source,
+                                  GLenum type,
+                                  GLenum severity,
+                                  GLuint id,
+                                  GLsizei length,
+                                  const GLchar* text)
+            {
+                DebugMessage msg;
+                msg.source = source;
+                msg.type = type;
+                msg.severity = severity;
+                msg.id = id;
+
+                size_t len = length < 0 ? strlen(text) : (size_t)length;
+                len = std::min(len, sizeof(msg.text) - 1);
+                memcpy(msg.text, text, len);
+                msg.text[len] = '\0';
+
+                if (!gDebugMessages.push(msg)) {
+                    ++gDroppedDebugMessages;
+                }
+            }
+
+            void GLAPIENTRY debugCallback(GLenum source,
+                                          GLenum type,
+                                          GLuint id,
+                                          GLenum severity,
+                                          GLsizei length,
+                                          const GLchar* message,
+                                          const void* /*userParam*/)
+            {
+                pushDebugMessage(source, type, severity, id, length, message);
+            }
+
+            const char* debugTypeName(GLenum type)
+            {
+                switch (type) {
+                case GL_DEBUG_TYPE_ERROR:               return "error";
+                case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+                case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:  return "undefined behavior";
+                case GL_DEBUG_TYPE_PORTABILITY:         return "portability";
+                case GL_DEBUG_TYPE_PERFORMANCE:         return "performance";
+                default:                                return "other";
+                }
+            }
+        } // namespace
+
+        bool installDebugCallback()
+        {
+            if (GLEW_KHR_debug) {
+                glDebugMessageCallback(debugCallback, NULL);
+                glEnable(GL_DEBUG_OUTPUT);
+                glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+
+                // notifications are noise, except for group markers that
+                // carry the source location
+                glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE,
+                                      GL_DEBUG_SEVERITY_NOTIFICATION,
+                                      0, NULL, GL_FALSE);
+                glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_PUSH_GROUP,
+                                      GL_DONT_CARE, 0, NULL, GL_TRUE);
+                glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_POP_GROUP,
+                                      GL_DONT_CARE, 0, NULL, GL_TRUE);
+
+                gDebugOutput = DebugOutputKHR;
+                gLog.info("using KHR_debug for GL error reporting\n");
+            } else if (GLEW_ARB_debug_output) {
+                glDebugMessageCallbackARB(debugCallback, NULL);
+                glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS_ARB);
+
+                gDebugOutput = DebugOutputARB;
+                gLog.info("using ARB_debug_output for GL error reporting\n");
+            } else {
+                gLog.warn("no GL debug output extension, GL errors will not "
+                          "be reported\n");
+                return false;
+            }
+
+            GLint flags = 0;
+            glGetIntegerv(GL_CONTEXT_FLAGS, &flags);
+            if (!(flags & GL_CONTEXT_FLAG_DEBUG_BIT)) {
+                gLog.warn("GL context is not a debug one, some errors may "
+                          "not be reported\n");
+            }
+
+            return true;
+        }
+
+        void drainDebugMessages()
+        {
+            // render thread only, mirrors the debug group stack as seen by
+            // the driver
+            static std::vector<std::string> groups;
+
+            DebugMessage msg;
+            while (gDebugMessages.pop(msg)) {
+                if (msg.type == GL_DEBUG_TYPE_PUSH_GROUP) {
+                    groups.push_back(msg.text);
+                    continue;
+                } else if (msg.type == GL_DEBUG_TYPE_POP_GROUP) {
+                    if (!groups.empty()) {
+                        groups.pop_back();
+                    }
+                    continue;
+                }
+
+                std::string where;
+                for (const std::string& group: groups) {
+                    where += where.empty() ? "" : " > ";
+                    where += group;
+                }
+
+                const char* fmt = "GL %s %u: %s\n>> %s\n";
+                const char* location = where.empty() ? "(no debug scope)"
+                                                     : where.c_str();
+
+                if (msg.type == GL_DEBUG_TYPE_ERROR
+                        || msg.severity == GL_DEBUG_SEVERITY_HIGH) {
+                    gLog.err(fmt, debugTypeName(msg.type), msg.id,
+                             msg.text, location);
+                } else if (msg.severity == GL_DEBUG_SEVERITY_MEDIUM) {
+                    gLog.warn(fmt, debugTypeName(msg.type), msg.id,
+                              msg.text, location);
+                } else {
+                    gLog.info(fmt, debugTypeName(msg.type), msg.id,
+                              msg.text, location);
+                }
+            }
+
+            unsigned dropped = gDroppedDebugMessages.exchange(0);
+            if (dropped > 0) {
+                gLog.warn("%u GL debug messages dropped\n", dropped);
+            }
+        }
+
+        GLDebugScope::GLDebugScope(const char* name, const char* file, int line):
+            mPushed(false)
+        {
+            if (gDebugOutput == DebugOutputNone) {
+                return;
+            }
+
+            const char* basename = strrchr(file, '/');
+            char buffer[128];
+            snprintf(buffer, sizeof(buffer), "%s (%s:%d)", name,
+                     basename ? basename + 1 : file, line);
+
+            if (gDebugOutput == DebugOutputKHR) {
+                glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, buffer);
+            } else {
+                // ARB_debug_output has no groups; markers are queued from
+                // the app side, so with asynchronous output their order
+                // relative to driver messages is only approximate
+                pushDebugMessage(GL_DEBUG_SOURCE_APPLICATION,
+                                 GL_DEBUG_TYPE_PUSH_GROUP,
+                                 GL_DEBUG_SEVERITY_NOTIFICATION,
+                                 0, -1, buffer);
+            }
+
+            mPushed = true;
+        }
+
+        GLDebugScope::~GLDebugScope()
+        {
+            if (!mPushed) {
+                return;
+            }
+
+            if (gDebugOutput == DebugOutputKHR) {
+                glPopDebugGroup();
+            } else {
+                pushDebugMessage(GL_DEBUG_SOURCE_APPLICATION,
+                                 GL_DEBUG_TYPE_POP_GROUP,
+                                 GL_DEBUG_SEVERITY_NOTIFICATION,
+                                 0, 0, "");
+            }
+        }
     }
 }
 
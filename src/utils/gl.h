@@ -1,5 +1,15 @@
 #pragma once
 
+// GL error checking mode is chosen at build time (GL_CHECK_MODE in CMake):
+// GL_CHECK_SYNC  - glGetError after every GL_CHECK call (default)
+// GL_CHECK_ASYNC - GL_CHECK is the bare call, errors are reported by the
+//                  KHR_debug/ARB_debug_output callback and logged once per
+//                  frame by drainDebugMessages()
+// GL_CHECK_NONE  - no checking at all
+#if !defined(GL_CHECK_SYNC) && !defined(GL_CHECK_ASYNC) && !defined(GL_CHECK_NONE)
+# define GL_CHECK_SYNC
+#endif
+
 namespace sb
 {
     namespace utils
@@ -8,11 +18,47 @@ namespace sb
         bool GLCheck(const char* file, int line, const char* call);
 
         void gl_debug();
+
+        // installs the debug output callback; requires a context created
+        // with the debug flag for reliable reporting
+        bool installDebugCallback();
+
+        // logs all messages collected by the callback since the last call
+        void drainDebugMessages();
+
+        // annotates GL commands issued in its lifetime, so that messages
+        // reported by the callback can be traced back to the source
+        class GLDebugScope
+        {
+        public:
+            GLDebugScope(const char* name, const char* file, int line);
+            ~GLDebugScope();
+
+            GLDebugScope(const GLDebugScope&) = delete;
+            GLDebugScope& operator =(const GLDebugScope&) = delete;
+
+        private:
+            bool mPushed;
+        };
     }
 }
 
+#ifdef GL_CHECK_ASYNC
+# define GL_DEBUG_SCOPE_CONCAT2(a, b) a##b
+# define GL_DEBUG_SCOPE_CONCAT(a, b) GL_DEBUG_SCOPE_CONCAT2(a, b)
+# define GL_DEBUG_SCOPE(name) \
+    sb::utils::GLDebugScope GL_DEBUG_SCOPE_CONCAT(glDebugScope_, __LINE__)( \
+            (name), __FILE__, __LINE__)
+#else
+# define GL_DEBUG_SCOPE(name) do {} while (0)
+#endif
+
 #ifndef NO_CHECK_MACROS
-# ifdef _DEBUG
+# if defined(GL_CHECK_ASYNC) || defined(GL_CHECK_NONE)
+
+#  define GL_CHECK(funccall) ((funccall), false)
+
+# elif defined(_DEBUG)
 
 #  define GL_CHECK(funccall) (gLog.debug(#funccall), (funccall)), \
                              sb::utils::GLCheck(__FILE__, __LINE__, #funccall)
@@ -39,4 +85,3 @@ namespace sb
 # define GL_CHECK_RET(funccall, retval) (funccall)
 
 #endif
-
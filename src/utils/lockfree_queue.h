@@ -0,0 +1,105 @@
+#ifndef UTILS_LOCKFREE_QUEUE_H
+#define UTILS_LOCKFREE_QUEUE_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+
+namespace sb
+{
+    namespace utils
+    {
+        // bounded multi-producer/multi-consumer queue, never blocks: push()
+        // fails when the queue is full and pop() fails when it is empty
+        template<typename T>
+        class LockFreeQueue
+        {
+        public:
+            // capacity must be a power of 2
+            explicit LockFreeQueue(size_t capacity):
+                mSlots(new Slot[capacity]),
+                mMask(capacity - 1),
+                mEnqueuePos(0),
+                mDequeuePos(0)
+            {
+                assert(capacity >= 2 && (capacity & (capacity - 1)) == 0);
+
+                for (size_t i = 0; i < capacity; ++i) {
+                    mSlots[i].sequence.store(i, std::memory_order_relaxed);
+                }
+            }
+
+            LockFreeQueue(const LockFreeQueue&) = delete;
+            LockFreeQueue& operator =(const LockFreeQueue&) = delete;
+
+            bool push(const T& value)
+            {
+                Slot* slot;
+                size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+
+                for (;;) {
+                    slot = &mSlots[pos & mMask];
+                    size_t seq = slot->sequence.load(std::memory_order_acquire);
+                    ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+
+                    if (diff == 0) {
+                        if (mEnqueuePos.compare_exchange_weak(
+                                pos, pos + 1, std::memory_order_relaxed)) {
+                            break;
+                        }
+                    } else if (diff < 0) {
+                        return false;   // full
+                    } else {
+                        pos = mEnqueuePos.load(std::memory_order_relaxed);
+                    }
+                }
+
+                slot->value = value;
+                slot->sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+
+            bool pop(T& value)
+            {
+                Slot* slot;
+                size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+
+                for (;;) {
+                    slot = &mSlots[pos & mMask];
+                    size_t seq = slot->sequence.load(std::memory_order_acquire);
+                    ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)(pos + 1);
+
+                    if (diff == 0) {
+                        if (mDequeuePos.compare_exchange_weak(
+                                pos, pos + 1, std::memory_order_relaxed)) {
+                            break;
+                        }
+                    } else if (diff < 0) {
+                        return false;   // empty
+                    } else {
+                        pos = mDequeuePos.load(std::memory_order_relaxed);
+                    }
+                }
+
+                value = slot->value;
+                slot->sequence.store(pos + mMask + 1, std::memory_order_release);
+                return true;
+            }
+
+        private:
+            struct Slot
+            {
+                std::atomic<size_t> sequence;
+                T value;
+            };
+
+            std::unique_ptr<Slot[]> mSlots;
+            const size_t mMask;
+            std::atomic<size_t> mEnqueuePos;
+            std::atomic<size_t> mDequeuePos;
+        };
+    } // namespace utils
+} // namespace sb
+
+#endif // UTILS_LOCKFREE_QUEUE_H
@@ -1,8 +1,236 @@
 #ifndef UTILS_VECTOR_H
 #define UTILS_VECTOR_H
 
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#if defined(__AVX__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
 namespace sb
 {
+    // Hot float kernels: SSE2 (x86-64 baseline), AVX where enabled at
+    // compile time, glm otherwise. Results match glm up to rounding.
+    //
+    // TVec3/TVec4 dot(), cross() and normalized() use them; matrix and
+    // quaternion products are glm operators, so call sites that run per
+    // object or per vertex use multiply(), transform() and rotate().
+    namespace simd
+    {
+        typedef glm::detail::tvec3<float, glm::highp> vec3;
+        typedef glm::detail::tvec4<float, glm::highp> vec4;
+        typedef glm::detail::tmat4x4<float, glm::highp> mat4;
+        typedef glm::detail::tquat<float, glm::highp> quat;
+
+        inline const char* getInstructionSet()
+        {
+#if defined(__AVX__)
+            return "AVX";
+#elif defined(__SSE2__)
+            return "SSE2";
+#else
+            return "scalar";
+#endif
+        }
+
+#if defined(__AVX__) || defined(__SSE2__)
+        namespace detail
+        {
+            // tvec3 is not padded, reading 4 floats may run past the end
+            inline __m128 load3(const vec3& v)
+            {
+                return _mm_setr_ps(v.x, v.y, v.z, 0.f);
+            }
+
+            inline vec3 store3(__m128 v)
+            {
+                float f[4];
+                _mm_storeu_ps(f, v);
+                return vec3(f[0], f[1], f[2]);
+            }
+
+            inline vec4 store4(__m128 v)
+            {
+                vec4 result;
+                _mm_storeu_ps(&result.x, v);
+                return result;
+            }
+
+            // sum of a * b in every lane
+            inline __m128 dot(__m128 a, __m128 b)
+            {
+                __m128 m = _mm_mul_ps(a, b);
+                m = _mm_add_ps(m, _mm_shuffle_ps(m, m,
+                                                 _MM_SHUFFLE(2, 3, 0, 1)));
+                return _mm_add_ps(m, _mm_shuffle_ps(m, m,
+                                                    _MM_SHUFFLE(1, 0, 3, 2)));
+            }
+
+            // w of the result is 0
+            inline __m128 cross(__m128 a, __m128 b)
+            {
+                __m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+                __m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+                __m128 c = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+                return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+            }
+
+            inline __m128 normalize(__m128 v)
+            {
+                // exact sqrt; rsqrt estimates are off by up to 1.5 * 2^-12
+                return _mm_div_ps(v, _mm_sqrt_ps(dot(v, v)));
+            }
+
+            inline __m128 transform(const float* m,
+                                    __m128 v)
+            {
+                __m128 x = _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0));
+                __m128 y = _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1));
+                __m128 z = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2));
+                __m128 w = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+                return _mm_add_ps(
+                        _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(m), x),
+                                   _mm_mul_ps(_mm_loadu_ps(m + 4), y)),
+                        _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(m + 8), z),
+                                   _mm_mul_ps(_mm_loadu_ps(m + 12), w)));
+            }
+        } // namespace detail
+
+        inline float dot(const vec4& a,
+                         const vec4& b)
+        {
+            return _mm_cvtss_f32(detail::dot(_mm_loadu_ps(&a.x),
+                                             _mm_loadu_ps(&b.x)));
+        }
+
+        inline float dot(const vec3& a,
+                         const vec3& b)
+        {
+            return _mm_cvtss_f32(detail::dot(detail::load3(a),
+                                             detail::load3(b)));
+        }
+
+        inline vec3 cross(const vec3& a,
+                          const vec3& b)
+        {
+            return detail::store3(detail::cross(detail::load3(a),
+                                                detail::load3(b)));
+        }
+
+        inline vec4 normalize(const vec4& v)
+        {
+            return detail::store4(detail::normalize(_mm_loadu_ps(&v.x)));
+        }
+
+        inline vec3 normalize(const vec3& v)
+        {
+            return detail::store3(detail::normalize(detail::load3(v)));
+        }
+
+        // m * v, columns are contiguous in glm matrices
+        inline vec4 transform(const mat4& m,
+                              const vec4& v)
+        {
+            return detail::store4(detail::transform(&m[0].x,
+                                                    _mm_loadu_ps(&v.x)));
+        }
+
+        // a * b
+        inline mat4 multiply(const mat4& a,
+                             const mat4& b)
+        {
+            mat4 result;
+#if defined(__AVX__)
+            // two columns of the result at a time
+            __m256 columns[4];
+            for (int i = 0; i < 4; ++i) {
+                __m128 c = _mm_loadu_ps(&a[i].x);
+                columns[i] = _mm256_insertf128_ps(_mm256_castps128_ps256(c),
+                                                  c, 1);
+            }
+            for (int j = 0; j < 4; j += 2) {
+                // shuffles work within 128-bit halves, one column each
+                __m256 b2 = _mm256_loadu_ps(&b[j].x);
+                __m256 x = _mm256_shuffle_ps(b2, b2, 0x00);
+                __m256 y = _mm256_shuffle_ps(b2, b2, 0x55);
+                __m256 z = _mm256_shuffle_ps(b2, b2, 0xaa);
+                __m256 w = _mm256_shuffle_ps(b2, b2, 0xff);
+                __m256 r = _mm256_add_ps(
+                        _mm256_add_ps(_mm256_mul_ps(columns[0], x),
+                                      _mm256_mul_ps(columns[1], y)),
+                        _mm256_add_ps(_mm256_mul_ps(columns[2], z),
+                                      _mm256_mul_ps(columns[3], w)));
+                _mm256_storeu_ps(&result[j].x, r);
+            }
+#else
+            for (int j = 0; j < 4; ++j) {
+                _mm_storeu_ps(&result[j].x,
+                              detail::transform(&a[0].x,
+                                                _mm_loadu_ps(&b[j].x)));
+            }
+#endif
+            return result;
+        }
+
+        // q * v for a unit quaternion: v + 2w (q x v) + 2 q x (q x v)
+        inline vec3 rotate(const quat& q,
+                           const vec3& v)
+        {
+            __m128 u = _mm_setr_ps(q.x, q.y, q.z, 0.f);
+            __m128 p = detail::load3(v);
+            __m128 uv = detail::cross(u, p);
+            __m128 uuv = detail::cross(u, uv);
+            uv = _mm_mul_ps(uv, _mm_set1_ps(2.f * q.w));
+            uuv = _mm_add_ps(uuv, uuv);
+            return detail::store3(_mm_add_ps(p, _mm_add_ps(uv, uuv)));
+        }
+#else
+        inline vec4 transform(const mat4& m,
+                              const vec4& v)
+        {
+            return m * v;
+        }
+
+        inline mat4 multiply(const mat4& a,
+                             const mat4& b)
+        {
+            return a * b;
+        }
+
+        inline vec3 rotate(const quat& q,
+                           const vec3& v)
+        {
+            return q * v;
+        }
+#endif
+
+        // other element types, and everything without SIMD, use glm
+        template<typename T, glm::precision P,
+                 template<typename, glm::precision> class V>
+        inline T dot(const V<T, P>& a,
+                     const V<T, P>& b)
+        {
+            return glm::dot(a, b);
+        }
+
+        template<typename T, glm::precision P>
+        inline glm::detail::tvec3<T, P> cross(const glm::detail::tvec3<T, P>& a,
+                                              const glm::detail::tvec3<T, P>& b)
+        {
+            return glm::cross(a, b);
+        }
+
+        template<typename T, glm::precision P,
+                 template<typename, glm::precision> class V>
+        inline V<T, P> normalize(const V<T, P>& v)
+        {
+            return glm::normalize(v);
+        }
+    } // namespace simd
+
     // please don't hate me
 #define OP1(RetType, op) \
     inline RetType operator op() const \
@@ -72,12 +300,12 @@ namespace sb
 
         inline float dot(const base_type& v) const
         {
-            return glm::dot((const base_type&)*this, v);
+            return simd::dot((const base_type&)*this, v);
         }
 
         inline TVec2 normalized() const
         {
-            return TVec2(glm::normalize((const base_type&)*this));
+            return TVec2(simd::normalize((const base_type&)*this));
         }
 
         inline bool isZero() const
@@ -118,16 +346,16 @@ namespace sb
 
         inline float dot(const base_type& v) const
         {
-            return glm::dot((const base_type&)*this, v);
+            return simd::dot((const base_type&)*this, v);
         }
         inline TVec3 cross(const base_type& v) const
         {
-            return TVec3(glm::cross((const base_type&)*this, v));
+            return TVec3(simd::cross((const base_type&)*this, v));
         }
 
         inline TVec3 normalized() const
         {
-            return TVec3(glm::normalize((const base_type&)*this));
+            return TVec3(simd::normalize((const base_type&)*this));
         }
 
         inline bool isZero() const
@@ -173,12 +401,12 @@ namespace sb
 
         inline float dot(const base_type& v) const
         {
-            return glm::dot((const base_type&)*this, v);
+            return simd::dot((const base_type&)*this, v);
         }
 
         inline TVec4 normalized() const
         {
-            return TVec4(glm::normalize((const base_type&)*this));
+            return TVec4(simd::normalize((const base_type&)*this));
         }
 
         inline bool isZero() const
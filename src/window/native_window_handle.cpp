@@ -43,7 +43,8 @@ GLXFBConfig chooseBestFBConfig(::Display* dpy,
     return configs[bestFbcId];
 }
 
-GLXFBConfig getBestFBConfig(::Display* dpy)
+GLXFBConfig getBestFBConfig(::Display* dpy,
+                            bool headless)
 {
     static const int VISUAL_ATTRIBS[] = {
         GLX_X_RENDERABLE,  True,
@@ -60,15 +61,30 @@ GLXFBConfig getBestFBConfig(::Display* dpy)
         None
     };
 
+    // pbuffer is only used to make the context current, actual rendering
+    // goes to a framebuffer object
+    static const int PBUFFER_ATTRIBS[] = {
+        GLX_DRAWABLE_TYPE, GLX_PBUFFER_BIT,
+        GLX_RENDER_TYPE,   GLX_RGBA_BIT,
+        GLX_RED_SIZE,      8,
+        GLX_GREEN_SIZE,    8,
+        GLX_BLUE_SIZE,     8,
+        GLX_ALPHA_SIZE,    8,
+        None
+    };
+
     gLog.trace("getting framebuffer config\n");
 
     int fbCount;
     GLXFBConfig* fbc = glXChooseFBConfig(dpy, DefaultScreen(dpy),
-                                         VISUAL_ATTRIBS, &fbCount);
+                                         headless ? PBUFFER_ATTRIBS
+                                                  : VISUAL_ATTRIBS,
+                                         &fbCount);
 
     assert(fbc && fbCount && "no available framebuffer configs");
 
-    GLXFBConfig ret = chooseBestFBConfig(dpy, fbc, (unsigned)fbCount);
+    GLXFBConfig ret = headless ? fbc[0]
+                               : chooseBestFBConfig(dpy, fbc, (unsigned)fbCount);
 
     XFree(fbc);
     return ret;
@@ -80,12 +96,14 @@ std::unique_ptr<NativeWindowHandle> NativeWindowHandle::create(sb::Window &owner
                                                                unsigned width,
                                                                unsigned height)
 {
+    // the resource loader thread uses the display too
+    XInitThreads();
     ::Display* dpy = XOpenDisplay(0);
     if (dpy == nullptr) {
         return {};
     }
 
-    GLXFBConfig bestFbc = getBestFBConfig(dpy);
+    GLXFBConfig bestFbc = getBestFBConfig(dpy, false);
     XVisualInfo* vi = glXGetVisualFromFBConfig(dpy, bestFbc);
     gLog.trace("chosen visual id = 0x%x\n", vi->visualid);
 
@@ -95,7 +113,7 @@ std::unique_ptr<NativeWindowHandle> NativeWindowHandle::create(sb::Window &owner
     swa.colormap = XCreateColormap(dpy, rootWnd, vi->visual, AllocNone);
     swa.background_pixmap = None;
     swa.border_pixel = 0;
-    swa.event_mask = StructureNotifyMask
+    swa.event_mask = StructureNotifyMask | ExposureMask
                      | KeyPressMask | KeyReleaseMask
                      | ButtonPressMask | ButtonReleaseMask | PointerMotionMask;
 
@@ -116,7 +134,28 @@ std::unique_ptr<NativeWindowHandle> NativeWindowHandle::create(sb::Window &owner
     gLog.trace("mapping window\n");
     XMapWindow(dpy, wnd);
 
-    auto ret = new NativeWindowHandle(&owner, dpy, wnd, bestFbc);
+    auto ret = new NativeWindowHandle(&owner, dpy, wnd, bestFbc,
+                                      width, height);
+    return std::unique_ptr<NativeWindowHandle>(ret);
+}
+
+std::unique_ptr<NativeWindowHandle>
+NativeWindowHandle::createHeadless(sb::Window &owner,
+                                   unsigned width,
+                                   unsigned height)
+{
+    // the resource loader thread uses the display too
+    XInitThreads();
+    ::Display* dpy = XOpenDisplay(0);
+    if (dpy == nullptr) {
+        gLog.err("cannot open X display, is DISPLAY set?\n");
+        return {};
+    }
+
+    gLog.trace("running headless, %ux%u\n", width, height);
+    GLXFBConfig fbc = getBestFBConfig(dpy, true);
+
+    auto ret = new NativeWindowHandle(&owner, dpy, None, fbc, width, height);
     return std::unique_ptr<NativeWindowHandle>(ret);
 }
 
@@ -257,6 +296,10 @@ LRESULT __stdcall wndProc(HWND hwnd, UINT msg, WPARAM w, LPARAM l)
             wndPtr->mRenderer.setViewport(0, 0, size[0], size[1]);
         }
         break;
+    case WM_PAINT:
+        // window contents were lost, DefWindowProc validates the region
+        wndPtr->mRenderer.invalidate();
+        return ::DefWindowProcA(hwnd, msg, w, l);
     case WM_CLOSE:
         wndPtr->mEvents.push(Event::windowClosedEvent());
         wndPtr->mHandle = {};
@@ -15,25 +15,39 @@ class NativeWindowHandle
 {
 public:
     ::Display *const display;
-    const ::Window window;
+    const ::Window window;      // None if headless
     GLXFBConfig fbConfig;
 
+    // size of the offscreen target, only meaningful if headless
+    const unsigned width;
+    const unsigned height;
+
     static std::unique_ptr<NativeWindowHandle> create(sb::Window &owner,
                                                       unsigned width,
                                                       unsigned height);
+    // no window is created, fbConfig is suitable for a GLX pbuffer
+    static std::unique_ptr<NativeWindowHandle> createHeadless(sb::Window &owner,
+                                                              unsigned width,
+                                                              unsigned height);
 
     ~NativeWindowHandle();
 
+    bool isHeadless() const { return window == None; }
+
 private:
     Window *owner;
 
     NativeWindowHandle(Window *owner,
                        ::Display* dpy,
                        ::Window wnd,
-                       const GLXFBConfig& fbc):
+                       const GLXFBConfig& fbc,
+                       unsigned width,
+                       unsigned height):
         display(dpy),
         window(wnd),
         fbConfig(fbc),
+        width(width),
+        height(height),
         owner(owner)
     {}
 };
@@ -1,6 +1,13 @@
 #include "window.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
+#include <thread>
+
+#if PLATFORM_LINUX
+# include <sys/select.h>
+#endif
 
 #include "utils/string.h"
 #include "utils/logger.h"
@@ -8,12 +15,15 @@
 
 namespace sb {
 
-Window::Window(unsigned width, unsigned height):
+Window::Window(unsigned width, unsigned height, bool headless):
     mHandle(nullptr),
     mLockCursor(false),
     mFullscreen(false),
+    mHeadless(headless),
     mRenderer(),
-    mEvents()
+    mEvents(),
+    mCommandsMutex(),
+    mCommandBuffers()
 
 {
     if (!create(width, height)) {
@@ -21,7 +31,11 @@ Window::Window(unsigned width, unsigned height):
         return;
     }
 
-    mRenderer.init(*mHandle);
+    if (!mRenderer.init(*mHandle)) {
+        gLog.err("cannot initialize renderer");
+        close();
+        return;
+    }
     mRenderer.setViewport(0, 0, width, height);
 }
 
@@ -32,6 +46,13 @@ Window::~Window()
 
 bool Window::create(unsigned width, unsigned height)
 {
+#if PLATFORM_LINUX
+    if (mHeadless) {
+        mHandle = NativeWindowHandle::createHeadless(*this, width, height);
+        return !!mHandle;
+    }
+#endif
+
     mHandle = NativeWindowHandle::create(*this, width, height);
     return !!mHandle;
 }
@@ -46,6 +67,31 @@ bool Window::isOpened()
     return !!mHandle;
 }
 
+void Window::submit(const CommandBuffer& commands)
+{
+    std::lock_guard<std::mutex> lock(mCommandsMutex);
+    mCommandBuffers.push_back(&commands);
+}
+
+void Window::replayCommands()
+{
+    std::vector<const CommandBuffer*> buffers;
+    {
+        std::lock_guard<std::mutex> lock(mCommandsMutex);
+        buffers.swap(mCommandBuffers);
+    }
+
+    // workers may submit in any order, replay must not depend on it
+    std::stable_sort(buffers.begin(), buffers.end(),
+                     [](const CommandBuffer* a, const CommandBuffer* b) {
+                         return a->getOrder() < b->getOrder();
+                     });
+
+    for (const CommandBuffer* commands: buffers) {
+        commands->replay(mRenderer);
+    }
+}
+
 void Window::lockCursor(bool lock)
 {
     mLockCursor = lock;
@@ -56,6 +102,11 @@ Renderer& Window::getRenderer()
     return mRenderer;
 }
 
+Camera& Window::getCamera()
+{
+    return mRenderer.getCamera();
+}
+
 #if PLATFORM_LINUX
 
 void Window::resize(unsigned width, unsigned height)
@@ -76,6 +127,10 @@ bool Window::setFullscreen(bool fullscreen)
 
 const Vec2i Window::getSize()
 {
+    if (mHandle->isHeadless()) {
+        return Vec2i(mHandle->width, mHandle->height);
+    }
+
     XWindowAttributes attribs;
     XGetWindowAttributes(mHandle->display, mHandle->window, &attribs);
 
@@ -152,6 +207,12 @@ bool Window::getEvent(Event& e)
         case DestroyNotify:
             mEvents.push(Event::windowClosedEvent());
             break;
+        case Expose:
+            // window contents were lost, the next frame must not be skipped
+            if (event.xexpose.count == 0) {
+                mRenderer.invalidate();
+            }
+            break;
         default:
             break;
         }
@@ -166,8 +227,43 @@ bool Window::getEvent(Event& e)
     return false;
 }
 
+bool Window::waitForEvent(unsigned timeoutMs)
+{
+    if (!mHandle) {
+        return false;
+    }
+    if (!mEvents.empty()) {
+        return true;
+    }
+
+    if (mHandle->isHeadless()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+        return false;
+    }
+
+    // requests still buffered might be what the server responds to
+    XFlush(mHandle->display);
+    if (XPending(mHandle->display)) {
+        return true;
+    }
+
+    int fd = ConnectionNumber(mHandle->display);
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+
+    timeval timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+    return select(fd + 1, &fds, NULL, NULL, &timeout) > 0;
+}
+
 bool Window::hasFocus()
 {
+    if (mHandle->isHeadless()) {
+        return false;
+    }
+
     ::Window focused;
     int focusState;
     XGetInputFocus(mHandle->display, &focused, &focusState);
@@ -176,6 +272,10 @@ bool Window::hasFocus()
 
 void Window::setTitle(const std::string& str)
 {
+    if (mHandle->isHeadless()) {
+        return;
+    }
+
     XStoreName(mHandle->display, mHandle->window, str.c_str());
 }
 
@@ -186,13 +286,24 @@ void Window::clear(const Color& c)
     mRenderer.clear();
 }
 
+void Window::draw(const Drawable& d)
+{
+    mRenderer.draw(d);
+}
+
 void Window::display()
 {
+    replayCommands();
+    mRenderer.drawAll();
     mRenderer.swapBuffers();
 }
 
 void Window::showCursor(bool show)
 {
+    if (mHandle->isHeadless()) {
+        return;
+    }
+
     if (show) {
         XDefineCursor(mHandle->display, mHandle->window, 0);
         return;
@@ -295,6 +406,18 @@ bool Window::getEvent(Event& e)
     return eventsPending > 0;
 }
 
+bool Window::waitForEvent(unsigned timeoutMs)
+{
+    assert(mHandle && mHandle->window);
+
+    if (!mEvents.empty()) {
+        return true;
+    }
+
+    return ::MsgWaitForMultipleObjects(0, NULL, FALSE, timeoutMs, QS_ALLINPUT)
+           == WAIT_OBJECT_0;
+}
+
 bool Window::hasFocus()
 {
     assert(mHandle && mHandle->window);
@@ -319,7 +442,7 @@ void Window::clear(const Color& c)
     mRenderer.clear();
 }
 
-void Window::draw(Drawable& d)
+void Window::draw(const Drawable& d)
 {
     mRenderer.draw(d);
 }
@@ -328,6 +451,7 @@ void Window::display()
 {
     assert(mHandle && mHandle->window);
 
+    replayCommands();
     mRenderer.drawAll();
     ::SwapBuffers(::GetDC(mHandle->window));
 }
@@ -1,9 +1,12 @@
 #pragma once
 
+#include <mutex>
 #include <queue>
 #include <string>
 #include <memory>
+#include <vector>
 
+#include "rendering/command_buffer.h"
 #include "rendering/renderer.h"
 #include "rendering/color.h"
 #include "rendering/camera.h"
@@ -16,7 +19,8 @@ struct NativeWindowHandle;
 class Window
 {
 public:
-    Window(unsigned width, unsigned height);
+    // headless window has no X window, everything is rendered offscreen
+    Window(unsigned width, unsigned height, bool headless = false);
     ~Window();
 
     Window(const Window&) = delete;
@@ -30,12 +34,18 @@ public:
     const Vec2i getSize();
     void close();
     bool getEvent(Event& e);
+    // blocks until an event arrives or timeoutMs passes, false on timeout.
+    // Lets redraw-on-demand applications sleep while nothing changes
+    bool waitForEvent(unsigned timeoutMs);
     bool isOpened();
     bool hasFocus();
     void setTitle(const std::string& str);
 
     void clear(const Color& c);
-    void draw(Drawable& d);
+    void draw(const Drawable& d);
+    // thread-safe; commands are replayed in display(), ordered by
+    // CommandBuffer::getOrder(). Buffer must not change until then
+    void submit(const CommandBuffer& commands);
     void display();
     void showCursor(bool show = true);
     void lockCursor(bool lock = true);
@@ -50,9 +60,15 @@ private:
 
     bool mLockCursor;
     bool mFullscreen;
+    bool mHeadless;
 
     Renderer mRenderer;
     std::queue<Event> mEvents;
+
+    std::mutex mCommandsMutex;
+    std::vector<const CommandBuffer*> mCommandBuffers;
+
+    void replayCommands();
 };
 
 } // namespace sb